@@ -1,5 +1,9 @@
 #include "esp_camera.h"
+#include "esp_timer.h"
 #include <WiFi.h>
+#include <Preferences.h>
+#include "sensor_profile.h"
+#include "camera_setup.h"
 
 // Camera model
 #define CAMERA_MODEL_AI_THINKER
@@ -9,11 +13,72 @@ const char* ssid = "Comradezeusman";
 const char* password = "Mada@12345678";
 
 void startCameraServer();
+void loadFaceIds();
+void supervisorLoop();
+
+// Boot timeline, printed once the network is up
+#define BOOT_MARKS_MAX 10
+
+static struct {
+  const char *phase;
+  int64_t us;
+} boot_marks[BOOT_MARKS_MAX];
+static int boot_mark_count = 0;
+
+static void boot_mark(const char *phase) {
+  if (boot_mark_count < BOOT_MARKS_MAX) {
+    boot_marks[boot_mark_count].phase = phase;
+    boot_marks[boot_mark_count].us = esp_timer_get_time();
+    boot_mark_count++;
+  }
+}
+
+// Channel and BSSID of the last AP we associated with. Passing them to WiFi.begin() skips the scan.
+#define WIFI_CACHE_NAMESPACE "wifi"
+#define WIFI_FAST_TIMEOUT_MS 3000  // then forget the cache and scan
+
+static bool wifi_cache_load(int32_t *channel, uint8_t *bssid) {
+  Preferences prefs;
+  if (!prefs.begin(WIFI_CACHE_NAMESPACE, true)) {
+    return false;
+  }
+  *channel = prefs.getUChar("channel", 0);
+  bool ok = *channel > 0 && prefs.getBytes("bssid", bssid, 6) == 6;
+  prefs.end();
+  return ok;
+}
+
+static void wifi_cache_save(int32_t channel, const uint8_t *bssid) {
+  int32_t cached_channel;
+  uint8_t cached_bssid[6];
+  if (wifi_cache_load(&cached_channel, cached_bssid) && cached_channel == channel && !memcmp(cached_bssid, bssid, 6)) {
+    return;
+  }
+  Preferences prefs;
+  if (prefs.begin(WIFI_CACHE_NAMESPACE, false)) {
+    prefs.putUChar("channel", channel);
+    prefs.putBytes("bssid", bssid, 6);
+    prefs.end();
+  }
+}
 
 void setup() {
   Serial.begin(115200);
   Serial.setDebugOutput(true);
   Serial.println();
+  boot_mark("start");
+
+  // associate in the background while the camera comes up
+  int32_t channel = 0;
+  uint8_t bssid[6];
+  bool fast = wifi_cache_load(&channel, bssid);
+  if (fast) {
+    WiFi.begin(ssid, password, channel, bssid);
+  } else {
+    WiFi.begin(ssid, password);
+  }
+  boot_mark("wifi begin");
+  loadFaceIds();
 
   camera_config_t config;
   config.ledc_channel = LEDC_CHANNEL_0;
@@ -42,24 +107,42 @@ void setup() {
   if(psramFound()){
     config.frame_size = FRAMESIZE_UXGA;
     config.jpeg_quality = 10;
-    config.fb_count = 2;
   } else {
     config.frame_size = FRAMESIZE_SVGA;
     config.jpeg_quality = 12;
-    config.fb_count = 1;
   }
 
+  // frame buffers and XCLK: driver defaults, then the board's picks, then whatever /camera saved
+  camera_setup_t setup;
+  camera_setup_defaults(&setup);
+#ifdef CAMERA_FB_COUNT
+  setup.fb_count = CAMERA_FB_COUNT;
+#endif
+#ifdef CAMERA_GRAB_MODE
+  setup.grab_mode = CAMERA_GRAB_MODE;
+#endif
+#ifdef CAMERA_FB_LOCATION
+  setup.fb_location = CAMERA_FB_LOCATION;
+#endif
+#ifdef CAMERA_XCLK_MHZ
+  setup.xclk_mhz = CAMERA_XCLK_MHZ;
+#endif
+  camera_setup_load(&setup);
+
 #if defined(CAMERA_MODEL_ESP_EYE)
   pinMode(13, INPUT_PULLUP);
   pinMode(14, INPUT_PULLUP);
 #endif
 
   // camera init
-  esp_err_t err = esp_camera_init(&config);
+  esp_err_t err = camera_setup_init(&config, &setup);
   if (err != ESP_OK) {
     Serial.printf("Camera init failed with error 0x%x", err);
     return;
   }
+  boot_mark("camera init");
+  Serial.printf("Camera: %u frame buffers in %s, grab %s, XCLK %u MHz\n", setup.fb_count, setup.fb_location == CAMERA_FB_IN_PSRAM ? "PSRAM" : "DRAM",
+                setup.grab_mode == CAMERA_GRAB_LATEST ? "latest" : "when empty", setup.xclk_mhz);
 
   sensor_t * s = esp_camera_sensor_get();
   // initial sensors are flipped vertically and colors are a bit saturated
@@ -76,18 +159,49 @@ void setup() {
   s->set_hmirror(s, 1);
 #endif
 
-  WiFi.begin(ssid, password);
+  // a boot profile saved through /profile overrides the defaults above
+  char boot[SENSOR_PROFILE_NAME_MAX + 1];
+  sensor_profile_t profile;
+  if (sensor_profile_get_boot(boot, sizeof(boot)) && sensor_profile_load(boot, &profile)) {
+    int writes;
+    sensor_profile_apply(s, &profile, &writes);
+    Serial.printf("Profile '%s' applied, %d writes\n", boot, writes);
+  }
 
+  boot_mark("sensor setup");
+
+  // the servers listen on any address, so they can start before there is one
+  startCameraServer();
+  boot_mark("servers");
+
+  int64_t wait_start = esp_timer_get_time();
   while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
-    Serial.print(".");
+    if (fast && esp_timer_get_time() - wait_start > WIFI_FAST_TIMEOUT_MS * 1000LL) {
+      // the AP moved or changed channel
+      Serial.println("Cached AP not found, scanning");
+      fast = false;
+      WiFi.disconnect();
+      WiFi.begin(ssid, password);
+    }
+    if (fast) {
+      delay(10);
+    } else {
+      delay(500);
+      Serial.print(".");
+    }
   }
+  boot_mark(fast ? "wifi connected (cached AP)" : "wifi connected");
   Serial.println("");
-  Serial.println("WiFi connected");
+  wifi_cache_save(WiFi.channel(), WiFi.BSSID());
+  // reconnects are up to the supervisor from here
+  WiFi.setAutoReconnect(false);
 
-  startCameraServer();
+  Serial.println("Boot timeline:");
+  for (int i = 0; i < boot_mark_count; i++) {
+    Serial.printf("  %6u ms  %s\n", (uint32_t)(boot_marks[i].us / 1000), boot_marks[i].phase);
+  }
 
-   Serial.println("\nWiFi connected");
+  Serial.println("WiFi connected");
   Serial.print("Stream ready: http://");
   Serial.print(WiFi.localIP());
   Serial.println(":81/stream");
@@ -95,6 +209,6 @@ void setup() {
 }
 
 void loop() {
-  // put your main code here, to run repeatedly:
-  delay(10000);
+  // waits for Wi-Fi, camera, stream and heap faults and recovers from them, see app_httpd.cpp
+  supervisorLoop();
 }
@@ -11,14 +11,27 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <atomic>
 #include "esp_http_server.h"
 #include "esp_timer.h"
+#include "esp32-hal-psram.h"
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_heap_caps.h"
 #include "esp_camera.h"
 #include "img_converters.h"
+#include "esp_jpg_decode.h"
 #include "fb_gfx.h"
 #include "esp32-hal-ledc.h"
 #include "sdkconfig.h"
-#include "camera_index.h"
+#include "jpg_overlay.h"
+#include "sensor_profile.h"
+#include "camera_setup.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
 
 #if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
 #include "esp32-hal-log.h"
@@ -82,28 +95,92 @@
 #define LED_LEDC_GPIO            22  //configure LED pin
 #define CONFIG_LED_MAX_INTENSITY 255
 
-int led_duty = 0;
-bool isStreaming = false;
-
 #endif
 
+// Settings written by the control handlers on port 80 and read every frame by the streams on port
+// 81, RCU style: a writer copies the current snapshot into a spare slot, changes it and publishes it
+// with one pointer store, readers copy whatever snapshot is current once per frame, without a lock.
+// Readers count themselves on the slot while they copy it, and a writer waits for a spare slot's
+// count to drop to zero before it reuses it.
 typedef struct {
-  httpd_req_t *req;
-  size_t len;
-} jpg_chunking_t;
+  int led_duty;
+  int8_t detection_enabled;
+  // draw boxes on JPEG frames in the compressed domain instead of decoding and re-encoding them
+  int8_t mcu_overlay_enabled;
+  int8_t recognition_enabled;
+  int8_t is_enrolling;
+} settings_t;
+
+#define SETTINGS_SLOTS 4
+
+static settings_t settings_slots[SETTINGS_SLOTS] = {{0, 0, 1, 0, 0}};
+static std::atomic<uint8_t> settings_readers[SETTINGS_SLOTS];
+static std::atomic<const settings_t *> settings_current(&settings_slots[0]);
+static SemaphoreHandle_t settings_lock = NULL;  // one writer at a time
+static int settings_spare = 1;
+
+static settings_t settings_get() {
+  while (true) {
+    const settings_t *cur = settings_current.load();
+    std::atomic<uint8_t> *readers = &settings_readers[cur - settings_slots];
+    readers->fetch_add(1);
+    // still current after the count went up, so no writer can be in it until the count drops
+    if (settings_current.load() == cur) {
+      settings_t copy = *cur;
+      readers->fetch_sub(1);
+      return copy;
+    }
+    readers->fetch_sub(1);
+  }
+}
+
+// Returns a copy of the current settings to change and hand to settings_publish()
+static settings_t *settings_edit() {
+  xSemaphoreTake(settings_lock, portMAX_DELAY);
+  while (settings_readers[settings_spare].load()) {
+    vTaskDelay(1);
+  }
+  settings_t *next = &settings_slots[settings_spare];
+  *next = *settings_current.load(std::memory_order_relaxed);
+  return next;
+}
+
+static void settings_publish(settings_t *next) {
+  settings_current.store(next);
+  settings_spare = (settings_spare + 1) % SETTINGS_SLOTS;
+  xSemaphoreGive(settings_lock);
+}
+
+static void settings_init() {
+  if (!settings_lock) {
+    settings_lock = xSemaphoreCreateMutex();
+  }
+}
+
+// Open streams of every kind (/stream, its thumb variant, /raw_stream), the LED stays on while
+// there is one
+static std::atomic<int> streams_open(0);
+
+// Serve the brotli copies of the UI as well. Browsers only offer br over HTTPS,
+// so they just take flash unless the camera sits behind a TLS proxy.
+#define CONFIG_UI_BROTLI 0
+
+#include "camera_index.h"
+
 
 #define PART_BOUNDARY "123456789000000000000987654321"
 static const char *_STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
 static const char *_STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
+static const char *_MULTIPART_END = "\r\n--" PART_BOUNDARY "--\r\n";
+static const char *_BURST_CONTENT_TYPE = "multipart/mixed;boundary=" PART_BOUNDARY;
 static const char *_STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %d.%06d\r\n\r\n";
+static const char *_STREAM_PART_FACES = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %d.%06d\r\nX-Faces: %s\r\n\r\n";
 
 httpd_handle_t stream_httpd = NULL;
 httpd_handle_t camera_httpd = NULL;
 
 #if CONFIG_ESP_FACE_DETECT_ENABLED
 
-static int8_t detection_enabled = 0;
-
 // #if TWO_STAGE
 // static HumanFaceDetectMSR01 s1(0.1F, 0.5F, 10, 0.2F);
 // static HumanFaceDetectMNP01 s2(0.5F, 0.3F, 5);
@@ -112,9 +189,6 @@ static int8_t detection_enabled = 0;
 // #endif
 
 #if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-static int8_t recognition_enabled = 0;
-static int8_t is_enrolling = 0;
-
 #if QUANT_TYPE
 // S16 model
 FaceRecognition112V1S16 recognizer;
@@ -122,6 +196,7 @@ FaceRecognition112V1S16 recognizer;
 // S8 model
 FaceRecognition112V1S8 recognizer;
 #endif
+static volatile bool face_ids_loaded = false;
 #endif
 
 #endif
@@ -166,6 +241,576 @@ static int ra_filter_run(ra_filter_t *filter, int value) {
 }
 #endif
 
+// Boards without PSRAM run in low memory mode: conversions work from one static arena instead of
+// heap buffers, every frame endpoint has a heap budget it must fit in, and the servers get
+// smaller stacks.
+#ifdef BOARD_HAS_PSRAM
+#define CONFIG_LOW_MEMORY 0
+#else
+#define CONFIG_LOW_MEMORY 1
+#endif
+
+// Heap use per request type, for the internal heap and PSRAM: sampled on entry and exit, after
+// allocations and converter calls, and once per frame. The all time low water mark catches peaks
+// between samples when a request sets a new one. Exported at /metrics.
+typedef enum {
+  MEM_CAPTURE,
+  MEM_BMP,
+  MEM_STREAM,
+  MEM_RAW,
+  MEM_CONTROL,
+  MEM_STATUS,
+  MEM_REGISTERS,
+  MEM_PROFILE,
+  MEM_CAMERA,
+  MEM_PAGE,
+  MEM_TIMELAPSE,
+  MEM_ENDPOINTS
+} mem_endpoint_t;
+
+#define MEM_HEAPS 2
+static const uint32_t mem_heap_caps[MEM_HEAPS] = {MALLOC_CAP_INTERNAL, MALLOC_CAP_SPIRAM};
+static const char *const mem_heap_names[MEM_HEAPS] = {"internal", "psram"};
+
+typedef struct {
+  size_t peak;         // most taken by one request
+  size_t min_free;     // least free while serving
+  size_t min_largest;  // smallest largest free block while serving
+} mem_heap_stats_t;
+
+typedef struct {
+  const char *name;
+  size_t budget;  // largest free internal block needed to start, low memory mode only
+  uint32_t requests;
+  uint32_t rejected;
+  uint32_t failures;  // allocations or conversions that failed
+  uint32_t min_stack;  // least free stack of the task serving it
+  mem_heap_stats_t heap[MEM_HEAPS];
+} mem_stats_t;
+
+static mem_stats_t mem_stats[MEM_ENDPOINTS] = {
+  {"capture", 12 * 1024}, {"bmp", 8 * 1024}, {"stream", 12 * 1024}, {"raw", 4 * 1024}, {"control"},
+  {"status"}, {"registers"}, {"profile"}, {"camera"}, {"page"}, {"timelapse"},
+};
+
+class MemScope;
+// The request the running task is serving, for samples taken deep in the frame pipeline
+static __thread MemScope *mem_scope = NULL;
+
+class MemScope {
+public:
+  explicit MemScope(mem_endpoint_t endpoint) : stats(&mem_stats[endpoint]), outer(mem_scope) {
+    for (int i = 0; i < MEM_HEAPS; i++) {
+      entry[i] = heap_caps_get_free_size(mem_heap_caps[i]);
+      low[i] = entry[i];
+      low_ever[i] = heap_caps_get_minimum_free_size(mem_heap_caps[i]);
+    }
+    stats->requests++;
+    mem_scope = this;
+  }
+
+  // Answers 503 and returns false when the endpoint's budget doesn't fit right now
+  bool admit(httpd_req_t *req) {
+#if CONFIG_LOW_MEMORY
+    if (heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL) < stats->budget) {
+      stats->rejected++;
+      log_e("%s: not enough memory", stats->name);
+      httpd_resp_set_status(req, "503 Service Unavailable");
+      httpd_resp_set_hdr(req, "Retry-After", "1");
+      httpd_resp_send(req, NULL, 0);
+      return false;
+    }
+#endif
+    return true;
+  }
+
+  void sample() {
+    for (int i = 0; i < MEM_HEAPS; i++) {
+      mem_heap_stats_t *h = &stats->heap[i];
+      size_t available = heap_caps_get_free_size(mem_heap_caps[i]);
+      size_t largest = heap_caps_get_largest_free_block(mem_heap_caps[i]);
+      if (available < low[i]) {
+        low[i] = available;
+      }
+      if (!h->min_largest || largest < h->min_largest) {
+        h->min_largest = largest;
+      }
+    }
+  }
+
+  void failed() {
+    stats->failures++;
+  }
+
+  ~MemScope() {
+    sample();
+    for (int i = 0; i < MEM_HEAPS; i++) {
+      mem_heap_stats_t *h = &stats->heap[i];
+      size_t ever = heap_caps_get_minimum_free_size(mem_heap_caps[i]);
+      if (ever < low_ever[i] && ever < low[i]) {
+        low[i] = ever;
+      }
+      if (entry[i] - low[i] > h->peak) {
+        h->peak = entry[i] - low[i];
+      }
+      if (!h->min_free || low[i] < h->min_free) {
+        h->min_free = low[i];
+      }
+    }
+    uint32_t stack = uxTaskGetStackHighWaterMark(NULL);
+    if (!stats->min_stack || stack < stats->min_stack) {
+      stats->min_stack = stack;
+    }
+    mem_scope = outer;
+  }
+
+private:
+  mem_stats_t *stats;
+  MemScope *outer;
+  size_t entry[MEM_HEAPS];
+  size_t low[MEM_HEAPS];
+  size_t low_ever[MEM_HEAPS];
+};
+
+// Sample point after an allocation or converter call, a no-op outside of a request
+static void mem_sample() {
+  if (mem_scope) {
+    mem_scope->sample();
+  }
+}
+
+// Counts a failed allocation or conversion against the request
+static void mem_failed() {
+  if (mem_scope) {
+    mem_scope->failed();
+  }
+}
+
+#if CONFIG_LOW_MEMORY
+// The pool is a single static work arena, used by one conversion at a time. It holds the RGB565
+// thumbnail of an SVGA frame (the no-PSRAM boot size) decoded at 1/4, which also covers a BMP
+// strip of it. Larger frames get a smaller thumbnail, see thumb_shift().
+#define WORK_ARENA_SIZE    (((800 + 7) >> 2) * ((600 + 7) >> 2) * 2)
+#define WORK_ARENA_WAIT_MS 1000
+
+static uint8_t work_arena[WORK_ARENA_SIZE];
+static SemaphoreHandle_t work_arena_lock = NULL;
+static size_t work_arena_peak = 0;
+
+static uint8_t *frame_pool_get(size_t len) {
+  if (len > WORK_ARENA_SIZE || xSemaphoreTake(work_arena_lock, WORK_ARENA_WAIT_MS / portTICK_PERIOD_MS) != pdTRUE) {
+    log_e("Work arena: %u bytes not available", len);
+    mem_failed();
+    return NULL;
+  }
+  if (len > work_arena_peak) {
+    work_arena_peak = len;
+  }
+  return work_arena;
+}
+
+static void frame_pool_put(uint8_t *buf) {
+  if (buf == work_arena) {
+    xSemaphoreGive(work_arena_lock);
+  } else {
+    free(buf);
+  }
+}
+
+static void frame_pool_trim() {}
+
+static void frame_pool_init() {
+  if (!work_arena_lock) {
+    work_arena_lock = xSemaphoreCreateBinary();
+    xSemaphoreGive(work_arena_lock);
+  }
+}
+#else
+// Conversion buffers (RGB888 frames, detector thumbnails) are recycled instead of
+// being allocated and freed for every frame. Requests the pool can't serve fall back to the heap.
+#define FRAME_POOL_SLOTS 3
+
+typedef struct {
+  uint8_t *buf;
+  size_t size;
+  bool in_use;
+} frame_pool_slot_t;
+
+static frame_pool_slot_t frame_pool[FRAME_POOL_SLOTS];
+static SemaphoreHandle_t frame_pool_lock = NULL;
+
+static uint8_t *frame_pool_get(size_t len) {
+  uint8_t *buf = NULL;
+  frame_pool_slot_t *fit = NULL;
+  frame_pool_slot_t *spare = NULL;
+
+  xSemaphoreTake(frame_pool_lock, portMAX_DELAY);
+  for (int i = 0; i < FRAME_POOL_SLOTS; i++) {
+    frame_pool_slot_t *slot = &frame_pool[i];
+    if (slot->in_use) {
+      continue;
+    }
+    if (slot->size >= len) {
+      if (!fit || slot->size < fit->size) {
+        fit = slot;
+      }
+    } else if (!spare || slot->size < spare->size) {
+      spare = slot;
+    }
+  }
+  if (!fit && spare) {
+    free(spare->buf);
+    spare->buf = (uint8_t *)malloc(len);
+    spare->size = spare->buf ? len : 0;
+    if (spare->buf) {
+      fit = spare;
+    }
+  }
+  if (fit) {
+    fit->in_use = true;
+    buf = fit->buf;
+  }
+  xSemaphoreGive(frame_pool_lock);
+
+  if (!buf) {
+    buf = (uint8_t *)malloc(len);
+    if (!buf) {
+      mem_failed();
+    }
+  }
+  mem_sample();
+  return buf;
+}
+
+static void frame_pool_put(uint8_t *buf) {
+  xSemaphoreTake(frame_pool_lock, portMAX_DELAY);
+  for (int i = 0; i < FRAME_POOL_SLOTS; i++) {
+    if (frame_pool[i].in_use && frame_pool[i].buf == buf) {
+      frame_pool[i].in_use = false;
+      xSemaphoreGive(frame_pool_lock);
+      return;
+    }
+  }
+  xSemaphoreGive(frame_pool_lock);
+  free(buf);
+}
+
+// Frees the buffers nobody is using, they are allocated again on demand
+static void frame_pool_trim() {
+  xSemaphoreTake(frame_pool_lock, portMAX_DELAY);
+  for (int i = 0; i < FRAME_POOL_SLOTS; i++) {
+    if (!frame_pool[i].in_use) {
+      free(frame_pool[i].buf);
+      frame_pool[i].buf = NULL;
+      frame_pool[i].size = 0;
+    }
+  }
+  xSemaphoreGive(frame_pool_lock);
+}
+
+static void frame_pool_init() {
+  if (!frame_pool_lock) {
+    frame_pool_lock = xSemaphoreCreateMutex();
+  }
+}
+#endif
+
+// Recent sensor JPEGs, copied out of the driver's buffers by whoever is already pulling frames
+// (the stream, or the keep-warm task), so /capture can answer without waiting for a new exposure.
+// Each slot carries its own camera_fb_t, so ring frames go through the same pipeline as driver frames.
+#ifdef BOARD_HAS_PSRAM
+#define CONFIG_FRAME_RING_ENABLED 1
+#else
+#define CONFIG_FRAME_RING_ENABLED 0
+#endif
+
+#define FRAME_RING_SLOTS      3
+#define FRAME_RING_MAX_AGE_MS 250  // older frames are not served, the sensor is probably not running
+
+static int8_t keep_warm_enabled = 0;
+
+// Thumbnails for /stream?variant=thumb and the face detector, decoded straight to scale
+#define THUMB_MIN_WIDTH 160
+
+// RGB565 buffer for a frame decoded at 1/2^shift, the decoder writes whole MCUs
+static size_t thumb_len(int width, int height, uint8_t shift) {
+  return ((width + 7) >> shift) * ((height + 7) >> shift) * 2;
+}
+
+// Decoder scale that brings the width closest to THUMB_MIN_WIDTH without going under it. In low
+// memory mode the thumbnail gets smaller until it fits the work arena.
+static uint8_t thumb_shift(int width, int height) {
+  uint8_t shift = 0;
+  while (shift < JPG_SCALE_8X && (width >> (shift + 1)) >= THUMB_MIN_WIDTH) {
+    shift++;
+  }
+#if CONFIG_LOW_MEMORY
+  while (shift < JPG_SCALE_8X && thumb_len(width, height, shift) > WORK_ARENA_SIZE) {
+    shift++;
+  }
+#endif
+  return shift;
+}
+
+#if CONFIG_FRAME_RING_ENABLED
+typedef struct {
+  camera_fb_t fb;
+  size_t size;
+  int64_t stored;
+  uint8_t refs;
+  bool valid;
+} frame_ring_slot_t;
+
+static frame_ring_slot_t frame_ring[FRAME_RING_SLOTS];
+static SemaphoreHandle_t frame_ring_lock = NULL;
+static TaskHandle_t keep_warm_task = NULL;
+
+static void frame_ring_publish(camera_fb_t *fb) {
+  if (fb->format != PIXFORMAT_JPEG) {
+    return;
+  }
+  frame_ring_slot_t *slot = NULL;
+  xSemaphoreTake(frame_ring_lock, portMAX_DELAY);
+  for (int i = 0; i < FRAME_RING_SLOTS; i++) {
+    frame_ring_slot_t *s = &frame_ring[i];
+    if (!s->refs && (!slot || !s->valid || (slot->valid && s->stored < slot->stored))) {
+      slot = s;
+    }
+  }
+  if (slot) {
+    // claimed while copying so readers skip it
+    slot->valid = false;
+    slot->refs = 1;
+  }
+  xSemaphoreGive(frame_ring_lock);
+  if (!slot) {
+    return;
+  }
+
+  if (slot->size < fb->len) {
+    free(slot->fb.buf);
+    slot->fb.buf = (uint8_t *)malloc(fb->len);
+    slot->size = slot->fb.buf ? fb->len : 0;
+  }
+  bool copied = slot->fb.buf != NULL;
+  if (copied) {
+    uint8_t *buf = slot->fb.buf;
+    slot->fb = *fb;
+    slot->fb.buf = buf;
+    memcpy(buf, fb->buf, fb->len);
+  }
+
+  xSemaphoreTake(frame_ring_lock, portMAX_DELAY);
+  slot->refs = 0;
+  slot->valid = copied;
+  slot->stored = esp_timer_get_time();
+  xSemaphoreGive(frame_ring_lock);
+}
+
+// Newest frame not older than max_age_ms, or NULL. Give it back with frame_fb_return().
+static camera_fb_t *frame_ring_get(int max_age_ms) {
+  frame_ring_slot_t *slot = NULL;
+  int64_t oldest = esp_timer_get_time() - max_age_ms * 1000LL;
+  xSemaphoreTake(frame_ring_lock, portMAX_DELAY);
+  for (int i = 0; i < FRAME_RING_SLOTS; i++) {
+    frame_ring_slot_t *s = &frame_ring[i];
+    if (s->valid && s->stored >= oldest && (!slot || s->stored > slot->stored)) {
+      slot = s;
+    }
+  }
+  if (slot) {
+    slot->refs++;
+  }
+  xSemaphoreGive(frame_ring_lock);
+  return slot ? &slot->fb : NULL;
+}
+
+static frame_ring_slot_t *frame_ring_slot(camera_fb_t *fb) {
+  for (int i = 0; i < FRAME_RING_SLOTS; i++) {
+    if (fb == &frame_ring[i].fb) {
+      return &frame_ring[i];
+    }
+  }
+  return NULL;
+}
+
+// Frames captured before a settings change must not be served after it
+static void frame_ring_flush() {
+  xSemaphoreTake(frame_ring_lock, portMAX_DELAY);
+  for (int i = 0; i < FRAME_RING_SLOTS; i++) {
+    frame_ring[i].valid = false;
+  }
+  xSemaphoreGive(frame_ring_lock);
+}
+
+static void frame_fb_return(camera_fb_t *fb) {
+  frame_ring_slot_t *slot = frame_ring_slot(fb);
+  if (!slot) {
+    camera_fb_return(fb);
+    return;
+  }
+  xSemaphoreTake(frame_ring_lock, portMAX_DELAY);
+  slot->refs--;
+  xSemaphoreGive(frame_ring_lock);
+}
+
+// The stream feeds the ring with frames it grabs anyway; the tasks below only grab
+// frames themselves while it doesn't, so they never compete with it for the sensor.
+static int64_t frame_ring_fed = 0;
+
+static void frame_ring_feed(camera_fb_t *fb) {
+  frame_ring_publish(fb);
+  frame_ring_fed = esp_timer_get_time();
+}
+
+// Grabs a frame into the ring unless a stream is feeding it. Returns false when it didn't.
+static bool frame_ring_fill() {
+  if (esp_timer_get_time() - frame_ring_fed < FRAME_RING_MAX_AGE_MS * 1000LL) {
+    return false;
+  }
+  camera_fb_t *fb = camera_fb_get();
+  if (!fb) {
+    log_e("Camera capture failed");
+    return false;
+  }
+  frame_ring_publish(fb);
+  camera_fb_return(fb);
+  return true;
+}
+
+// Keeps the ring filled while nothing else is pulling frames
+static void keep_warm_loop(void *arg) {
+  while (true) {
+    if (!keep_warm_enabled || !frame_ring_fill()) {
+      vTaskDelay(20 / portTICK_PERIOD_MS);
+    }
+  }
+}
+
+// Simulcast thumbnails: every new ring frame is scaled down once and the result is shared by
+// all /stream?variant=thumb clients. The task is pinned to core 0, away from the Arduino core.
+#define THUMB_TASK_CORE 0
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  struct timeval timestamp;
+  uint32_t seq;
+} thumb_frame_t;
+
+static thumb_frame_t thumb_frame;
+static int thumb_clients = 0;
+static SemaphoreHandle_t thumb_lock = NULL;
+static TaskHandle_t thumb_task = NULL;
+
+static void thumb_loop(void *arg) {
+  struct timeval last = {0, 0};
+  while (true) {
+    if (!thumb_clients) {
+      vTaskDelay(50 / portTICK_PERIOD_MS);
+      continue;
+    }
+    frame_ring_fill();
+    camera_fb_t *fb = frame_ring_get(FRAME_RING_MAX_AGE_MS);
+    if (!fb || (fb->timestamp.tv_sec == last.tv_sec && fb->timestamp.tv_usec == last.tv_usec)) {
+      if (fb) {
+        frame_fb_return(fb);
+      }
+      vTaskDelay(5 / portTICK_PERIOD_MS);
+      continue;
+    }
+    last = fb->timestamp;
+
+    uint8_t shift = thumb_shift(fb->width, fb->height);
+    int width = fb->width >> shift;
+    int height = fb->height >> shift;
+    uint8_t *rgb_buf = frame_pool_get(thumb_len(fb->width, fb->height, shift));
+    bool s = rgb_buf && jpg2rgb565(fb->buf, fb->len, rgb_buf, (jpg_scale_t)shift);
+    frame_fb_return(fb);
+    uint8_t *jpg_buf = NULL;
+    size_t jpg_len = 0;
+    s = s && fmt2jpg(rgb_buf, width * height * 2, width, height, PIXFORMAT_RGB565, 80, &jpg_buf, &jpg_len);
+    if (rgb_buf) {
+      frame_pool_put(rgb_buf);
+    }
+    if (!s) {
+      log_e("Thumbnail failed");
+      continue;
+    }
+
+    xSemaphoreTake(thumb_lock, portMAX_DELAY);
+    uint8_t *old = thumb_frame.buf;
+    thumb_frame.buf = jpg_buf;
+    thumb_frame.len = jpg_len;
+    thumb_frame.timestamp = last;
+    thumb_frame.seq++;
+    xSemaphoreGive(thumb_lock);
+    free(old);
+  }
+}
+
+static void thumb_client_add(int n) {
+  xSemaphoreTake(thumb_lock, portMAX_DELAY);
+  thumb_clients += n;
+  if (!thumb_task) {
+    xTaskCreatePinnedToCore(thumb_loop, "thumb", 4096, NULL, 5, &thumb_task, THUMB_TASK_CORE);
+  }
+  xSemaphoreGive(thumb_lock);
+}
+
+static void frame_ring_init() {
+  if (!frame_ring_lock) {
+    frame_ring_lock = xSemaphoreCreateMutex();
+    thumb_lock = xSemaphoreCreateMutex();
+  }
+}
+
+static void keep_warm_set(int enable) {
+  keep_warm_enabled = enable;
+  if (enable && !keep_warm_task) {
+    xTaskCreate(keep_warm_loop, "keep_warm", 4096, NULL, 5, &keep_warm_task);
+  }
+}
+#else
+static void frame_ring_feed(camera_fb_t *fb) {}
+static camera_fb_t *frame_ring_get(int max_age_ms) {
+  return NULL;
+}
+static void frame_ring_flush() {}
+static void frame_fb_return(camera_fb_t *fb) {
+  camera_fb_return(fb);
+}
+static void frame_ring_init() {}
+static void keep_warm_set(int enable) {
+  keep_warm_enabled = enable;
+}
+#endif
+
+// Detector output is copied once into fixed, contiguous storage. Everything downstream
+// (drawing, overlay, recognition, metadata) works from it without allocating per frame.
+#define FACE_RESULTS_MAX 8
+#define FACE_KEYPOINTS   10
+
+typedef struct {
+  size_t count;
+  int16_t box[FACE_RESULTS_MAX][4];  //x0, y0, x1, y1
+  float score[FACE_RESULTS_MAX];
+  int16_t keypoint[FACE_RESULTS_MAX][FACE_KEYPOINTS];  //left eye, mouth left, nose, right eye, mouth right
+} face_results_t;
+
+// "x,y,w,h,score;..." with the score in percent, for the X-Faces header
+static size_t face_results_print(const face_results_t *faces, char *buf, size_t len) {
+  size_t n = 0;
+  buf[0] = 0;
+  for (size_t i = 0; i < faces->count && n < len; i++) {
+    n += snprintf(
+      buf + n, len - n, "%s%d,%d,%d,%d,%u", i ? ";" : "", faces->box[i][0], faces->box[i][1], faces->box[i][2] - faces->box[i][0] + 1,
+      faces->box[i][3] - faces->box[i][1] + 1, (unsigned)(faces->score[i] * 100)
+    );
+  }
+  return n < len ? n : len - 1;
+}
+
 #if CONFIG_ESP_FACE_DETECT_ENABLED
 #if CONFIG_ESP_FACE_RECOGNITION_ENABLED
 static void rgb_print(fb_data_t *fb, uint32_t color, const char *str) {
@@ -197,7 +842,23 @@ static int rgb_printf(fb_data_t *fb, uint32_t color, const char *format, ...) {
   return len;
 }
 #endif
-static void draw_face_boxes(fb_data_t *fb, std::list<dl::detect::result_t> *results, int face_id) {
+static size_t face_results_set(face_results_t *faces, std::list<dl::detect::result_t> &results, uint8_t shift) {
+  int scale = 1 << shift;
+  faces->count = 0;
+  for (std::list<dl::detect::result_t>::iterator prediction = results.begin(); prediction != results.end() && faces->count < FACE_RESULTS_MAX; prediction++) {
+    size_t i = faces->count++;
+    for (int j = 0; j < 4; j++) {
+      faces->box[i][j] = prediction->box[j] * scale;
+    }
+    faces->score[i] = prediction->score;
+    for (size_t j = 0; j < FACE_KEYPOINTS; j++) {
+      faces->keypoint[i][j] = j < prediction->keypoint.size() ? prediction->keypoint[j] * scale : 0;
+    }
+  }
+  return faces->count;
+}
+
+static void draw_face_boxes(fb_data_t *fb, const face_results_t *faces, int face_id) {
   int x, y, w, h;
   uint32_t color = FACE_COLOR_YELLOW;
   if (face_id < 0) {
@@ -209,13 +870,12 @@ static void draw_face_boxes(fb_data_t *fb, std::list<dl::detect::result_t> *resu
     //color = ((color >> 8) & 0xF800) | ((color >> 3) & 0x07E0) | (color & 0x001F);
     color = ((color >> 16) & 0x001F) | ((color >> 3) & 0x07E0) | ((color << 8) & 0xF800);
   }
-  int i = 0;
-  for (std::list<dl::detect::result_t>::iterator prediction = results->begin(); prediction != results->end(); prediction++, i++) {
+  for (size_t i = 0; i < faces->count; i++) {
     // rectangle box
-    x = (int)prediction->box[0];
-    y = (int)prediction->box[1];
-    w = (int)prediction->box[2] - x + 1;
-    h = (int)prediction->box[3] - y + 1;
+    x = faces->box[i][0];
+    y = faces->box[i][1];
+    w = faces->box[i][2] - x + 1;
+    h = faces->box[i][3] - y + 1;
     if ((x + w) > fb->width) {
       w = fb->width - x;
     }
@@ -228,27 +888,81 @@ static void draw_face_boxes(fb_data_t *fb, std::list<dl::detect::result_t> *resu
     fb_gfx_drawFastVLine(fb, x + w - 1, y, h, color);
 #if TWO_STAGE
     // landmarks (left eye, mouth left, nose, right eye, mouth right)
-    int x0, y0, j;
-    for (j = 0; j < 10; j += 2) {
-      x0 = (int)prediction->keypoint[j];
-      y0 = (int)prediction->keypoint[j + 1];
-      fb_gfx_fillRect(fb, x0, y0, 3, 3, color);
+    for (int j = 0; j < FACE_KEYPOINTS; j += 2) {
+      fb_gfx_fillRect(fb, faces->keypoint[i][j], faces->keypoint[i][j + 1], 3, 3, color);
     }
 #endif
   }
 }
 
+// JPEG frames are run through the detector on a scaled-down RGB565 thumbnail.
+// TJpgDec produces 1/8 scale straight from the DC coefficients (1/2 and 1/4 from a
+// reduced IDCT), so a frame without faces is never fully decoded or re-encoded.
+
+typedef struct {
+  uint8_t *buf;
+  int width;
+  int height;
+  uint8_t shift;  //log2 of the downscale factor
+} face_thumb_t;
+
+static bool face_detect_on_thumb(camera_fb_t *fb, const settings_t *cfg) {
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+  // recognition needs full resolution landmarks
+  if (cfg->recognition_enabled) {
+    return false;
+  }
+#endif
+  return fb->format == PIXFORMAT_JPEG;
+}
+
+static bool face_thumb_decode(camera_fb_t *fb, face_thumb_t *thumb) {
+  uint8_t shift = thumb_shift(fb->width, fb->height);
+  thumb->shift = shift;
+  thumb->width = fb->width >> shift;
+  thumb->height = fb->height >> shift;
+  thumb->buf = frame_pool_get(thumb_len(fb->width, fb->height, shift));
+  if (!thumb->buf) {
+    log_e("thumb malloc failed");
+    return false;
+  }
+  if (!jpg2rgb565(fb->buf, fb->len, thumb->buf, (jpg_scale_t)shift)) {
+    frame_pool_put(thumb->buf);
+    thumb->buf = NULL;
+    return false;
+  }
+  return true;
+}
+
+static bool face_overlay_jpeg(camera_fb_t *fb, const face_results_t *faces, uint8_t **out, size_t *out_len) {
+  jpg_overlay_box_t boxes[FACE_RESULTS_MAX];
+  for (size_t i = 0; i < faces->count; i++) {
+    boxes[i].x = faces->box[i][0];
+    boxes[i].y = faces->box[i][1];
+    boxes[i].w = faces->box[i][2] - faces->box[i][0] + 1;
+    boxes[i].h = faces->box[i][3] - faces->box[i][1] + 1;
+  }
+  return jpg_overlay_boxes(fb->buf, fb->len, boxes, faces->count, FACE_COLOR_YELLOW, out, out_len);
+}
+
 #if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-static int run_face_recognition(fb_data_t *fb, std::list<dl::detect::result_t> *results) {
-  std::vector<int> landmarks = results->front().keypoint;
+// landmarks is owned by the caller and sized FACE_KEYPOINTS up front, so assign() does not allocate
+static int run_face_recognition(fb_data_t *fb, const face_results_t *faces, std::vector<int> &landmarks, bool enrolling) {
+  landmarks.assign(faces->keypoint[0], faces->keypoint[0] + FACE_KEYPOINTS);
   int id = -1;
 
   Tensor<uint8_t> tensor;
   tensor.set_element((uint8_t *)fb->data).set_shape({fb->height, fb->width, 3}).set_auto_free(false);
 
+  // the IDs are still being read from flash
+  if (!face_ids_loaded) {
+    rgb_print(fb, FACE_COLOR_YELLOW, "Loading IDs");
+    return -1;
+  }
+
   int enrolled_count = recognizer.get_enrolled_id_num();
 
-  if (enrolled_count < FACE_ID_SAVE_NUMBER && is_enrolling) {
+  if (enrolled_count < FACE_ID_SAVE_NUMBER && enrolling) {
     id = recognizer.enroll_id(tensor, landmarks, "", true);
     log_i("Enrolled ID: %d", id);
     rgb_printf(fb, FACE_COLOR_CYAN, "ID[%u]", id);
@@ -265,10 +979,16 @@ static int run_face_recognition(fb_data_t *fb, std::list<dl::detect::result_t> *
 #endif
 #endif
 
+// Capture time of a frame in esp_timer µs, the driver stamps frames at VSYNC
+static int64_t frame_fb_time(camera_fb_t *fb) {
+  return (int64_t)fb->timestamp.tv_sec * 1000000LL + fb->timestamp.tv_usec;
+}
+
 #if CONFIG_LED_ILLUMINATOR_ENABLED
 void enable_led(bool en) {  // Turn LED On or Off
+  int led_duty = settings_get().led_duty;
   int duty = en ? led_duty : 0;
-  if (en && isStreaming && (led_duty > CONFIG_LED_MAX_INTENSITY)) {
+  if (en && streams_open && (led_duty > CONFIG_LED_MAX_INTENSITY)) {
     duty = CONFIG_LED_MAX_INTENSITY;
   }
   ledcWrite(LED_LEDC_GPIO, duty);
@@ -276,74 +996,821 @@ void enable_led(bool en) {  // Turn LED On or Off
   //ledc_update_duty(CONFIG_LED_LEDC_SPEED_MODE, CONFIG_LED_LEDC_CHANNEL);
   log_i("Set LED intensity to %d", duty);
 }
-#endif
-
-static esp_err_t bmp_handler(httpd_req_t *req) {
-  camera_fb_t *fb = NULL;
-  esp_err_t res = ESP_OK;
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-  uint64_t fr_start = esp_timer_get_time();
-#endif
-  fb = esp_camera_fb_get();
-  if (!fb) {
-    log_e("Camera capture failed");
-    httpd_resp_send_500(req);
-    return ESP_FAIL;
-  }
 
-  httpd_resp_set_type(req, "image/x-windows-bmp");
-  httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.bmp");
-  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+#define FLASH_MAX_FRAMES 5
+#define FLASH_PERIOD_US  (70 * 1000)  // frame period assumed until two frames give the real one
 
-  char ts[32];
-  snprintf(ts, 32, "%lld.%06ld", fb->timestamp.tv_sec, fb->timestamp.tv_usec);
-  httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
+// Instead of sleeping a fixed 150ms after turning the LED on, drop the frames that weren't exposed
+// under it. The driver stamps frames with esp_timer time at VSYNC, at the end of their exposure, so
+// a frame is lit all the way through only when its stamp is a frame period or more after the LED
+// went on. The period is measured between the stamps of the frames dropped on the way, buffered
+// frames are discarded right away.
+typedef struct {
+  int64_t lit;  // LED on
+  int64_t last;  // stamp of the previous frame
+  int64_t period;
+  int skipped;
+  bool done;  // a lit frame came in, the ones after it are kept
+} flash_wait_t;
+
+static void flash_wait_begin(flash_wait_t *w) {
+  w->lit = esp_timer_get_time();
+  w->last = 0;
+  w->period = FLASH_PERIOD_US;
+  w->skipped = 0;
+  w->done = false;
+}
 
-  uint8_t *buf = NULL;
-  size_t buf_len = 0;
-  bool converted = frame2bmp(fb, &buf, &buf_len);
-  esp_camera_fb_return(fb);
-  if (!converted) {
-    log_e("BMP Conversion failed");
-    httpd_resp_send_500(req);
-    return ESP_FAIL;
+// True when fb should be dropped, up to FLASH_MAX_FRAMES of them
+static bool flash_wait_drop(flash_wait_t *w, camera_fb_t *fb) {
+  if (w->done) {
+    return false;
   }
-  res = httpd_resp_send(req, (const char *)buf, buf_len);
-  free(buf);
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-  uint64_t fr_end = esp_timer_get_time();
-#endif
-  log_i("BMP: %llums, %uB", (uint64_t)((fr_end - fr_start) / 1000), buf_len);
-  return res;
+  int64_t t = frame_fb_time(fb);
+  if (w->last && t > w->last) {
+    w->period = t - w->last;
+  }
+  w->last = t;
+  w->done = t >= w->lit + w->period || w->skipped++ >= FLASH_MAX_FRAMES;
+  return !w->done;
 }
 
-static size_t jpg_encode_stream(void *arg, size_t index, const void *data, size_t len) {
-  jpg_chunking_t *j = (jpg_chunking_t *)arg;
-  if (!index) {
-    j->len = 0;
+static camera_fb_t *flash_fb_get() {
+  enable_led(true);
+  flash_wait_t wait;
+  flash_wait_begin(&wait);
+  camera_fb_t *fb = camera_fb_get();
+  while (fb && flash_wait_drop(&wait, fb)) {
+    camera_fb_return(fb);
+    fb = camera_fb_get();
   }
-  if (httpd_resp_send_chunk(j->req, (const char *)data, len) != ESP_OK) {
-    return 0;
+  enable_led(false);
+  return fb;
+}
+#endif
+
+typedef struct {
+  httpd_req_t *req;
+  size_t len;
+} jpg_chunking_t;
+
+static size_t jpg_encode_stream(void *arg, size_t index, const void *data, size_t len) {
+  jpg_chunking_t *j = (jpg_chunking_t *)arg;
+  if (!index) {
+    j->len = 0;
+    // the encoder's buffers are all allocated by the first chunk
+    mem_sample();
+  }
+  if (httpd_resp_send_chunk(j->req, (const char *)data, len) != ESP_OK) {
+    return 0;
   }
   j->len += len;
   return len;
 }
 
-static esp_err_t capture_handler(httpd_req_t *req) {
+// Frame pipeline shared by /capture, /bmp and /stream:
+//   camera fb -> Detector (optional face detection/recognition + drawing) -> Encoder (JPEG or BMP)
+// Detectors and encoders are template policies, so every endpoint gets the same conversion,
+// buffer pooling and detection logic without virtual calls or per endpoint copies of it.
+//
+// Encoder policy:
+//   static const bool accepts_jpeg;  // whether an already encoded JPEG can be handed over as is
+//   esp_err_t frame(frame_out_t *out);  // encode out->fb unchanged
+//   esp_err_t pixels(frame_out_t *out, const uint8_t *buf, size_t len, int w, int h, pixformat_t format, uint8_t quality);
+//   esp_err_t encoded(frame_out_t *out, uint8_t *buf, size_t len);  // takes ownership of a malloc'ed JPEG
+//
+// Detector policy:
+//   bool enabled(const frame_out_t *out);
+//   template<class Encoder> esp_err_t process(Encoder &enc, frame_out_t *out);
+
+typedef struct {
+  int64_t start;
+  int64_t ready;
+  int64_t face;
+  int64_t recognize;
+  int64_t encode;
+} frame_timing_t;
+
+typedef struct {
+  camera_fb_t *fb;  // NULL once returned to the driver
+  int width;
+  int height;
+  const uint8_t *buf;
+  size_t len;
+  uint8_t *owned;  // heap buffer behind buf, freed on release
+  settings_t cfg;  // taken once per frame
+  const face_results_t *faces;
+  int face_id;
+  frame_timing_t t;
+} frame_out_t;
+
+static void frame_out_init(frame_out_t *out, camera_fb_t *fb) {
+  memset(out, 0, sizeof(frame_out_t));
+  out->fb = fb;
+  out->cfg = settings_get();
+  if (fb) {
+    out->width = fb->width;
+    out->height = fb->height;
+  }
+  out->t.start = esp_timer_get_time();
+  out->t.ready = out->t.start;
+  out->t.face = out->t.start;
+  out->t.recognize = out->t.start;
+  out->t.encode = out->t.start;
+}
+
+static void frame_return_fb(frame_out_t *out) {
+  if (out->fb) {
+    frame_fb_return(out->fb);
+    out->fb = NULL;
+  }
+}
+
+static void frame_out_release(frame_out_t *out) {
+  frame_return_fb(out);
+  free(out->owned);
+  out->owned = NULL;
+  out->buf = NULL;
+}
+
+static size_t frame_faces_print(const frame_out_t *out, char *buf, size_t len) {
+  if (!out->faces || !out->faces->count) {
+    return 0;
+  }
+  return face_results_print(out->faces, buf, len);
+}
+
+// Encoders that write straight into the HTTP response
+class ResponseEncoder {
+public:
+  // Once part of the response has gone out an error status can't follow, the client only sees
+  // it cut short
+  bool started() const {
+    return sent;
+  }
+
+protected:
+  explicit ResponseEncoder(httpd_req_t *req) : req(req) {}
+
+  // httpd keeps the pointer until the headers go out, hence static. Only the main server's
+  // task encodes into responses.
+  void set_faces_hdr(const frame_out_t *out) {
+    static char faces_hdr[FACE_RESULTS_MAX * 32];
+    if (frame_faces_print(out, faces_hdr, sizeof(faces_hdr))) {
+      httpd_resp_set_hdr(req, "X-Faces", faces_hdr);
+    }
+  }
+
+  httpd_req_t *req;
+  bool sent = false;
+};
+
+// Sends the JPEG while it is being encoded. Used by /capture.
+class JpegChunkEncoder : public ResponseEncoder {
+public:
+  static const bool accepts_jpeg = true;
+
+  explicit JpegChunkEncoder(httpd_req_t *req) : ResponseEncoder(req) {}
+
+  esp_err_t frame(frame_out_t *out) {
+    camera_fb_t *fb = out->fb;
+    if (fb->format == PIXFORMAT_JPEG) {
+      return send(out, fb->buf, fb->len);
+    }
+    return pixels(out, fb->buf, fb->len, fb->width, fb->height, fb->format, 80);
+  }
+
+  esp_err_t pixels(frame_out_t *out, const uint8_t *buf, size_t len, int w, int h, pixformat_t format, uint8_t quality) {
+    set_faces_hdr(out);
+    jpg_chunking_t jchunk = {req, 0};
+    bool s = fmt2jpg_cb((uint8_t *)buf, len, w, h, format, quality, jpg_encode_stream, &jchunk);
+    out->len = jchunk.len;
+    sent = jchunk.len > 0;
+    if (!s) {
+      log_e("JPEG compression failed");
+      mem_failed();
+      return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+  }
+
+  esp_err_t encoded(frame_out_t *out, uint8_t *buf, size_t len) {
+    out->owned = buf;
+    return send(out, buf, len);
+  }
+
+private:
+  esp_err_t send(frame_out_t *out, const uint8_t *buf, size_t len) {
+    set_faces_hdr(out);
+    out->buf = buf;
+    out->len = len;
+    sent = true;
+    return httpd_resp_send(req, (const char *)buf, len);
+  }
+};
+
+// Leaves a complete JPEG in out->buf, pointing into the fb when the sensor JPEG is passed through. Used by /stream.
+class JpegBufferEncoder {
+public:
+  static const bool accepts_jpeg = true;
+
+  esp_err_t frame(frame_out_t *out) {
+    camera_fb_t *fb = out->fb;
+    if (fb->format == PIXFORMAT_JPEG) {
+      out->buf = fb->buf;
+      out->len = fb->len;
+      return ESP_OK;
+    }
+    uint8_t *buf = NULL;
+    size_t len = 0;
+    bool s = frame2jpg(fb, 80, &buf, &len);
+    mem_sample();
+    frame_return_fb(out);
+    if (!s) {
+      log_e("JPEG compression failed");
+      mem_failed();
+      return ESP_FAIL;
+    }
+    return encoded(out, buf, len);
+  }
+
+  esp_err_t pixels(frame_out_t *out, const uint8_t *buf, size_t len, int w, int h, pixformat_t format, uint8_t quality) {
+    uint8_t *jpg_buf = NULL;
+    size_t jpg_len = 0;
+    bool s = fmt2jpg((uint8_t *)buf, len, w, h, format, quality, &jpg_buf, &jpg_len);
+    mem_sample();
+    if (!s) {
+      log_e("fmt2jpg failed");
+      mem_failed();
+      return ESP_FAIL;
+    }
+    return encoded(out, jpg_buf, jpg_len);
+  }
+
+  esp_err_t encoded(frame_out_t *out, uint8_t *buf, size_t len) {
+    out->owned = buf;
+    out->buf = buf;
+    out->len = len;
+    return ESP_OK;
+  }
+};
+
+// Leaves a BMP in out->buf. Used by /bmp.
+#define BMP_HEADER_LEN 54
+#define BMP_STRIP_ROWS 16  // also the tallest JPEG MCU
+
+// Sends the BMP while converting it, a strip of rows at a time, so the working memory is one
+// strip (plus a copy of the JPEG, which lets the camera buffer go back before decoding, except in
+// low memory mode) instead of a complete width * height * 3 image. Used by /bmp.
+class BmpEncoder : public ResponseEncoder {
+public:
+  static const bool accepts_jpeg = false;
+
+  explicit BmpEncoder(httpd_req_t *req) : ResponseEncoder(req) {}
+
+  esp_err_t frame(frame_out_t *out) {
+    if (out->fb->format == PIXFORMAT_JPEG) {
+      return jpeg(out);
+    }
+    camera_fb_t *fb = out->fb;
+    return pixels(out, fb->buf, fb->len, fb->width, fb->height, fb->format, 0);
+  }
+
+  esp_err_t pixels(frame_out_t *out, const uint8_t *buf, size_t len, int w, int h, pixformat_t format, uint8_t quality) {
+    size_t src_stride = len / h;
+    size_t stride = w * 3;
+    esp_err_t res = begin(out, w, h);
+    for (int y = 0; y < h && res == ESP_OK; y += BMP_STRIP_ROWS) {
+      int rows = h - y < BMP_STRIP_ROWS ? h - y : BMP_STRIP_ROWS;
+      const uint8_t *src = buf + y * src_stride;
+      if (format == PIXFORMAT_RGB888) {
+        res = send(out, src, rows * stride);
+      } else if (!fmt2rgb888(src, rows * src_stride, format, strip)) {
+        log_e("BMP Conversion failed");
+        mem_failed();
+        res = ESP_FAIL;
+      } else {
+        res = send(out, strip, rows * stride);
+      }
+    }
+    return end(out, res);
+  }
+
+  esp_err_t encoded(frame_out_t *out, uint8_t *buf, size_t len) {
+    free(buf);
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+
+  size_t working_len() const {
+    return peak;
+  }
+
+private:
+  esp_err_t jpeg(frame_out_t *out) {
+    camera_fb_t *fb = out->fb;
+    size_t jpg_len = fb->len;
+#if CONFIG_LOW_MEMORY
+    // the arena holds the strip, the camera buffer is kept while decoding instead
+    jpg = fb->buf;
+#else
+    jpg = frame_pool_get(jpg_len);
+    if (!jpg) {
+      log_e("jpg copy malloc failed");
+      return ESP_FAIL;
+    }
+    memcpy(jpg, fb->buf, jpg_len);
+    frame_return_fb(out);
+    peak = jpg_len;
+#endif
+
+    dest = out;
+    decode_res = ESP_OK;
+    esp_err_t res = esp_jpg_decode(jpg_len, JPG_SCALE_NONE, jpg_read, jpg_write, this);
+    mem_sample();
+#if CONFIG_LOW_MEMORY
+    frame_return_fb(out);
+#else
+    frame_pool_put(jpg);
+#endif
+    jpg = NULL;
+    if (res != ESP_OK && decode_res == ESP_OK) {
+      log_e("JPG Decompression Failed!");
+      mem_failed();
+    }
+    return end(out, decode_res == ESP_OK ? res : decode_res);
+  }
+
+  static size_t jpg_read(void *arg, size_t index, uint8_t *buf, size_t len) {
+    BmpEncoder *enc = (BmpEncoder *)arg;
+    if (buf) {
+      memcpy(buf, enc->jpg + index, len);
+    }
+    return len;
+  }
+
+  // Called once per MCU, left to right, a row of MCUs at a time. A strip is sent
+  // when the decoder moves on to the next MCU row.
+  static bool jpg_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+    BmpEncoder *enc = (BmpEncoder *)arg;
+    if (enc->decode_res != ESP_OK) {
+      return false;
+    }
+    if (!data) {
+      if (x == 0 && y == 0) {
+        enc->decode_res = enc->begin(enc->dest, w, h);
+        enc->strip_y = 0;
+        enc->strip_rows = 0;
+      } else {
+        enc->decode_res = enc->flush();
+      }
+      return enc->decode_res == ESP_OK;
+    }
+    if (y != enc->strip_y) {
+      enc->decode_res = enc->flush();
+      enc->strip_y = y;
+    }
+    enc->strip_rows = h;
+    size_t stride = enc->width * 3;
+    uint8_t *o = enc->strip + x * 3;
+    for (int iy = 0; iy < h; iy++, o += stride) {
+      for (int ix = 0; ix < w * 3; ix += 3) {
+        o[ix] = data[ix + 2];
+        o[ix + 1] = data[ix + 1];
+        o[ix + 2] = data[ix];
+      }
+      data += w * 3;
+    }
+    return enc->decode_res == ESP_OK;
+  }
+
+  esp_err_t flush() {
+    esp_err_t err = strip_rows ? send(dest, strip, strip_rows * width * 3) : ESP_OK;
+    strip_rows = 0;
+    return err;
+  }
+
+  esp_err_t begin(frame_out_t *out, int w, int h) {
+    width = w;
+    strip = frame_pool_get(w * 3 * BMP_STRIP_ROWS);
+    if (!strip) {
+      log_e("strip malloc failed");
+      return ESP_FAIL;
+    }
+    peak += w * 3 * BMP_STRIP_ROWS;
+
+    uint8_t hdr[BMP_HEADER_LEN] = {'B', 'M'};
+    uint32_t data_len = w * h * 3;
+    // negative height: rows are stored top-down, in the order they come out of the sensor and the decoder
+    uint32_t fields[] = {BMP_HEADER_LEN + data_len, 0, BMP_HEADER_LEN, 40, (uint32_t)w, (uint32_t)-h, 1 | (24 << 16), 0, data_len, 0, 0, 0, 0};
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+      for (int b = 0; b < 4; b++) {
+        hdr[2 + i * 4 + b] = fields[i] >> (8 * b);
+      }
+    }
+    set_faces_hdr(out);
+    out->len = 0;
+    return send(out, hdr, BMP_HEADER_LEN);
+  }
+
+  esp_err_t end(frame_out_t *out, esp_err_t res) {
+    if (strip) {
+      frame_pool_put(strip);
+      strip = NULL;
+    }
+    if (res == ESP_OK) {
+      res = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return res;
+  }
+
+  esp_err_t send(frame_out_t *out, const uint8_t *buf, size_t len) {
+    out->len += len;
+    sent = true;
+    return httpd_resp_send_chunk(req, (const char *)buf, len);
+  }
+
+  frame_out_t *dest = NULL;
+  uint8_t *jpg = NULL;
+  uint8_t *strip = NULL;
+  int width = 0;
+  uint16_t strip_y = 0;
+  uint16_t strip_rows = 0;
+  size_t peak = 0;
+  esp_err_t decode_res = ESP_OK;
+};
+
+class NoDetector {
+public:
+  bool enabled(const frame_out_t *out) {
+    return false;
+  }
+
+  template<class Encoder> esp_err_t process(Encoder &enc, frame_out_t *out) {
+    return enc.frame(out);
+  }
+};
+
+#if CONFIG_ESP_FACE_DETECT_ENABLED
+class FaceDetector {
+public:
+  bool enabled(const frame_out_t *out) {
+    return out->cfg.detection_enabled && (out->fb->width <= 400 || face_detect_on_thumb(out->fb, &out->cfg));
+  }
+
+  template<class Encoder> esp_err_t process(Encoder &enc, frame_out_t *out) {
+    camera_fb_t *fb = out->fb;
+    faces.count = 0;
+
+    if (fb->format == PIXFORMAT_RGB565
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+        && !out->cfg.recognition_enabled
+#endif
+    ) {
+      out->t.ready = esp_timer_get_time();
+      size_t count = detect((uint16_t *)fb->buf, fb->width, fb->height, 0);
+      out->t.face = esp_timer_get_time();
+      out->t.recognize = out->t.face;
+      if (!count) {
+        return enc.frame(out);
+      }
+      fb_data_t rfb;
+      rfb.width = fb->width;
+      rfb.height = fb->height;
+      rfb.data = fb->buf;
+      rfb.bytes_per_pixel = 2;
+      rfb.format = FB_RGB565;
+      draw_face_boxes(&rfb, &faces, out->face_id);
+      out->faces = &faces;
+      esp_err_t res = enc.pixels(out, fb->buf, fb->len, fb->width, fb->height, PIXFORMAT_RGB565, 90);
+      frame_return_fb(out);
+      return res;
+    }
+
+    bool detect_on_thumb = face_detect_on_thumb(fb, &out->cfg);
+    if (detect_on_thumb) {
+      face_thumb_t thumb;
+      if (!face_thumb_decode(fb, &thumb)) {
+        log_e("JPEG thumbnail decode failed");
+        return ESP_FAIL;
+      }
+      out->t.ready = esp_timer_get_time();
+      detect((uint16_t *)thumb.buf, thumb.width, thumb.height, thumb.shift);
+      frame_pool_put(thumb.buf);
+      out->t.face = esp_timer_get_time();
+      out->t.recognize = out->t.face;
+      if (!faces.count) {
+        // nothing to draw, send the sensor JPEG as is
+        return enc.frame(out);
+      }
+      out->faces = &faces;
+      uint8_t *jpg_buf = NULL;
+      size_t jpg_len = 0;
+      if (Encoder::accepts_jpeg && out->cfg.mcu_overlay_enabled && face_overlay_jpeg(fb, &faces, &jpg_buf, &jpg_len)) {
+        frame_return_fb(out);
+        return enc.encoded(out, jpg_buf, jpg_len);
+      }
+    }
+
+    int width = fb->width;
+    int height = fb->height;
+    size_t rgb_len = width * height * 3;
+    uint8_t *rgb_buf = frame_pool_get(rgb_len);
+    if (!rgb_buf) {
+      log_e("out_buf malloc failed");
+      return ESP_FAIL;
+    }
+    bool s = fmt2rgb888(fb->buf, fb->len, fb->format, rgb_buf);
+    mem_sample();
+    frame_return_fb(out);
+    if (!s) {
+      frame_pool_put(rgb_buf);
+      log_e("To rgb888 failed");
+      mem_failed();
+      return ESP_FAIL;
+    }
+
+    fb_data_t rfb;
+    rfb.width = width;
+    rfb.height = height;
+    rfb.data = rgb_buf;
+    rfb.bytes_per_pixel = 3;
+    rfb.format = FB_BGR888;
+
+    if (!detect_on_thumb) {
+      out->t.ready = esp_timer_get_time();
+      detect(rgb_buf, width, height, 0);
+      out->t.face = esp_timer_get_time();
+      out->t.recognize = out->t.face;
+    }
+
+    if (faces.count > 0) {
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+      if (out->cfg.recognition_enabled) {
+        out->face_id = run_face_recognition(&rfb, &faces, landmarks, out->cfg.is_enrolling);
+        out->t.recognize = esp_timer_get_time();
+      }
+#endif
+      draw_face_boxes(&rfb, &faces, out->face_id);
+      out->faces = &faces;
+    }
+
+    esp_err_t res = enc.pixels(out, rgb_buf, rgb_len, width, height, PIXFORMAT_RGB888, 90);
+    frame_pool_put(rgb_buf);
+    return res;
+  }
+
+private:
+  template<typename T> size_t detect(T *img, int width, int height, uint8_t shift) {
+#if TWO_STAGE
+    std::list<dl::detect::result_t> &candidates = s1.infer(img, {height, width, 3});
+    std::list<dl::detect::result_t> &results = s2.infer(img, {height, width, 3}, candidates);
+#else
+    std::list<dl::detect::result_t> &results = s1.infer(img, {height, width, 3});
+#endif
+    return face_results_set(&faces, results, shift);
+  }
+
+#if TWO_STAGE
+  HumanFaceDetectMSR01 s1{0.1F, 0.5F, 10, 0.2F};
+  HumanFaceDetectMNP01 s2{0.5F, 0.3F, 5};
+#else
+  HumanFaceDetectMSR01 s1{0.3F, 0.5F, 10, 0.2F};
+#endif
+  face_results_t faces;
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+  std::vector<int> landmarks = std::vector<int>(FACE_KEYPOINTS);
+#endif
+};
+
+typedef FaceDetector frame_detector_t;
+#else
+typedef NoDetector frame_detector_t;
+#endif
+
+template<class Detector, class Encoder> static esp_err_t frame_process(Detector &det, Encoder &enc, frame_out_t *out) {
+  esp_err_t res = det.enabled(out) ? det.process(enc, out) : enc.frame(out);
+  out->t.encode = esp_timer_get_time();
+  return res;
+}
+
+static esp_err_t parse_get(httpd_req_t *req, char **obuf) {
+  char *buf = NULL;
+  size_t buf_len = 0;
+
+  buf_len = httpd_req_get_url_query_len(req) + 1;
+  if (buf_len > 1) {
+    buf = (char *)malloc(buf_len);
+    if (!buf) {
+      httpd_resp_send_500(req);
+      return ESP_FAIL;
+    }
+    if (httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK) {
+      *obuf = buf;
+      return ESP_OK;
+    }
+    free(buf);
+  }
+  httpd_resp_send_404(req);
+  return ESP_FAIL;
+}
+
+static int parse_get_var(char *buf, const char *key, int def) {
+  char _int[16];
+  if (httpd_query_key_value(buf, key, _int, sizeof(_int)) != ESP_OK) {
+    return def;
+  }
+  return atoi(_int);
+}
+
+#define PART_HDR_MAX (128 + FACE_RESULTS_MAX * 32)
+
+// One part of a multipart response: boundary, part headers and the JPEG. The part headers are
+// printed into part_buf, PART_HDR_MAX bytes, which the caller keeps off the httpd task's stack.
+static esp_err_t send_jpeg_part(httpd_req_t *req, char *part_buf, const uint8_t *buf, size_t len, const struct timeval *timestamp, const char *faces) {
+  esp_err_t res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
+  if (res == ESP_OK) {
+    size_t hlen;
+    if (faces) {
+      hlen = snprintf(part_buf, PART_HDR_MAX, _STREAM_PART_FACES, len, timestamp->tv_sec, timestamp->tv_usec, faces);
+    } else {
+      hlen = snprintf(part_buf, PART_HDR_MAX, _STREAM_PART, len, timestamp->tv_sec, timestamp->tv_usec);
+    }
+    res = httpd_resp_send_chunk(req, part_buf, hlen);
+  }
+  if (res == ESP_OK) {
+    res = httpd_resp_send_chunk(req, (const char *)buf, len);
+  }
+  return res;
+}
+
+static esp_err_t bmp_handler(httpd_req_t *req) {
   camera_fb_t *fb = NULL;
   esp_err_t res = ESP_OK;
+  MemScope mem(MEM_BMP);
+  if (!mem.admit(req)) {
+    return ESP_OK;
+  }
+  fb = camera_fb_get();
+  if (!fb) {
+    log_e("Camera capture failed");
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+
+  httpd_resp_set_type(req, "image/x-windows-bmp");
+  httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.bmp");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  char ts[32];
+  snprintf(ts, 32, "%lld.%06ld", fb->timestamp.tv_sec, fb->timestamp.tv_usec);
+  httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
+
+  frame_detector_t detector;
+  BmpEncoder encoder(req);
+  frame_out_t out;
+  frame_out_init(&out, fb);
+  res = frame_process(detector, encoder, &out);
+  frame_out_release(&out);
+  if (res != ESP_OK) {
+    if (!encoder.started()) {
+      httpd_resp_send_500(req);
+    }
+    return ESP_FAIL;
+  }
 #if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
+  uint64_t fr_end = esp_timer_get_time();
+#endif
+  log_i("BMP: %llums, %uB, working memory %uB", (uint64_t)((fr_end - out.t.start) / 1000), out.len, encoder.working_len());
+  return res;
+}
+
+#define BURST_MAX_FRAMES 16
+
+// /capture?burst=N&interval_ms=M: N consecutive frames in one multipart/mixed response,
+// each part with its own X-Timestamp. With interval_ms=0 frames are taken back to back,
+// so the rate is bounded by the sensor rather than by HTTP round trips.
+static esp_err_t burst_handler(httpd_req_t *req, int count, int interval_ms) {
+  esp_err_t res = ESP_OK;
+  static char faces_hdr[FACE_RESULTS_MAX * 32];
+  static char part_buf[PART_HDR_MAX];
+  frame_detector_t detector;
+  JpegBufferEncoder encoder;
+  frame_out_t out;
+  int sent = 0;
+
+  if (count > BURST_MAX_FRAMES) {
+    count = BURST_MAX_FRAMES;
+  }
+
+  httpd_resp_set_type(req, _BURST_CONTENT_TYPE);
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+#if CONFIG_LED_ILLUMINATOR_ENABLED
+  // the LED stays on for the whole burst instead of flashing per frame
+  bool flash = settings_get().led_duty && !streams_open;
+  flash_wait_t flash_wait;
+  if (flash) {
+    enable_led(true);
+    flash_wait_begin(&flash_wait);
+  }
+#endif
   int64_t fr_start = esp_timer_get_time();
+  int64_t next_frame = fr_start;
+
+  while (sent < count) {
+    camera_fb_t *fb = camera_fb_get();
+    if (!fb) {
+      log_e("Camera capture failed");
+      res = ESP_FAIL;
+      break;
+    }
+#if CONFIG_LED_ILLUMINATOR_ENABLED
+    if (flash && flash_wait_drop(&flash_wait, fb)) {
+      camera_fb_return(fb);
+      continue;
+    }
 #endif
+    struct timeval timestamp = fb->timestamp;
+    frame_out_init(&out, fb);
+    res = frame_process(detector, encoder, &out);
+    if (res == ESP_OK) {
+      bool faces = frame_faces_print(&out, faces_hdr, sizeof(faces_hdr));
+      res = send_jpeg_part(req, part_buf, out.buf, out.len, &timestamp, faces ? faces_hdr : NULL);
+    }
+    frame_out_release(&out);
+    if (res != ESP_OK) {
+      break;
+    }
+    sent++;
+
+    if (interval_ms > 0 && sent < count) {
+      next_frame += interval_ms * 1000LL;
+      int64_t wait = next_frame - esp_timer_get_time();
+      if (wait > 0) {
+        vTaskDelay(wait / 1000 / portTICK_PERIOD_MS);
+      }
+    }
+  }
 
 #if CONFIG_LED_ILLUMINATOR_ENABLED
-  enable_led(true);
-  vTaskDelay(150 / portTICK_PERIOD_MS);  // The LED needs to be turned on ~150ms before the call to esp_camera_fb_get()
-  fb = esp_camera_fb_get();              // or it won't be visible in the frame. A better way to do this is needed.
-  enable_led(false);
+  if (flash) {
+    enable_led(false);
+  }
+#endif
+
+  if (res == ESP_OK) {
+    res = httpd_resp_send_chunk(req, _MULTIPART_END, strlen(_MULTIPART_END));
+  }
+  if (res == ESP_OK) {
+    res = httpd_resp_send_chunk(req, NULL, 0);
+  } else {
+    log_e("Send burst failed");
+  }
+#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
+  int64_t fr_end = esp_timer_get_time();
+#endif
+  log_i("BURST: %d/%d frames %ums", sent, count, (uint32_t)((fr_end - fr_start) / 1000));
+  return res;
+}
+
+static esp_err_t capture_handler(httpd_req_t *req) {
+  camera_fb_t *fb = NULL;
+  esp_err_t res = ESP_OK;
+  MemScope mem(MEM_CAPTURE);
+  if (!mem.admit(req)) {
+    return ESP_OK;
+  }
+
+  if (httpd_req_get_url_query_len(req)) {
+    char *buf = NULL;
+    if (parse_get(req, &buf) != ESP_OK) {
+      return ESP_FAIL;
+    }
+    int burst = parse_get_var(buf, "burst", 0);
+    int interval_ms = parse_get_var(buf, "interval_ms", 0);
+    free(buf);
+    if (burst > 0) {
+      return burst_handler(req, burst, interval_ms);
+    }
+  }
+
+#if CONFIG_LED_ILLUMINATOR_ENABLED
+  // the stream keeps the LED on, so its frames are lit already
+  bool flash = settings_get().led_duty && !streams_open;
 #else
-  fb = esp_camera_fb_get();
+  bool flash = false;
 #endif
+  if (!flash) {
+    fb = frame_ring_get(FRAME_RING_MAX_AGE_MS);
+  }
+#if CONFIG_LED_ILLUMINATOR_ENABLED
+  if (!fb && flash) {
+    fb = flash_fb_get();
+  }
+#endif
+  if (!fb) {
+    fb = camera_fb_get();
+  }
 
   if (!fb) {
     log_e("Camera capture failed");
@@ -359,168 +1826,954 @@ static esp_err_t capture_handler(httpd_req_t *req) {
   snprintf(ts, 32, "%lld.%06ld", fb->timestamp.tv_sec, fb->timestamp.tv_usec);
   httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
 
-#if CONFIG_ESP_FACE_DETECT_ENABLED
-  size_t out_len, out_width, out_height;
-  uint8_t *out_buf;
-  bool s;
+  frame_detector_t detector;
+  JpegChunkEncoder encoder(req);
+  frame_out_t out;
+  frame_out_init(&out, fb);
+  res = frame_process(detector, encoder, &out);
+  frame_out_release(&out);
+  if (res != ESP_OK) {
+    if (!encoder.started()) {
+      httpd_resp_send_500(req);
+    }
+    return ESP_FAIL;
+  }
 #if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-  bool detected = false;
-#endif
-  int face_id = 0;
-  if (!detection_enabled || fb->width > 400) {
+  int64_t fr_end = esp_timer_get_time();
 #endif
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-    size_t fb_len = 0;
+  if (out.faces) {
+    log_i("FACE: %uB %ums DETECTED %d", (uint32_t)(out.len), (uint32_t)((fr_end - out.t.start) / 1000), out.face_id);
+  } else {
+    log_i("JPG: %uB %ums", (uint32_t)(out.len), (uint32_t)((fr_end - out.t.start) / 1000));
+  }
+  return res;
+}
+
+// On-device time-lapse: a task takes a frame every interval_ms on a fixed grid of esp_timer
+// deadlines and keeps the JPEGs in a PSRAM ring, /timelapse/frames hands them out in bulk.
+// Clients fetch whenever they like instead of polling /capture on time.
+#define TIMELAPSE_STORE_SIZE      (2 * 1024 * 1024)
+#define TIMELAPSE_MAX_FRAMES      512
+#define TIMELAPSE_MIN_INTERVAL_MS 100
+#define TIMELAPSE_FETCH_MAX       64  // frames per /timelapse/frames response
+
+typedef struct {
+  uint32_t seq;
+  uint32_t offset;  // into the store
+  uint32_t len;
+  struct timeval timestamp;
+} timelapse_frame_t;
+
+typedef struct {
+  bool running;
+  uint32_t interval_ms;
+  uint32_t count;  // frames to take, 0 for no limit
+  int64_t next;    // esp_timer time of the next frame
+  uint32_t taken;
+  uint32_t missed;   // deadlines that passed while the previous frame was still being taken
+  uint32_t failed;   // grabs, encodes or stores that failed
+  uint32_t evicted;  // frames overwritten before anyone dropped them
+
+  // Frames are written one after the other and wrap at the end of the store, so the oldest
+  // ones are always right after `head`. Their index is a ring of `stored` entries from `first`.
+  uint8_t *store;
+  size_t size;
+  size_t head;
+  size_t used;
+  timelapse_frame_t *frames;
+  uint32_t first;
+  uint32_t stored;
+  uint32_t next_seq;
+  uint32_t pinned;  // frame being sent by /timelapse/frames, it and newer ones are not evicted
+} timelapse_t;
+
+static timelapse_t timelapse = {false, 1000};
+static SemaphoreHandle_t timelapse_lock = NULL;
+static TaskHandle_t timelapse_task = NULL;
+
+static timelapse_frame_t *timelapse_frame(uint32_t i) {
+  return &timelapse.frames[(timelapse.first + i) % TIMELAPSE_MAX_FRAMES];
+}
+
+// Drops the oldest frame, false when it is the one being sent
+static bool timelapse_evict() {
+  timelapse_frame_t *f = timelapse_frame(0);
+  if (f->seq == timelapse.pinned) {
+    return false;
+  }
+  timelapse.used -= f->len;
+  timelapse.first = (timelapse.first + 1) % TIMELAPSE_MAX_FRAMES;
+  timelapse.stored--;
+  if (!timelapse.stored) {
+    timelapse.head = 0;
+  }
+  return true;
+}
+
+// Called with timelapse_lock held
+static esp_err_t timelapse_store(const uint8_t *buf, size_t len, const struct timeval *timestamp) {
+  if (!timelapse.store || len > timelapse.size / 2) {
+    return ESP_ERR_NO_MEM;
+  }
+  size_t pos = timelapse.head;
+  if (pos + len > timelapse.size) {
+    // the frames between head and the end are the oldest ones
+    while (timelapse.stored && timelapse_frame(0)->offset >= timelapse.head) {
+      if (!timelapse_evict()) {
+        return ESP_ERR_NO_MEM;
+      }
+      timelapse.evicted++;
+    }
+    pos = 0;
+  }
+  while (timelapse.stored) {
+    timelapse_frame_t *f = timelapse_frame(0);
+    bool overlaps = f->offset < pos + len && pos < f->offset + f->len;
+    if (!overlaps && timelapse.stored < TIMELAPSE_MAX_FRAMES) {
+      break;
+    }
+    if (!timelapse_evict()) {
+      return ESP_ERR_NO_MEM;
+    }
+    timelapse.evicted++;
+  }
+
+  memcpy(timelapse.store + pos, buf, len);
+  timelapse_frame_t *f = timelapse_frame(timelapse.stored);
+  f->seq = timelapse.next_seq++;
+  f->offset = pos;
+  f->len = len;
+  f->timestamp = *timestamp;
+  timelapse.stored++;
+  timelapse.used += len;
+  timelapse.head = pos + len;
+  return ESP_OK;
+}
+
+// Same frame sources as /capture, without face detection
+static esp_err_t timelapse_capture() {
+  camera_fb_t *fb = NULL;
+#if CONFIG_LED_ILLUMINATOR_ENABLED
+  bool flash = settings_get().led_duty && !streams_open;
+#else
+  bool flash = false;
 #endif
-    if (fb->format == PIXFORMAT_JPEG) {
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-      fb_len = fb->len;
+  if (!flash) {
+    fb = frame_ring_get(FRAME_RING_MAX_AGE_MS);
+  }
+#if CONFIG_LED_ILLUMINATOR_ENABLED
+  if (!fb && flash) {
+    fb = flash_fb_get();
+  }
 #endif
-      res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
+  if (!fb) {
+    fb = camera_fb_get();
+  }
+  if (!fb) {
+    log_e("Camera capture failed");
+    return ESP_FAIL;
+  }
+
+  NoDetector detector;
+  JpegBufferEncoder encoder;
+  frame_out_t out;
+  struct timeval timestamp = fb->timestamp;
+  frame_out_init(&out, fb);
+  esp_err_t res = frame_process(detector, encoder, &out);
+  if (res == ESP_OK) {
+    xSemaphoreTake(timelapse_lock, portMAX_DELAY);
+    res = timelapse_store(out.buf, out.len, &timestamp);
+    xSemaphoreGive(timelapse_lock);
+    if (res != ESP_OK) {
+      log_e("Time-lapse store full");
+    }
+  }
+  frame_out_release(&out);
+  return res;
+}
+
+static void timelapse_loop(void *arg) {
+  while (true) {
+    xSemaphoreTake(timelapse_lock, portMAX_DELAY);
+    bool running = timelapse.running;
+    int64_t wait = timelapse.next - esp_timer_get_time();
+    xSemaphoreGive(timelapse_lock);
+    // woken early by start and stop
+    if (!running) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    if (wait > 0) {
+      ulTaskNotifyTake(pdTRUE, wait / 1000 / portTICK_PERIOD_MS + 1);
+      continue;
+    }
+
+    MemScope mem(MEM_TIMELAPSE);
+    esp_err_t res = timelapse_capture();
+
+    xSemaphoreTake(timelapse_lock, portMAX_DELAY);
+    if (res == ESP_OK) {
+      timelapse.taken++;
     } else {
-      jpg_chunking_t jchunk = {req, 0};
-      res = frame2jpg_cb(fb, 80, jpg_encode_stream, &jchunk) ? ESP_OK : ESP_FAIL;
-      httpd_resp_send_chunk(req, NULL, 0);
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-      fb_len = jchunk.len;
-#endif
+      timelapse.failed++;
     }
-    esp_camera_fb_return(fb);
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-    int64_t fr_end = esp_timer_get_time();
-#endif
-    log_i("JPG: %uB %ums", (uint32_t)(fb_len), (uint32_t)((fr_end - fr_start) / 1000));
-    return res;
-#if CONFIG_ESP_FACE_DETECT_ENABLED
+    // stay on the grid, skipping the deadlines this frame ran over
+    int64_t interval = timelapse.interval_ms * 1000LL;
+    int64_t late = esp_timer_get_time() - timelapse.next;
+    int64_t skipped = late / interval;
+    timelapse.missed += skipped;
+    timelapse.next += (skipped + 1) * interval;
+    if (timelapse.count && timelapse.taken + timelapse.failed >= timelapse.count) {
+      timelapse.running = false;
+      log_i("Time-lapse done: %u frames", timelapse.taken);
+    }
+    xSemaphoreGive(timelapse_lock);
   }
+}
 
-  jpg_chunking_t jchunk = {req, 0};
+static esp_err_t timelapse_start(int interval_ms, int count, int delay_ms) {
+  if (interval_ms < TIMELAPSE_MIN_INTERVAL_MS || count < 0 || delay_ms < 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!psramFound()) {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  xSemaphoreTake(timelapse_lock, portMAX_DELAY);
+  if (!timelapse.store) {
+    size_t size = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM) / 2;
+    if (size > TIMELAPSE_STORE_SIZE) {
+      size = TIMELAPSE_STORE_SIZE;
+    }
+    timelapse.store = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    timelapse.frames = (timelapse_frame_t *)heap_caps_malloc(TIMELAPSE_MAX_FRAMES * sizeof(timelapse_frame_t), MALLOC_CAP_SPIRAM);
+    if (!timelapse.store || !timelapse.frames) {
+      free(timelapse.store);
+      free(timelapse.frames);
+      timelapse.store = NULL;
+      timelapse.frames = NULL;
+      xSemaphoreGive(timelapse_lock);
+      return ESP_ERR_NO_MEM;
+    }
+    timelapse.size = size;
+    timelapse.head = 0;
+    timelapse.used = 0;
+    timelapse.first = 0;
+    timelapse.stored = 0;
+    timelapse.next_seq = 1;
+  }
+  timelapse.interval_ms = interval_ms;
+  timelapse.count = count;
+  timelapse.next = esp_timer_get_time() + delay_ms * 1000LL;
+  timelapse.taken = 0;
+  timelapse.missed = 0;
+  timelapse.failed = 0;
+  timelapse.running = true;
+  if (!timelapse_task) {
+    xTaskCreate(timelapse_loop, "timelapse", 4096, NULL, 5, &timelapse_task);
+  }
+  xSemaphoreGive(timelapse_lock);
+  xTaskNotifyGive(timelapse_task);
+  log_i("Time-lapse: every %dms, %d frames, in %dms", interval_ms, count, delay_ms);
+  return ESP_OK;
+}
 
-  if (fb->format == PIXFORMAT_RGB565
-#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-      && !recognition_enabled
-#endif
-  ) {
-#if TWO_STAGE
-    HumanFaceDetectMSR01 s1(0.1F, 0.5F, 10, 0.2F);
-    HumanFaceDetectMNP01 s2(0.5F, 0.3F, 5);
-    std::list<dl::detect::result_t> &candidates = s1.infer((uint16_t *)fb->buf, {(int)fb->height, (int)fb->width, 3});
-    std::list<dl::detect::result_t> &results = s2.infer((uint16_t *)fb->buf, {(int)fb->height, (int)fb->width, 3}, candidates);
-#else
-    HumanFaceDetectMSR01 s1(0.3F, 0.5F, 10, 0.2F);
-    std::list<dl::detect::result_t> &results = s1.infer((uint16_t *)fb->buf, {(int)fb->height, (int)fb->width, 3});
-#endif
-    if (results.size() > 0) {
-      fb_data_t rfb;
-      rfb.width = fb->width;
-      rfb.height = fb->height;
-      rfb.data = fb->buf;
-      rfb.bytes_per_pixel = 2;
-      rfb.format = FB_RGB565;
+static void timelapse_stop() {
+  xSemaphoreTake(timelapse_lock, portMAX_DELAY);
+  timelapse.running = false;
+  xSemaphoreGive(timelapse_lock);
+  if (timelapse_task) {
+    xTaskNotifyGive(timelapse_task);
+  }
+}
+
+// Drops the stored frames, and gives the store back to PSRAM when no time-lapse is running
+static void timelapse_clear() {
+  xSemaphoreTake(timelapse_lock, portMAX_DELAY);
+  timelapse.first = 0;
+  timelapse.stored = 0;
+  timelapse.head = 0;
+  timelapse.used = 0;
+  if (!timelapse.running) {
+    free(timelapse.store);
+    free(timelapse.frames);
+    timelapse.store = NULL;
+    timelapse.frames = NULL;
+  }
+  xSemaphoreGive(timelapse_lock);
+}
+
+static void timelapse_init() {
+  if (!timelapse_lock) {
+    timelapse_lock = xSemaphoreCreateMutex();
+  }
+}
+
+// /timelapse: status, after start=1&interval_ms=&count=&delay_ms=, stop=1 or clear=1 if given
+static esp_err_t timelapse_handler(httpd_req_t *req) {
+  MemScope mem(MEM_TIMELAPSE);
+  if (httpd_req_get_url_query_len(req)) {
+    char *buf = NULL;
+    if (parse_get(req, &buf) != ESP_OK) {
+      return ESP_FAIL;
+    }
+    esp_err_t err = ESP_OK;
+    if (parse_get_var(buf, "stop", 0)) {
+      timelapse_stop();
+    }
+    if (parse_get_var(buf, "clear", 0)) {
+      timelapse_clear();
+    }
+    if (parse_get_var(buf, "start", 0)) {
+      err = timelapse_start(parse_get_var(buf, "interval_ms", 1000), parse_get_var(buf, "count", 0), parse_get_var(buf, "delay_ms", 0));
+    }
+    free(buf);
+    if (err == ESP_ERR_INVALID_ARG) {
+      httpd_resp_set_status(req, "400 Bad Request");
+      return httpd_resp_send(req, NULL, 0);
+    } else if (err != ESP_OK) {
+      log_e("Time-lapse start failed: 0x%x", err);
+      return httpd_resp_send_500(req);
+    }
+  }
+
+  static char json[384];
+  char *p = json;
+  xSemaphoreTake(timelapse_lock, portMAX_DELAY);
+  int64_t next_ms = timelapse.running ? (timelapse.next - esp_timer_get_time()) / 1000 : 0;
+  p += sprintf(
+    p, "{\"running\":%u,\"interval_ms\":%u,\"count\":%u,\"next_ms\":%d,\"taken\":%u,\"missed\":%u,\"failed\":%u", timelapse.running, timelapse.interval_ms, timelapse.count,
+    (int)(next_ms > 0 ? next_ms : 0), timelapse.taken, timelapse.missed, timelapse.failed
+  );
+  p += sprintf(
+    p, ",\"stored\":%u,\"first_seq\":%u,\"next_seq\":%u,\"bytes\":%u,\"store_size\":%u,\"evicted\":%u}", timelapse.stored,
+    timelapse.stored ? timelapse_frame(0)->seq : timelapse.next_seq, timelapse.next_seq, timelapse.used, timelapse.size, timelapse.evicted
+  );
+  xSemaphoreGive(timelapse_lock);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json, p - json);
+}
+
+// /timelapse/frames?since=S&max=N&drop=1: up to N stored frames from sequence number S on, as
+// multipart/mixed like a burst. X-Next-Seq is the `since` for the next call; with drop=1 the
+// frames are freed once they are all sent.
+static esp_err_t timelapse_frames_handler(httpd_req_t *req) {
+  MemScope mem(MEM_TIMELAPSE);
+  uint32_t since = 0;
+  int max = TIMELAPSE_FETCH_MAX;
+  bool drop = false;
+  if (httpd_req_get_url_query_len(req)) {
+    char *buf = NULL;
+    if (parse_get(req, &buf) != ESP_OK) {
+      return ESP_FAIL;
+    }
+    since = parse_get_var(buf, "since", 0);
+    max = parse_get_var(buf, "max", TIMELAPSE_FETCH_MAX);
+    drop = parse_get_var(buf, "drop", 0);
+    free(buf);
+  }
+  if (max < 1 || max > TIMELAPSE_FETCH_MAX) {
+    max = TIMELAPSE_FETCH_MAX;
+  }
+
+  // frames are only dropped from the front, so the ones to send are a contiguous run
+  xSemaphoreTake(timelapse_lock, portMAX_DELAY);
+  uint32_t first_seq = timelapse.stored ? timelapse_frame(0)->seq : timelapse.next_seq;
+  if (since < first_seq) {
+    since = first_seq;
+  }
+  uint32_t end = since + max;
+  if (end > timelapse.next_seq) {
+    end = timelapse.next_seq;
+  }
+  if (since > end) {
+    since = end;
+  }
+  // the pin keeps the capture task from overwriting the frame going out, and the ones after it
+  if (since < end) {
+    timelapse.pinned = since;
+  }
+  xSemaphoreGive(timelapse_lock);
+
+  char next[16];
+  snprintf(next, sizeof(next), "%u", end);
+  httpd_resp_set_hdr(req, "X-Next-Seq", next);
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  if (since == end) {
+    httpd_resp_set_status(req, "204 No Content");
+    return httpd_resp_send(req, NULL, 0);
+  }
+  httpd_resp_set_type(req, _BURST_CONTENT_TYPE);
+
+  static char part_buf[PART_HDR_MAX];
+  esp_err_t res = ESP_OK;
+  int64_t fr_start = esp_timer_get_time();
+  size_t bytes = 0;
+  for (uint32_t seq = since; seq < end && res == ESP_OK; seq++) {
+    xSemaphoreTake(timelapse_lock, portMAX_DELAY);
+    timelapse_frame_t f = *timelapse_frame(seq - timelapse_frame(0)->seq);
+    timelapse.pinned = seq;
+    xSemaphoreGive(timelapse_lock);
+    res = send_jpeg_part(req, part_buf, timelapse.store + f.offset, f.len, &f.timestamp, NULL);
+    bytes += f.len;
+    mem.sample();
+  }
+  xSemaphoreTake(timelapse_lock, portMAX_DELAY);
+  timelapse.pinned = 0;
+  if (res == ESP_OK && drop) {
+    while (timelapse.stored && timelapse_frame(0)->seq < end) {
+      timelapse_evict();
+    }
+  }
+  xSemaphoreGive(timelapse_lock);
+
+  if (res == ESP_OK) {
+    res = httpd_resp_send_chunk(req, _MULTIPART_END, strlen(_MULTIPART_END));
+  }
+  if (res == ESP_OK) {
+    res = httpd_resp_send_chunk(req, NULL, 0);
+  } else {
+    log_e("Send time-lapse frames failed");
+  }
 #if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-      detected = true;
+  int64_t fr_end = esp_timer_get_time();
 #endif
-      draw_face_boxes(&rfb, &results, face_id);
+  log_i("TIMELAPSE: %u frames %uB %ums", end - since, bytes, (uint32_t)((fr_end - fr_start) / 1000));
+  return res;
+}
+
+// Per-client view of the shared frame, /stream?roi=x,y,w,h&scale=1|2|4|8.
+// The ROI is cut on the MCU grid of the encoded JPEG (no decode); only a scaled view is
+// decoded, at the reduced size straight out of the decoder, and encoded again.
+typedef struct {
+  bool crop;
+  jpg_overlay_box_t roi;
+  uint8_t shift;  //log2 of the downscale factor, as jpg_scale_t
+  bool thumb;     //variant=thumb, scaled to about THUMB_MIN_WIDTH
+} frame_view_t;
+
+static void frame_view_parse(char *buf, frame_view_t *view) {
+  char roi[48];
+  memset(view, 0, sizeof(frame_view_t));
+  if (httpd_query_key_value(buf, "roi", roi, sizeof(roi)) == ESP_OK) {
+    jpg_overlay_box_t *r = &view->roi;
+    view->crop = sscanf(roi, "%d,%d,%d,%d", &r->x, &r->y, &r->w, &r->h) == 4 && r->w > 0 && r->h > 0;
+  }
+  char variant[16];
+  view->thumb = httpd_query_key_value(buf, "variant", variant, sizeof(variant)) == ESP_OK && !strcmp(variant, "thumb");
+  int scale = parse_get_var(buf, "scale", 1);
+  while (view->shift < JPG_SCALE_8X && (2 << view->shift) <= scale) {
+    view->shift++;
+  }
+}
+
+static void frame_out_set(frame_out_t *out, uint8_t *buf, size_t len, int width, int height) {
+  frame_return_fb(out);
+  free(out->owned);
+  out->owned = buf;
+  out->buf = buf;
+  out->len = len;
+  out->width = width;
+  out->height = height;
+}
+
+// Replaces the encoded JPEG in out with the view of it
+static esp_err_t frame_view_apply(const frame_view_t *view, frame_out_t *out) {
+  if (view->crop) {
+    jpg_overlay_box_t rect = view->roi;
+    uint8_t *crop_buf = NULL;
+    size_t crop_len = 0;
+    bool s = jpg_crop(out->buf, out->len, &rect, &crop_buf, &crop_len);
+    mem_sample();
+    if (!s) {
+      log_e("ROI crop failed");
+      mem_failed();
+      return ESP_FAIL;
+    }
+    frame_out_set(out, crop_buf, crop_len, rect.w, rect.h);
+  }
+  uint8_t shift = view->thumb ? thumb_shift(out->width, out->height) : view->shift;
+  if (shift) {
+    int width = out->width >> shift;
+    int height = out->height >> shift;
+    uint8_t *rgb_buf = frame_pool_get(thumb_len(out->width, out->height, shift));
+    if (!rgb_buf) {
+      log_e("view malloc failed");
+      return ESP_FAIL;
+    }
+    uint8_t *jpg_buf = NULL;
+    size_t jpg_len = 0;
+    bool s = jpg2rgb565(out->buf, out->len, rgb_buf, (jpg_scale_t)shift)
+             && fmt2jpg(rgb_buf, width * height * 2, width, height, PIXFORMAT_RGB565, 80, &jpg_buf, &jpg_len);
+    mem_sample();
+    frame_pool_put(rgb_buf);
+    if (!s) {
+      log_e("Scaling view failed");
+      mem_failed();
+      return ESP_FAIL;
+    }
+    frame_out_set(out, jpg_buf, jpg_len, width, height);
+  }
+  return ESP_OK;
+}
+
+// Shadow of recently read sensor registers, so repeated reads (status polls, tuning scripts) don't
+// each cost an SCCB transaction. Read from the main httpd task only. Every write through this
+// server drops it; registers the sensor updates itself (AEC/AGC/AWB) are bounded by the max age.
+#define REG_SHADOW_SLOTS      64
+#define REG_SHADOW_MAX_AGE_MS 1000
+
+typedef struct {
+  uint32_t mask;
+  uint32_t time_ms;
+  int value;
+  uint32_t gen;
+  uint16_t reg;
+} reg_shadow_t;
+
+static reg_shadow_t reg_shadow[REG_SHADOW_SLOTS];
+// entries from older generations are stale, bumping it is safe from any task
+static volatile uint32_t reg_shadow_gen = 1;
+
+static void reg_shadow_invalidate() {
+  reg_shadow_gen++;
+}
+
+// s->get_reg() through the shadow. `hit` is set when the bus wasn't touched.
+static int reg_shadow_get(sensor_t *s, uint16_t reg, uint32_t mask, bool *hit) {
+  reg_shadow_t *e = &reg_shadow[reg % REG_SHADOW_SLOTS];
+  uint32_t now = esp_timer_get_time() / 1000;
+  uint32_t gen = reg_shadow_gen;
+  if (e->gen == gen && e->reg == reg && e->mask == mask && now - e->time_ms < REG_SHADOW_MAX_AGE_MS) {
+    *hit = true;
+    return e->value;
+  }
+  *hit = false;
+  int value = s->get_reg(s, reg, mask);
+  if (value >= 0) {
+    e->reg = reg;
+    e->mask = mask;
+    e->value = value;
+    e->time_ms = now;
+    e->gen = gen;
+  }
+  return value;
+}
+
+// Frames exposed while a profile is being applied carry a mix of old and new settings. The streams
+// drop them, and the first stream to get a clean frame records how many frame slots the switch cost.
+typedef struct {
+  volatile int64_t start;  // esp_timer µs, 0 when no switch happened yet
+  volatile int64_t end;    // 0 while the profile is being applied
+  uint32_t switch_ms;
+  volatile int frames_lost;  // -1 until a stream measured it
+} profile_switch_t;
+
+static profile_switch_t profile_switch = {0, 0, 0, -1};
+
+// Returns true when the stream should drop `fb`. `last` and `period` are the stream's own
+// previous capture time and average frame interval.
+static bool profile_switch_drop(camera_fb_t *fb, int64_t *last, int64_t *period) {
+  int64_t t = frame_fb_time(fb);
+  int64_t start = profile_switch.start;
+  int64_t end = profile_switch.end;
+  if (start && t > start - *period && (!end || t < end)) {
+    return true;
+  }
+  if (start && end && t >= end && profile_switch.frames_lost < 0 && *last && *period) {
+    int lost = (t - *last + *period / 2) / *period - 1;
+    profile_switch.frames_lost = lost > 0 ? lost : 0;
+    log_i("PROFILE: switch took %ums, %d frames lost", profile_switch.switch_ms, profile_switch.frames_lost);
+  } else if (*last) {
+    *period = *period ? (*period * 7 + (t - *last)) / 8 : t - *last;
+  }
+  *last = t;
+  return false;
+}
+
+// Adaptive framesize/quality. One stream at a time watches how long its frames take to send and
+// steps the sensor down when the target FPS isn't met, and back up when there is headroom. Quality is
+// traded before resolution in both directions, and the user's framesize/quality are the ceiling.
+// Streams run on several workers at once, so the controller is claimed with a compare-and-swap; the
+// other streams leave the shared sensor alone until the owner ends and one of them takes over.
+// adapt_lock covers the state: the owner's updates, and /control, /profile and /status on port 80.
+#define ADAPT_WINDOW        15    // frames per decision
+#define ADAPT_DOWN_HOLD     2     // windows over budget before stepping down
+#define ADAPT_UP_HOLD       4     // windows with headroom before stepping up
+#define ADAPT_HEADROOM_PCT  70    // frame time below this % of the budget counts as headroom
+#define ADAPT_OVER_PCT      115
+#define ADAPT_QUALITY_STEP  4
+#define ADAPT_QUALITY_MAX   30    // worst quality used before dropping resolution
+#define ADAPT_RSSI_WEAK     -75   // dBm, no stepping up below this
+
+static const framesize_t adapt_sizes[] = {FRAMESIZE_QVGA, FRAMESIZE_CIF, FRAMESIZE_VGA, FRAMESIZE_SVGA, FRAMESIZE_XGA, FRAMESIZE_HD, FRAMESIZE_SXGA, FRAMESIZE_UXGA};
+
+typedef struct {
+  bool enabled;
+  uint8_t target_fps;
+  framesize_t max_size;  // what the user picked
+  uint8_t base_quality;
+  uint32_t frames;
+  uint32_t send_us;  // sums over the current window
+  uint32_t frame_us;
+  uint32_t send_ms;  // averages of the last window
+  uint32_t frame_ms;
+  int rssi;
+  int over;
+  int under;
+  uint32_t steps_up;
+  uint32_t steps_down;
+  char decision[32];
+} adapt_state_t;
+
+static adapt_state_t adapt = {false, 15, FRAMESIZE_QVGA, 10};
+static std::atomic<void *> adapt_owner(NULL);  // stream running the controller
+static SemaphoreHandle_t adapt_lock = NULL;
+
+static void adapt_init() {
+  if (!adapt_lock) {
+    adapt_lock = xSemaphoreCreateMutex();
+  }
+}
+
+static adapt_state_t adapt_get() {
+  xSemaphoreTake(adapt_lock, portMAX_DELAY);
+  adapt_state_t copy = adapt;
+  xSemaphoreGive(adapt_lock);
+  return copy;
+}
+
+static void adapt_reset_window() {
+  adapt.frames = 0;
+  adapt.send_us = 0;
+  adapt.frame_us = 0;
+}
+
+static void adapt_enable(bool enable) {
+  sensor_t *s = esp_camera_sensor_get();
+  xSemaphoreTake(adapt_lock, portMAX_DELAY);
+  if (enable && !adapt.enabled) {
+    adapt.max_size = s->status.framesize;
+    adapt.base_quality = s->status.quality;
+    adapt_owner = NULL;
+    adapt.over = adapt.under = 0;
+    adapt_reset_window();
+    strcpy(adapt.decision, "hold");
+  } else if (!enable && adapt.enabled) {
+    // back to what the user set
+    s->set_framesize(s, adapt.max_size);
+    s->set_quality(s, adapt.base_quality);
+    reg_shadow_invalidate();
+  }
+  adapt.enabled = enable;
+  xSemaphoreGive(adapt_lock);
+}
+
+// One step along the quality/resolution ladder, returns false at the end of it
+static bool adapt_step(sensor_t *s, bool up) {
+  const int count = sizeof(adapt_sizes) / sizeof(adapt_sizes[0]);
+  framesize_t size = s->status.framesize;
+  int quality = s->status.quality;
+  if (!up) {
+    int i = count - 1;
+    while (i >= 0 && adapt_sizes[i] >= size) {
+      i--;
+    }
+    if (quality + ADAPT_QUALITY_STEP <= ADAPT_QUALITY_MAX) {
+      s->set_quality(s, quality + ADAPT_QUALITY_STEP);
+    } else if (i >= 0) {
+      s->set_framesize(s, adapt_sizes[i]);
+      s->set_quality(s, adapt.base_quality);
+    } else {
+      return false;
     }
-    s = fmt2jpg_cb(fb->buf, fb->len, fb->width, fb->height, PIXFORMAT_RGB565, 90, jpg_encode_stream, &jchunk);
-    esp_camera_fb_return(fb);
   } else {
-    out_len = fb->width * fb->height * 3;
-    out_width = fb->width;
-    out_height = fb->height;
-    out_buf = (uint8_t *)malloc(out_len);
-    if (!out_buf) {
-      log_e("out_buf malloc failed");
-      httpd_resp_send_500(req);
-      return ESP_FAIL;
+    int i = 0;
+    while (i < count && adapt_sizes[i] <= size) {
+      i++;
     }
-    s = fmt2rgb888(fb->buf, fb->len, fb->format, out_buf);
-    esp_camera_fb_return(fb);
-    if (!s) {
-      free(out_buf);
-      log_e("To rgb888 failed");
-      httpd_resp_send_500(req);
-      return ESP_FAIL;
+    if (quality - ADAPT_QUALITY_STEP >= adapt.base_quality) {
+      s->set_quality(s, quality - ADAPT_QUALITY_STEP);
+    } else if (quality != adapt.base_quality) {
+      s->set_quality(s, adapt.base_quality);
+    } else if (size < adapt.max_size) {
+      s->set_framesize(s, i < count && adapt_sizes[i] < adapt.max_size ? adapt_sizes[i] : adapt.max_size);
+      // come back in at a low quality so the bigger frames don't overshoot
+      s->set_quality(s, adapt.base_quality > ADAPT_QUALITY_MAX - ADAPT_QUALITY_STEP ? adapt.base_quality : ADAPT_QUALITY_MAX - ADAPT_QUALITY_STEP);
+    } else {
+      return false;
     }
+  }
+  reg_shadow_invalidate();
+  if (up) {
+    adapt.steps_up++;
+  } else {
+    adapt.steps_down++;
+  }
+  snprintf(adapt.decision, sizeof(adapt.decision), "%s to %ux%u q%u", up ? "up" : "down", resolution[s->status.framesize].width, resolution[s->status.framesize].height, s->status.quality);
+  log_i("ADAPT: %s, send %ums, frame %ums, rssi %d", adapt.decision, adapt.send_ms, adapt.frame_ms, adapt.rssi);
+  return true;
+}
 
-    fb_data_t rfb;
-    rfb.width = out_width;
-    rfb.height = out_height;
-    rfb.data = out_buf;
-    rfb.bytes_per_pixel = 3;
-    rfb.format = FB_BGR888;
+static void adapt_update(void *owner, uint32_t send_us, uint32_t frame_us) {
+  if (!adapt.enabled) {
+    return;
+  }
+  void *current = NULL;
+  if (adapt_owner.compare_exchange_strong(current, owner)) {
+    adapt_reset_window();
+  } else if (current != owner) {
+    return;
+  }
+  sensor_t *s = esp_camera_sensor_get();
+  if (s->pixformat != PIXFORMAT_JPEG) {
+    return;
+  }
+  adapt.send_us += send_us;
+  adapt.frame_us += frame_us;
+  if (++adapt.frames < ADAPT_WINDOW) {
+    return;
+  }
+  adapt.send_ms = adapt.send_us / adapt.frames / 1000;
+  adapt.frame_ms = adapt.frame_us / adapt.frames / 1000;
+  adapt_reset_window();
+
+  wifi_ap_record_t ap;
+  adapt.rssi = esp_wifi_sta_get_ap_info(&ap) == ESP_OK ? ap.rssi : 0;
+
+  uint32_t budget_ms = 1000 / adapt.target_fps;
+  if (adapt.frame_ms * 100 > budget_ms * ADAPT_OVER_PCT) {
+    adapt.under = 0;
+    if (++adapt.over >= ADAPT_DOWN_HOLD) {
+      adapt.over = 0;
+      if (!adapt_step(s, false)) {
+        strcpy(adapt.decision, "at minimum");
+      }
+    }
+  } else if (adapt.frame_ms * 100 < budget_ms * ADAPT_HEADROOM_PCT && (adapt.rssi == 0 || adapt.rssi >= ADAPT_RSSI_WEAK)) {
+    adapt.over = 0;
+    if (++adapt.under >= ADAPT_UP_HOLD) {
+      adapt.under = 0;
+      if (!adapt_step(s, true)) {
+        strcpy(adapt.decision, "at maximum");
+      }
+    }
+  } else {
+    adapt.over = adapt.under = 0;
+  }
+}
 
-#if TWO_STAGE
-    HumanFaceDetectMSR01 s1(0.1F, 0.5F, 10, 0.2F);
-    HumanFaceDetectMNP01 s2(0.5F, 0.3F, 5);
-    std::list<dl::detect::result_t> &candidates = s1.infer((uint8_t *)out_buf, {(int)out_height, (int)out_width, 3});
-    std::list<dl::detect::result_t> &results = s2.infer((uint8_t *)out_buf, {(int)out_height, (int)out_width, 3}, candidates);
-#else
-    HumanFaceDetectMSR01 s1(0.3F, 0.5F, 10, 0.2F);
-    std::list<dl::detect::result_t> &results = s1.infer((uint8_t *)out_buf, {(int)out_height, (int)out_width, 3});
+// Called by every stream after each frame it sent, only the owner changes the sensor
+static void adapt_frame(void *owner, uint32_t send_us, uint32_t frame_us) {
+  xSemaphoreTake(adapt_lock, portMAX_DELAY);
+  adapt_update(owner, send_us, frame_us);
+  xSemaphoreGive(adapt_lock);
+}
+
+static void adapt_stream_end(void *owner) {
+  adapt_owner.compare_exchange_strong(owner, NULL);
+}
+
+// Stream liveness for the supervisor. Bumping stream_epoch ends the running streams.
+static volatile uint32_t stream_epoch = 0;
+static volatile int64_t stream_sent = 0;  // last frame sent by any stream
+
+static void stream_begin() {
+  streams_open++;
+  stream_sent = esp_timer_get_time();
+#if CONFIG_LED_ILLUMINATOR_ENABLED
+  enable_led(true);
 #endif
+}
 
-    if (results.size() > 0) {
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-      detected = true;
+// The LED goes off with the last stream
+static void stream_end() {
+  if (--streams_open == 0) {
+#if CONFIG_LED_ILLUMINATOR_ENABLED
+    enable_led(false);
 #endif
-#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-      if (recognition_enabled) {
-        face_id = run_face_recognition(&rfb, &results);
-      }
+  }
+}
+
+#define STREAMS_STOP_WAIT_MS 1000
+
+// Ends the running streams and waits for them to let go of the driver
+static void streams_stop() {
+  stream_epoch++;
+  for (int waited = 0; streams_open && waited < STREAMS_STOP_WAIT_MS; waited += 10) {
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+  }
+}
+
+// Streams run on worker tasks, so the stream server's single httpd task is free again as soon
+// as a client is handed over. A client that finds every worker busy gets a 503. The frame
+// pipeline and the part headers live on the worker's stack, which keeps the default httpd size.
+#if CONFIG_LOW_MEMORY
+#define STREAM_WORKERS 1
+#else
+#define STREAM_WORKERS 3
 #endif
-      draw_face_boxes(&rfb, &results, face_id);
-    }
+#define STREAM_WORKER_STACK 4096
+
+typedef esp_err_t (*stream_fn_t)(httpd_req_t *req);
+
+typedef struct {
+  httpd_req_t *req;  // async copy, completed by the worker
+  stream_fn_t fn;
+} stream_job_t;
+
+static QueueHandle_t stream_jobs = NULL;
+static SemaphoreHandle_t stream_workers_idle = NULL;
+
+static void stream_worker(void *arg) {
+  stream_job_t job;
+  while (true) {
+    xSemaphoreGive(stream_workers_idle);
+    xQueueReceive(stream_jobs, &job, portMAX_DELAY);
+    job.fn(job.req);
+    httpd_req_async_handler_complete(job.req);
+  }
+}
 
-    s = fmt2jpg_cb(out_buf, out_len, out_width, out_height, PIXFORMAT_RGB888, 90, jpg_encode_stream, &jchunk);
-    free(out_buf);
+static void stream_workers_start(const httpd_config_t *config) {
+  stream_jobs = xQueueCreate(STREAM_WORKERS, sizeof(stream_job_t));
+  stream_workers_idle = xSemaphoreCreateCounting(STREAM_WORKERS, 0);
+  for (int i = 0; i < STREAM_WORKERS; i++) {
+    xTaskCreate(stream_worker, "stream", STREAM_WORKER_STACK, NULL, config->task_priority, NULL);
   }
+}
 
-  if (!s) {
-    log_e("JPEG compression failed");
-    httpd_resp_send_500(req);
+// Hands req over to an idle worker, called from the stream server's task
+static esp_err_t stream_submit(httpd_req_t *req, stream_fn_t fn) {
+  if (xSemaphoreTake(stream_workers_idle, 0) != pdTRUE) {
+    log_e("No stream worker free");
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    return httpd_resp_send(req, NULL, 0);
+  }
+  stream_job_t job = {NULL, fn};
+  if (httpd_req_async_handler_begin(req, &job.req) != ESP_OK) {
+    xSemaphoreGive(stream_workers_idle);
     return ESP_FAIL;
   }
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-  int64_t fr_end = esp_timer_get_time();
-#endif
-  log_i("FACE: %uB %ums %s%d", (uint32_t)(jchunk.len), (uint32_t)((fr_end - fr_start) / 1000), detected ? "DETECTED " : "", face_id);
+  xQueueSend(stream_jobs, &job, portMAX_DELAY);
+  return ESP_OK;
+}
+
+#if CONFIG_FRAME_RING_ENABLED
+// Without a new thumbnail the last one goes out again every keep-alive period, and the stream
+// ends once none has arrived for the timeout
+#define THUMB_STREAM_KEEPALIVE_MS 1000
+#define THUMB_STREAM_TIMEOUT_MS   5000
+
+// /stream?variant=thumb: sends every new shared thumbnail, without grabbing or converting anything itself
+static esp_err_t thumb_stream_handler(httpd_req_t *req) {
+  esp_err_t res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
+  if (res != ESP_OK) {
+    return res;
+  }
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  char part_buf[PART_HDR_MAX];
+  uint8_t *buf = NULL;
+  size_t size = 0;
+  size_t len = 0;
+  struct timeval timestamp;
+  uint32_t seq = thumb_frame.seq;
+  int64_t fresh = esp_timer_get_time();  // last new thumbnail
+  int64_t sent = 0;
+  uint32_t epoch = stream_epoch;
+  thumb_client_add(1);
+  stream_begin();
+  while (true) {
+    if (epoch != stream_epoch) {
+      log_i("Stream ended by the supervisor");
+      break;
+    }
+    bool got = false;
+    xSemaphoreTake(thumb_lock, portMAX_DELAY);
+    if (thumb_frame.seq != seq && thumb_frame.buf) {
+      if (size < thumb_frame.len) {
+        free(buf);
+        size = thumb_frame.len;
+        buf = (uint8_t *)malloc(size);
+      }
+      if (buf) {
+        len = thumb_frame.len;
+        memcpy(buf, thumb_frame.buf, len);
+        timestamp = thumb_frame.timestamp;
+        got = true;
+      }
+      seq = thumb_frame.seq;
+    }
+    xSemaphoreGive(thumb_lock);
+    if (!buf && size) {
+      log_e("thumb malloc failed");
+      res = ESP_FAIL;
+      break;
+    }
+    int64_t now = esp_timer_get_time();
+    if (got) {
+      fresh = now;
+    } else if (now - fresh > THUMB_STREAM_TIMEOUT_MS * 1000LL) {
+      log_e("No thumbnails, stream ended");
+      res = ESP_FAIL;
+      break;
+    } else if (!len || now - sent < THUMB_STREAM_KEEPALIVE_MS * 1000LL) {
+      vTaskDelay(10 / portTICK_PERIOD_MS);
+      continue;
+    }
+    res = send_jpeg_part(req, part_buf, buf, len, &timestamp, NULL);
+    if (res != ESP_OK) {
+      log_e("Send frame failed");
+      break;
+    }
+    sent = esp_timer_get_time();
+    if (got) {
+      stream_sent = sent;
+    }
+  }
+  stream_end();
+  thumb_client_add(-1);
+  free(buf);
   return res;
-#endif
 }
+#endif
 
 static esp_err_t stream_handler(httpd_req_t *req) {
   camera_fb_t *fb = NULL;
   struct timeval _timestamp;
   esp_err_t res = ESP_OK;
-  size_t _jpg_buf_len = 0;
-  uint8_t *_jpg_buf = NULL;
-  char *part_buf[128];
-#if CONFIG_ESP_FACE_DETECT_ENABLED
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-  bool detected = false;
-  int64_t fr_ready = 0;
-  int64_t fr_recognize = 0;
-  int64_t fr_encode = 0;
-  int64_t fr_face = 0;
-  int64_t fr_start = 0;
-#endif
-  int face_id = 0;
-  size_t out_len = 0, out_width = 0, out_height = 0;
-  uint8_t *out_buf = NULL;
-  bool s = false;
-#if TWO_STAGE
-  HumanFaceDetectMSR01 s1(0.1F, 0.5F, 10, 0.2F);
-  HumanFaceDetectMNP01 s2(0.5F, 0.3F, 5);
-#else
-  HumanFaceDetectMSR01 s1(0.3F, 0.5F, 10, 0.2F);
-#endif
-#endif
+  char faces_hdr[FACE_RESULTS_MAX * 32];
+  char part_buf[PART_HDR_MAX];
+  frame_detector_t detector;
+  JpegBufferEncoder encoder;
+  frame_out_t out;
+  frame_view_t view = {};
+  MemScope mem(MEM_STREAM);
+  if (!mem.admit(req)) {
+    return ESP_OK;
+  }
 
-  static int64_t last_frame = 0;
-  if (!last_frame) {
-    last_frame = esp_timer_get_time();
+  if (httpd_req_get_url_query_len(req)) {
+    char *buf = NULL;
+    if (parse_get(req, &buf) != ESP_OK) {
+      return ESP_FAIL;
+    }
+    frame_view_parse(buf, &view);
+    free(buf);
+  }
+#if CONFIG_FRAME_RING_ENABLED
+  // without the ring each thumb client scales its own frames below
+  if (view.thumb && !view.crop) {
+    return thumb_stream_handler(req);
   }
+#endif
+  bool use_view = view.crop || view.shift || view.thumb;
+  int64_t last_capture = 0;
+  int64_t capture_period = 0;
+
+  int64_t last_frame = esp_timer_get_time();
 
   res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
   if (res != ESP_OK) {
@@ -530,265 +2783,237 @@ static esp_err_t stream_handler(httpd_req_t *req) {
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
   httpd_resp_set_hdr(req, "X-Framerate", "60");
 
-#if CONFIG_LED_ILLUMINATOR_ENABLED
-  isStreaming = true;
-  enable_led(true);
-#endif
+  uint32_t epoch = stream_epoch;
+  stream_begin();
 
   while (true) {
-#if CONFIG_ESP_FACE_DETECT_ENABLED
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-    detected = false;
-#endif
-    face_id = 0;
-#endif
-
-    fb = esp_camera_fb_get();
+    if (epoch != stream_epoch) {
+      log_i("Stream ended by the supervisor");
+      break;
+    }
+    fb = camera_fb_get();
+    if (fb && profile_switch_drop(fb, &last_capture, &capture_period)) {
+      camera_fb_return(fb);
+      continue;
+    }
+    frame_out_init(&out, fb);
     if (!fb) {
       log_e("Camera capture failed");
       res = ESP_FAIL;
     } else {
       _timestamp.tv_sec = fb->timestamp.tv_sec;
       _timestamp.tv_usec = fb->timestamp.tv_usec;
-#if CONFIG_ESP_FACE_DETECT_ENABLED
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-      fr_start = esp_timer_get_time();
-      fr_ready = fr_start;
-      fr_encode = fr_start;
-      fr_recognize = fr_start;
-      fr_face = fr_start;
-#endif
-      if (!detection_enabled || fb->width > 400) {
-#endif
-        if (fb->format != PIXFORMAT_JPEG) {
-          bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-          esp_camera_fb_return(fb);
-          fb = NULL;
-          if (!jpeg_converted) {
-            log_e("JPEG compression failed");
-            res = ESP_FAIL;
-          }
-        } else {
-          _jpg_buf_len = fb->len;
-          _jpg_buf = fb->buf;
-        }
-#if CONFIG_ESP_FACE_DETECT_ENABLED
-      } else {
-        if (fb->format == PIXFORMAT_RGB565
-#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-            && !recognition_enabled
-#endif
-        ) {
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-          fr_ready = esp_timer_get_time();
-#endif
-#if TWO_STAGE
-          std::list<dl::detect::result_t> &candidates = s1.infer((uint16_t *)fb->buf, {(int)fb->height, (int)fb->width, 3});
-          std::list<dl::detect::result_t> &results = s2.infer((uint16_t *)fb->buf, {(int)fb->height, (int)fb->width, 3}, candidates);
-#else
-          std::list<dl::detect::result_t> &results = s1.infer((uint16_t *)fb->buf, {(int)fb->height, (int)fb->width, 3});
-#endif
-#if CONFIG_ESP_FACE_DETECT_ENABLED && ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-          fr_face = esp_timer_get_time();
-          fr_recognize = fr_face;
-#endif
-          if (results.size() > 0) {
-            fb_data_t rfb;
-            rfb.width = fb->width;
-            rfb.height = fb->height;
-            rfb.data = fb->buf;
-            rfb.bytes_per_pixel = 2;
-            rfb.format = FB_RGB565;
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-            detected = true;
-#endif
-            draw_face_boxes(&rfb, &results, face_id);
-          }
-          s = fmt2jpg(fb->buf, fb->len, fb->width, fb->height, PIXFORMAT_RGB565, 80, &_jpg_buf, &_jpg_buf_len);
-          esp_camera_fb_return(fb);
-          fb = NULL;
-          if (!s) {
-            log_e("fmt2jpg failed");
-            res = ESP_FAIL;
-          }
-#if CONFIG_ESP_FACE_DETECT_ENABLED && ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-          fr_encode = esp_timer_get_time();
-#endif
-        } else {
-          out_len = fb->width * fb->height * 3;
-          out_width = fb->width;
-          out_height = fb->height;
-          out_buf = (uint8_t *)malloc(out_len);
-          if (!out_buf) {
-            log_e("out_buf malloc failed");
-            res = ESP_FAIL;
-          } else {
-            s = fmt2rgb888(fb->buf, fb->len, fb->format, out_buf);
-            esp_camera_fb_return(fb);
-            fb = NULL;
-            if (!s) {
-              free(out_buf);
-              log_e("To rgb888 failed");
-              res = ESP_FAIL;
-            } else {
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-              fr_ready = esp_timer_get_time();
-#endif
-
-              fb_data_t rfb;
-              rfb.width = out_width;
-              rfb.height = out_height;
-              rfb.data = out_buf;
-              rfb.bytes_per_pixel = 3;
-              rfb.format = FB_BGR888;
-
-#if TWO_STAGE
-              std::list<dl::detect::result_t> &candidates = s1.infer((uint8_t *)out_buf, {(int)out_height, (int)out_width, 3});
-              std::list<dl::detect::result_t> &results = s2.infer((uint8_t *)out_buf, {(int)out_height, (int)out_width, 3}, candidates);
-#else
-              std::list<dl::detect::result_t> &results = s1.infer((uint8_t *)out_buf, {(int)out_height, (int)out_width, 3});
-#endif
-
-#if CONFIG_ESP_FACE_DETECT_ENABLED && ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-              fr_face = esp_timer_get_time();
-              fr_recognize = fr_face;
-#endif
-
-              if (results.size() > 0) {
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-                detected = true;
-#endif
-#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-                if (recognition_enabled) {
-                  face_id = run_face_recognition(&rfb, &results);
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-                  fr_recognize = esp_timer_get_time();
-#endif
-                }
-#endif
-                draw_face_boxes(&rfb, &results, face_id);
-              }
-              s = fmt2jpg(out_buf, out_len, out_width, out_height, PIXFORMAT_RGB888, 90, &_jpg_buf, &_jpg_buf_len);
-              free(out_buf);
-              if (!s) {
-                log_e("fmt2jpg failed");
-                res = ESP_FAIL;
-              }
-#if CONFIG_ESP_FACE_DETECT_ENABLED && ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-              fr_encode = esp_timer_get_time();
-#endif
-            }
-          }
-        }
+      frame_ring_feed(fb);
+      res = frame_process(detector, encoder, &out);
+      if (res == ESP_OK && use_view) {
+        res = frame_view_apply(&view, &out);
       }
-#endif
-    }
-    if (res == ESP_OK) {
-      res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
-    }
-    if (res == ESP_OK) {
-      size_t hlen = snprintf((char *)part_buf, 128, _STREAM_PART, _jpg_buf_len, _timestamp.tv_sec, _timestamp.tv_usec);
-      res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
     }
+    int64_t send_start = esp_timer_get_time();
     if (res == ESP_OK) {
-      res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
-    }
-    if (fb) {
-      esp_camera_fb_return(fb);
-      fb = NULL;
-      _jpg_buf = NULL;
-    } else if (_jpg_buf) {
-      free(_jpg_buf);
-      _jpg_buf = NULL;
+      bool faces = frame_faces_print(&out, faces_hdr, sizeof(faces_hdr));
+      res = send_jpeg_part(req, part_buf, out.buf, out.len, &_timestamp, faces ? faces_hdr : NULL);
     }
+    frame_out_release(&out);
     if (res != ESP_OK) {
       log_e("Send frame failed");
       break;
     }
+    mem.sample();
     int64_t fr_end = esp_timer_get_time();
+    stream_sent = fr_end;
+    adapt_frame(req, fr_end - send_start, fr_end - last_frame);
 
 #if CONFIG_ESP_FACE_DETECT_ENABLED && ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-    int64_t ready_time = (fr_ready - fr_start) / 1000;
-    int64_t face_time = (fr_face - fr_ready) / 1000;
-    int64_t recognize_time = (fr_recognize - fr_face) / 1000;
-    int64_t encode_time = (fr_encode - fr_recognize) / 1000;
-    int64_t process_time = (fr_encode - fr_start) / 1000;
+    int64_t ready_time = (out.t.ready - out.t.start) / 1000;
+    int64_t face_time = (out.t.face - out.t.ready) / 1000;
+    int64_t recognize_time = (out.t.recognize - out.t.face) / 1000;
+    int64_t encode_time = (out.t.encode - out.t.recognize) / 1000;
+    int64_t process_time = (out.t.encode - out.t.start) / 1000;
 #endif
 
     int64_t frame_time = fr_end - last_frame;
+    last_frame = fr_end;
     frame_time /= 1000;
 #if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
     uint32_t avg_frame_time = ra_filter_run(&ra_filter, frame_time);
+    // free and largest free block, in KB
+    uint32_t heap_kb = heap_caps_get_free_size(MALLOC_CAP_INTERNAL) / 1024;
+    uint32_t heap_block_kb = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL) / 1024;
+    uint32_t psram_kb = heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / 1024;
+    uint32_t psram_block_kb = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM) / 1024;
 #endif
     log_i(
-      "MJPG: %uB %ums (%.1ffps), AVG: %ums (%.1ffps)"
+      "MJPG: %uB %ums (%.1ffps), AVG: %ums (%.1ffps), heap %uK/%uK, psram %uK/%uK"
 #if CONFIG_ESP_FACE_DETECT_ENABLED
       ", %u+%u+%u+%u=%u %s%d"
 #endif
       ,
-      (uint32_t)(_jpg_buf_len), (uint32_t)frame_time, 1000.0 / (uint32_t)frame_time, avg_frame_time, 1000.0 / avg_frame_time
+      (uint32_t)(out.len), (uint32_t)frame_time, 1000.0 / (uint32_t)frame_time, avg_frame_time, 1000.0 / avg_frame_time, heap_kb, heap_block_kb, psram_kb, psram_block_kb
 #if CONFIG_ESP_FACE_DETECT_ENABLED
       ,
-      (uint32_t)ready_time, (uint32_t)face_time, (uint32_t)recognize_time, (uint32_t)encode_time, (uint32_t)process_time, (detected) ? "DETECTED " : "", face_id
+      (uint32_t)ready_time, (uint32_t)face_time, (uint32_t)recognize_time, (uint32_t)encode_time, (uint32_t)process_time, (out.faces) ? "DETECTED " : "", out.face_id
 #endif
     );
   }
 
-#if CONFIG_LED_ILLUMINATOR_ENABLED
-  isStreaming = false;
-  enable_led(false);
+  adapt_stream_end(req);
+  stream_end();
+
+  return res;
+}
+
+// Header in front of every frame sent by /raw and /raw_stream, little endian, followed by `len` bytes of fb->buf
+typedef struct __attribute__((packed)) {
+  char magic[4];  // "ECRF"
+  uint16_t width;
+  uint16_t height;
+  uint8_t format;  // pixformat_t
+  uint8_t header_len;
+  uint16_t stride;  // bytes per row, 0 for compressed formats
+  uint32_t len;
+  uint32_t tv_sec;
+  uint32_t tv_usec;
+} raw_frame_hdr_t;
+
+static uint16_t raw_frame_stride(camera_fb_t *fb) {
+  switch (fb->format) {
+    case PIXFORMAT_RGB565:
+    case PIXFORMAT_YUV422: return fb->width * 2;
+    case PIXFORMAT_GRAYSCALE: return fb->width;
+    case PIXFORMAT_RGB888: return fb->width * 3;
+    default: return 0;
+  }
+}
+
+// Sends the header and the frame buffer as it is, no conversion and no copy
+static esp_err_t send_raw_frame(httpd_req_t *req, camera_fb_t *fb) {
+  raw_frame_hdr_t hdr;
+  memcpy(hdr.magic, "ECRF", 4);
+  hdr.width = fb->width;
+  hdr.height = fb->height;
+  hdr.format = fb->format;
+  hdr.header_len = sizeof(raw_frame_hdr_t);
+  hdr.stride = raw_frame_stride(fb);
+  hdr.len = fb->len;
+  hdr.tv_sec = fb->timestamp.tv_sec;
+  hdr.tv_usec = fb->timestamp.tv_usec;
+  esp_err_t res = httpd_resp_send_chunk(req, (const char *)&hdr, sizeof(hdr));
+  if (res == ESP_OK) {
+    res = httpd_resp_send_chunk(req, (const char *)fb->buf, fb->len);
+  }
+  return res;
+}
+
+static esp_err_t raw_handler(httpd_req_t *req) {
+  MemScope mem(MEM_RAW);
+  if (!mem.admit(req)) {
+    return ESP_OK;
+  }
+  camera_fb_t *fb = camera_fb_get();
+  if (!fb) {
+    log_e("Camera capture failed");
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
+  int64_t fr_start = esp_timer_get_time();
 #endif
 
+  httpd_resp_set_type(req, "application/octet-stream");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  char ts[32];
+  snprintf(ts, 32, "%lld.%06ld", fb->timestamp.tv_sec, fb->timestamp.tv_usec);
+  httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
+
+  esp_err_t res = send_raw_frame(req, fb);
+#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
+  size_t fb_len = fb->len;
+#endif
+  camera_fb_return(fb);
+  if (res == ESP_OK) {
+    res = httpd_resp_send_chunk(req, NULL, 0);
+  }
+#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
+  int64_t fr_end = esp_timer_get_time();
+#endif
+  log_i("RAW: %uB %ums", (uint32_t)(fb_len), (uint32_t)((fr_end - fr_start) / 1000));
   return res;
 }
 
-static esp_err_t parse_get(httpd_req_t *req, char **obuf) {
-  char *buf = NULL;
-  size_t buf_len = 0;
+// Back to back header + frame records until the client disconnects
+static esp_err_t raw_stream_handler(httpd_req_t *req) {
+  MemScope mem(MEM_RAW);
+  if (!mem.admit(req)) {
+    return ESP_OK;
+  }
+  esp_err_t res = httpd_resp_set_type(req, "application/octet-stream");
+  if (res != ESP_OK) {
+    return res;
+  }
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-  buf_len = httpd_req_get_url_query_len(req) + 1;
-  if (buf_len > 1) {
-    buf = (char *)malloc(buf_len);
-    if (!buf) {
-      httpd_resp_send_500(req);
-      return ESP_FAIL;
+  uint32_t epoch = stream_epoch;
+  stream_begin();
+
+  while (true) {
+    if (epoch != stream_epoch) {
+      log_i("Stream ended by the supervisor");
+      break;
     }
-    if (httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK) {
-      *obuf = buf;
-      return ESP_OK;
+    camera_fb_t *fb = camera_fb_get();
+    if (!fb) {
+      log_e("Camera capture failed");
+      res = ESP_FAIL;
+      break;
     }
-    free(buf);
+    res = send_raw_frame(req, fb);
+    camera_fb_return(fb);
+    if (res != ESP_OK) {
+      log_e("Send frame failed");
+      break;
+    }
+    mem.sample();
+    stream_sent = esp_timer_get_time();
   }
-  httpd_resp_send_404(req);
-  return ESP_FAIL;
+
+  stream_end();
+
+  return res;
 }
 
-static esp_err_t cmd_handler(httpd_req_t *req) {
-  char *buf = NULL;
-  char variable[32];
-  char value[32];
+static esp_err_t stream_async_handler(httpd_req_t *req) {
+  return stream_submit(req, stream_handler);
+}
 
-  if (parse_get(req, &buf) != ESP_OK) {
-    return ESP_FAIL;
-  }
-  if (httpd_query_key_value(buf, "var", variable, sizeof(variable)) != ESP_OK || httpd_query_key_value(buf, "val", value, sizeof(value)) != ESP_OK) {
-    free(buf);
-    httpd_resp_send_404(req);
-    return ESP_FAIL;
-  }
-  free(buf);
+static esp_err_t raw_stream_async_handler(httpd_req_t *req) {
+  return stream_submit(req, raw_stream_handler);
+}
 
-  int val = atoi(value);
-  log_i("%s = %d", variable, val);
+// PLL and window last set through /pll and /resolution, the sensor can't report them back
+static sensor_profile_t sensor_custom;
+
+// Applies one /control setting, shared by the HTTP and WebSocket paths. Returns < 0 on error.
+static int apply_control(const char *variable, int val) {
   sensor_t *s = esp_camera_sensor_get();
   int res = 0;
 
   if (!strcmp(variable, "framesize")) {
     if (s->pixformat == PIXFORMAT_JPEG) {
       res = s->set_framesize(s, (framesize_t)val);
+      // replaces the custom window, and on OV3660/OV5640 the PLL
+      sensor_custom.has_window = false;
+      sensor_custom.has_pll = false;
+      xSemaphoreTake(adapt_lock, portMAX_DELAY);
+      adapt.max_size = (framesize_t)val;
+      xSemaphoreGive(adapt_lock);
     }
   } else if (!strcmp(variable, "quality")) {
     res = s->set_quality(s, val);
+    xSemaphoreTake(adapt_lock, portMAX_DELAY);
+    adapt.base_quality = val;
+    xSemaphoreGive(adapt_lock);
   } else if (!strcmp(variable, "contrast")) {
     res = s->set_contrast(s, val);
   } else if (!strcmp(variable, "brightness")) {
@@ -834,33 +3059,58 @@ static esp_err_t cmd_handler(httpd_req_t *req) {
   } else if (!strcmp(variable, "ae_level")) {
     res = s->set_ae_level(s, val);
   }
+  else if (!strcmp(variable, "keep_warm")) {
+    keep_warm_set(val);
+  }
+  else if (!strcmp(variable, "adaptive")) {
+    adapt_enable(val);
+  } else if (!strcmp(variable, "adapt_fps")) {
+    if (val < 1 || val > 60) {
+      return -1;
+    }
+    xSemaphoreTake(adapt_lock, portMAX_DELAY);
+    adapt.target_fps = val;
+    xSemaphoreGive(adapt_lock);
+  }
 #if CONFIG_LED_ILLUMINATOR_ENABLED
   else if (!strcmp(variable, "led_intensity")) {
-    led_duty = val;
-    if (isStreaming) {
+    settings_t *next = settings_edit();
+    next->led_duty = val;
+    settings_publish(next);
+    if (streams_open) {
       enable_led(true);
     }
   }
 #endif
 
 #if CONFIG_ESP_FACE_DETECT_ENABLED
-  else if (!strcmp(variable, "face_detect")) {
-    detection_enabled = val;
+  else if (!strcmp(variable, "mcu_overlay")) {
+    settings_t *next = settings_edit();
+    next->mcu_overlay_enabled = val;
+    settings_publish(next);
+  } else if (!strcmp(variable, "face_detect")) {
+    settings_t *next = settings_edit();
+    next->detection_enabled = val;
 #if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-    if (!detection_enabled) {
-      recognition_enabled = 0;
+    if (!next->detection_enabled) {
+      next->recognition_enabled = 0;
     }
 #endif
+    settings_publish(next);
   }
 #if CONFIG_ESP_FACE_RECOGNITION_ENABLED
   else if (!strcmp(variable, "face_enroll")) {
-    is_enrolling = !is_enrolling;
-    log_i("Enrolling: %s", is_enrolling ? "true" : "false");
+    settings_t *next = settings_edit();
+    next->is_enrolling = !next->is_enrolling;
+    log_i("Enrolling: %s", next->is_enrolling ? "true" : "false");
+    settings_publish(next);
   } else if (!strcmp(variable, "face_recognize")) {
-    recognition_enabled = val;
-    if (recognition_enabled) {
-      detection_enabled = val;
+    settings_t *next = settings_edit();
+    next->recognition_enabled = val;
+    if (next->recognition_enabled) {
+      next->detection_enabled = val;
     }
+    settings_publish(next);
   }
 #endif
 #endif
@@ -869,20 +3119,137 @@ static esp_err_t cmd_handler(httpd_req_t *req) {
     res = -1;
   }
 
-  if (res < 0) {
+  if (res >= 0) {
+    reg_shadow_invalidate();
+  }
+  return res;
+}
+
+static esp_err_t cmd_handler(httpd_req_t *req) {
+  MemScope mem(MEM_CONTROL);
+  char *buf = NULL;
+  char variable[32];
+  char value[32];
+
+  if (parse_get(req, &buf) != ESP_OK) {
+    return ESP_FAIL;
+  }
+  if (httpd_query_key_value(buf, "var", variable, sizeof(variable)) != ESP_OK || httpd_query_key_value(buf, "val", value, sizeof(value)) != ESP_OK) {
+    free(buf);
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+  free(buf);
+
+  int val = atoi(value);
+  log_i("%s = %d", variable, val);
+  if (apply_control(variable, val) < 0) {
     return httpd_resp_send_500(req);
   }
+  frame_ring_flush();
 
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
   return httpd_resp_send(req, NULL, 0);
 }
 
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+// Binary control protocol on /ws. A binary frame carries one or more ctrl_msg_t back to back and is
+// answered with one frame holding a reply per command, in the same order, so a client can keep many
+// commands in flight. A text frame "params" is answered with the names for the param ids, comma separated;
+// other text frames get no answer.
+#define CTRL_OP_SET   1  // apply_control(control_params[param], value)
+#define CTRL_OP_PING  2  // echoes value, for latency measurements
+#define CTRL_OP_REPLY 0x80
+#define CTRL_MAX_BATCH 32
+
+// Little endian. Replies have op | CTRL_OP_REPLY and the result (< 0 on error) in value.
+typedef struct __attribute__((packed)) {
+  uint8_t op;
+  uint8_t param;
+  uint16_t seq;  // echoed back
+  int32_t value;
+} ctrl_msg_t;
+
+// Param ids are indexes into this table; append only, so clients can cache it
+static const char *const control_params[] = {
+  "framesize", "quality", "contrast", "brightness", "saturation", "gainceiling", "colorbar", "awb",
+  "agc", "aec", "hmirror", "vflip", "awb_gain", "agc_gain", "aec_value", "aec2",
+  "dcw", "bpc", "wpc", "raw_gma", "lenc", "special_effect", "wb_mode", "ae_level",
+  "keep_warm", "led_intensity", "mcu_overlay", "face_detect", "face_enroll", "face_recognize",
+  "adaptive", "adapt_fps",
+};
+
+static esp_err_t ws_control_handler(httpd_req_t *req) {
+  MemScope mem(MEM_CONTROL);
+  if (req->method == HTTP_GET) {
+    log_i("Control socket opened");
+    return ESP_OK;
+  }
+
+  static ctrl_msg_t msgs[CTRL_MAX_BATCH];
+  httpd_ws_frame_t frame;
+  memset(&frame, 0, sizeof(frame));
+  esp_err_t ret = httpd_ws_recv_frame(req, &frame, 0);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  if (frame.len > sizeof(msgs)) {
+    log_e("Control frame too long: %u", frame.len);
+    return ESP_FAIL;
+  }
+  frame.payload = (uint8_t *)msgs;
+  ret = httpd_ws_recv_frame(req, &frame, sizeof(msgs));
+  if (ret != ESP_OK) {
+    return ret;
+  }
+
+  if (frame.type == HTTPD_WS_TYPE_TEXT && frame.len == strlen("params") && !memcmp(frame.payload, "params", frame.len)) {
+    static char names[384];
+    char *p = names;
+    for (size_t i = 0; i < sizeof(control_params) / sizeof(control_params[0]); i++) {
+      p += sprintf(p, i ? ",%s" : "%s", control_params[i]);
+    }
+    frame.payload = (uint8_t *)names;
+    frame.len = p - names;
+    return httpd_ws_send_frame(req, &frame);
+  }
+  // any other text frame is dropped, like a binary frame that isn't whole messages
+  if (frame.type != HTTPD_WS_TYPE_BINARY || frame.len % sizeof(ctrl_msg_t)) {
+    return ESP_OK;
+  }
+
+  bool changed = false;
+  for (size_t i = 0; i < frame.len / sizeof(ctrl_msg_t); i++) {
+    ctrl_msg_t *m = &msgs[i];
+    if (m->op == CTRL_OP_SET) {
+      m->value = m->param < sizeof(control_params) / sizeof(control_params[0]) ? apply_control(control_params[m->param], m->value) : -1;
+      changed |= m->value >= 0;
+    } else if (m->op != CTRL_OP_PING) {
+      m->value = -1;
+    }
+    m->op |= CTRL_OP_REPLY;
+  }
+  // one flush for the whole batch
+  if (changed) {
+    frame_ring_flush();
+  }
+  return httpd_ws_send_frame(req, &frame);
+}
+#endif
+
 static int print_reg(char *p, sensor_t *s, uint16_t reg, uint32_t mask) {
   return sprintf(p, "\"0x%x\":%u,", reg, s->get_reg(s, reg, mask));
 }
 
+// For the tables that only change when written (gamma, color matrix, SDE)
+static int print_reg_shadow(char *p, sensor_t *s, uint16_t reg, uint32_t mask) {
+  bool hit;
+  return sprintf(p, "\"0x%x\":%u,", reg, reg_shadow_get(s, reg, mask, &hit));
+}
+
 static esp_err_t status_handler(httpd_req_t *req) {
-  static char json_response[1024];
+  MemScope mem(MEM_STATUS);
+  static char json_response[1536];
 
   sensor_t *s = esp_camera_sensor_get();
   char *p = json_response;
@@ -900,17 +3267,17 @@ static esp_err_t status_handler(httpd_req_t *req) {
     p += print_reg(p, s, 0x350c, 0xFFFF);  //16 bit
 
     for (int reg = 0x5480; reg <= 0x5490; reg++) {
-      p += print_reg(p, s, reg, 0xFF);
+      p += print_reg_shadow(p, s, reg, 0xFF);
     }
 
     for (int reg = 0x5380; reg <= 0x538b; reg++) {
-      p += print_reg(p, s, reg, 0xFF);
+      p += print_reg_shadow(p, s, reg, 0xFF);
     }
 
     for (int reg = 0x5580; reg < 0x558a; reg++) {
-      p += print_reg(p, s, reg, 0xFF);
+      p += print_reg_shadow(p, s, reg, 0xFF);
     }
-    p += print_reg(p, s, 0x558a, 0x1FF);  //9 bit
+    p += print_reg_shadow(p, s, 0x558a, 0x1FF);  //9 bit
   } else if (s->id.PID == OV2640_PID) {
     p += print_reg(p, s, 0xd3, 0xFF);
     p += print_reg(p, s, 0x111, 0xFF);
@@ -943,16 +3310,28 @@ static esp_err_t status_handler(httpd_req_t *req) {
   p += sprintf(p, "\"hmirror\":%u,", s->status.hmirror);
   p += sprintf(p, "\"dcw\":%u,", s->status.dcw);
   p += sprintf(p, "\"colorbar\":%u", s->status.colorbar);
+  p += sprintf(p, ",\"keep_warm\":%u", keep_warm_enabled);
+  adapt_state_t a = adapt_get();
+  p += sprintf(p, ",\"adaptive\":%u,\"adapt_fps\":%u", a.enabled, a.target_fps);
+  if (a.enabled) {
+    p += sprintf(
+      p, ",\"adapt_max_size\":%u,\"adapt_base_quality\":%u,\"adapt_send_ms\":%u,\"adapt_frame_ms\":%u,\"adapt_rssi\":%d", a.max_size, a.base_quality, a.send_ms,
+      a.frame_ms, a.rssi
+    );
+    p += sprintf(p, ",\"adapt_steps_up\":%u,\"adapt_steps_down\":%u,\"adapt_decision\":\"%s\"", a.steps_up, a.steps_down, a.decision);
+  }
+  settings_t cfg = settings_get();
 #if CONFIG_LED_ILLUMINATOR_ENABLED
-  p += sprintf(p, ",\"led_intensity\":%u", led_duty);
+  p += sprintf(p, ",\"led_intensity\":%u", cfg.led_duty);
 #else
   p += sprintf(p, ",\"led_intensity\":%d", -1);
 #endif
 #if CONFIG_ESP_FACE_DETECT_ENABLED
-  p += sprintf(p, ",\"face_detect\":%u", detection_enabled);
+  p += sprintf(p, ",\"face_detect\":%u", cfg.detection_enabled);
+  p += sprintf(p, ",\"mcu_overlay\":%u", cfg.mcu_overlay_enabled);
 #if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-  p += sprintf(p, ",\"face_enroll\":%u,", is_enrolling);
-  p += sprintf(p, "\"face_recognize\":%u", recognition_enabled);
+  p += sprintf(p, ",\"face_enroll\":%u,", cfg.is_enrolling);
+  p += sprintf(p, "\"face_recognize\":%u", cfg.recognition_enabled);
 #endif
 #endif
   *p++ = '}';
@@ -963,6 +3342,7 @@ static esp_err_t status_handler(httpd_req_t *req) {
 }
 
 static esp_err_t xclk_handler(httpd_req_t *req) {
+  MemScope mem(MEM_REGISTERS);
   char *buf = NULL;
   char _xclk[32];
 
@@ -981,6 +3361,7 @@ static esp_err_t xclk_handler(httpd_req_t *req) {
 
   sensor_t *s = esp_camera_sensor_get();
   int res = s->set_xclk(s, LEDC_TIMER_0, xclk);
+  reg_shadow_invalidate();
   if (res) {
     return httpd_resp_send_500(req);
   }
@@ -990,6 +3371,7 @@ static esp_err_t xclk_handler(httpd_req_t *req) {
 }
 
 static esp_err_t reg_handler(httpd_req_t *req) {
+  MemScope mem(MEM_REGISTERS);
   char *buf = NULL;
   char _reg[32];
   char _mask[32];
@@ -1013,126 +3395,845 @@ static esp_err_t reg_handler(httpd_req_t *req) {
 
   sensor_t *s = esp_camera_sensor_get();
   int res = s->set_reg(s, reg, mask, val);
+  reg_shadow_invalidate();
+  if (res) {
+    return httpd_resp_send_500(req);
+  }
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, NULL, 0);
+}
+
+static esp_err_t greg_handler(httpd_req_t *req) {
+  MemScope mem(MEM_REGISTERS);
+  char *buf = NULL;
+  char _reg[32];
+  char _mask[32];
+
+  if (parse_get(req, &buf) != ESP_OK) {
+    return ESP_FAIL;
+  }
+  if (httpd_query_key_value(buf, "reg", _reg, sizeof(_reg)) != ESP_OK || httpd_query_key_value(buf, "mask", _mask, sizeof(_mask)) != ESP_OK) {
+    free(buf);
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+  free(buf);
+
+  int reg = atoi(_reg);
+  int mask = atoi(_mask);
+  sensor_t *s = esp_camera_sensor_get();
+  int res = s->get_reg(s, reg, mask);
+  if (res < 0) {
+    return httpd_resp_send_500(req);
+  }
+  log_i("Get Register: reg: 0x%02x, mask: 0x%02x, value: 0x%02x", reg, mask, res);
+
+  char buffer[20];
+  const char *val = itoa(res, buffer, 10);
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, val, strlen(val));
+}
+
+// Reads or writes a run of consecutive registers in one request:
+//   /regs?reg=0x5480&count=17[&mask=0xFF][&fresh=1]  -> JSON array of values
+//   /regs?reg=0x5480&val=0x01,0x08,...[&mask=0xFF]    -> writes one value per register
+// The sensor driver only does single register SCCB transactions, so this batches at the HTTP level
+// and serves repeated reads from the register shadow (fresh=1 bypasses it).
+#define REGS_MAX_COUNT 64
+
+static esp_err_t regs_handler(httpd_req_t *req) {
+  MemScope mem(MEM_REGISTERS);
+  char *buf = NULL;
+  char _reg[16];
+  char _num[16];
+  static char vals[REGS_MAX_COUNT * 8 + 1];
+
+  if (parse_get(req, &buf) != ESP_OK) {
+    return ESP_FAIL;
+  }
+  if (httpd_query_key_value(buf, "reg", _reg, sizeof(_reg)) != ESP_OK) {
+    free(buf);
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+  int reg = strtol(_reg, NULL, 0);
+  uint32_t mask = 0xFF;
+  if (httpd_query_key_value(buf, "mask", _num, sizeof(_num)) == ESP_OK) {
+    mask = strtoul(_num, NULL, 0);
+  }
+  bool fresh = parse_get_var(buf, "fresh", 0) == 1;
+  int count = parse_get_var(buf, "count", 1);
+  esp_err_t val_res = httpd_query_key_value(buf, "val", vals, sizeof(vals));
+  free(buf);
+  if (val_res == ESP_ERR_HTTPD_RESULT_TRUNC) {
+    return httpd_resp_send_500(req);
+  }
+  bool write = val_res == ESP_OK;
+
+  sensor_t *s = esp_camera_sensor_get();
+  int64_t start = esp_timer_get_time();
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  if (write) {
+    count = 0;
+    for (char *p = vals; *p && count < REGS_MAX_COUNT; count++) {
+      char *end;
+      int val = strtol(p, &end, 0);
+      // httpd_query_key_value doesn't url decode, so accept both , and %2C
+      if (end == p) {
+        break;
+      }
+      if (s->set_reg(s, reg + count, mask, val)) {
+        reg_shadow_invalidate();
+        return httpd_resp_send_500(req);
+      }
+      p = end;
+      if (*p == ',') {
+        p++;
+      } else if (strncasecmp(p, "%2C", 3) == 0) {
+        p += 3;
+      }
+    }
+    reg_shadow_invalidate();
+    log_i("REGS: wrote %d from 0x%04x in %ums", count, reg, (uint32_t)((esp_timer_get_time() - start) / 1000));
+    return httpd_resp_send(req, NULL, 0);
+  }
+
+  if (count < 1 || count > REGS_MAX_COUNT) {
+    return httpd_resp_send_500(req);
+  }
+  static char json[REGS_MAX_COUNT * 12 + 2];
+  char *p = json;
+  int hits = 0;
+  *p++ = '[';
+  for (int i = 0; i < count; i++) {
+    bool hit = false;
+    int value = fresh ? s->get_reg(s, reg + i, mask) : reg_shadow_get(s, reg + i, mask, &hit);
+    if (value < 0) {
+      return httpd_resp_send_500(req);
+    }
+    hits += hit;
+    p += sprintf(p, i ? ",%d" : "%d", value);
+  }
+  *p++ = ']';
+  *p = 0;
+  log_i("REGS: read %d from 0x%04x, %d from shadow, %ums", count, reg, hits, (uint32_t)((esp_timer_get_time() - start) / 1000));
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_send(req, json, p - json);
+}
+
+static esp_err_t pll_handler(httpd_req_t *req) {
+  MemScope mem(MEM_REGISTERS);
+  char *buf = NULL;
+
+  if (parse_get(req, &buf) != ESP_OK) {
+    return ESP_FAIL;
+  }
+
+  int bypass = parse_get_var(buf, "bypass", 0);
+  int mul = parse_get_var(buf, "mul", 0);
+  int sys = parse_get_var(buf, "sys", 0);
+  int root = parse_get_var(buf, "root", 0);
+  int pre = parse_get_var(buf, "pre", 0);
+  int seld5 = parse_get_var(buf, "seld5", 0);
+  int pclken = parse_get_var(buf, "pclken", 0);
+  int pclk = parse_get_var(buf, "pclk", 0);
+  free(buf);
+
+  log_i("Set Pll: bypass: %d, mul: %d, sys: %d, root: %d, pre: %d, seld5: %d, pclken: %d, pclk: %d", bypass, mul, sys, root, pre, seld5, pclken, pclk);
+  sensor_t *s = esp_camera_sensor_get();
+  int res = s->set_pll(s, bypass, mul, sys, root, pre, seld5, pclken, pclk);
+  reg_shadow_invalidate();
+  if (res) {
+    return httpd_resp_send_500(req);
+  }
+  sensor_custom.has_pll = true;
+  sensor_custom.pll = {bypass, mul, sys, root, pre, seld5, pclken, pclk};
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, NULL, 0);
+}
+
+static esp_err_t win_handler(httpd_req_t *req) {
+  MemScope mem(MEM_REGISTERS);
+  char *buf = NULL;
+
+  if (parse_get(req, &buf) != ESP_OK) {
+    return ESP_FAIL;
+  }
+
+  int startX = parse_get_var(buf, "sx", 0);
+  int startY = parse_get_var(buf, "sy", 0);
+  int endX = parse_get_var(buf, "ex", 0);
+  int endY = parse_get_var(buf, "ey", 0);
+  int offsetX = parse_get_var(buf, "offx", 0);
+  int offsetY = parse_get_var(buf, "offy", 0);
+  int totalX = parse_get_var(buf, "tx", 0);
+  int totalY = parse_get_var(buf, "ty", 0);  // codespell:ignore totaly
+  int outputX = parse_get_var(buf, "ox", 0);
+  int outputY = parse_get_var(buf, "oy", 0);
+  bool scale = parse_get_var(buf, "scale", 0) == 1;
+  bool binning = parse_get_var(buf, "binning", 0) == 1;
+  free(buf);
+
+  log_i(
+    "Set Window: Start: %d %d, End: %d %d, Offset: %d %d, Total: %d %d, Output: %d %d, Scale: %u, Binning: %u", startX, startY, endX, endY, offsetX, offsetY,
+    totalX, totalY, outputX, outputY, scale, binning  // codespell:ignore totaly
+  );
+  sensor_t *s = esp_camera_sensor_get();
+  int res = s->set_res_raw(s, startX, startY, endX, endY, offsetX, offsetY, totalX, totalY, outputX, outputY, scale, binning);  // codespell:ignore totaly
+  reg_shadow_invalidate();
   if (res) {
     return httpd_resp_send_500(req);
   }
+  sensor_custom.has_window = true;
+  sensor_custom.window = {startX, startY, endX, endY, offsetX, offsetY, totalX, totalY, outputX, outputY, scale, binning};  // codespell:ignore totaly
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, NULL, 0);
+}
+
+// Applies a stored profile and marks the switch for profile_switch_drop()
+static int profile_apply(const sensor_profile_t *p, int *writes) {
+  sensor_t *s = esp_camera_sensor_get();
+  framesize_t framesize = s->status.framesize;
+  profile_switch.frames_lost = -1;
+  profile_switch.end = 0;
+  profile_switch.start = esp_timer_get_time();
+  int res = sensor_profile_apply(s, p, writes);
+  int64_t end = esp_timer_get_time();
+  profile_switch.switch_ms = (end - profile_switch.start) / 1000;
+  profile_switch.end = end;
+
+  reg_shadow_invalidate();
+  frame_ring_flush();
+  // same rules as /control framesize, /pll and /resolution
+  if (p->has_window || p->framesize != framesize) {
+    sensor_custom.has_window = p->has_window;
+    sensor_custom.window = p->window;
+    sensor_custom.has_pll = false;
+  }
+  if (p->has_pll) {
+    sensor_custom.has_pll = true;
+    sensor_custom.pll = p->pll;
+  }
+  xSemaphoreTake(adapt_lock, portMAX_DELAY);
+  adapt.max_size = (framesize_t)p->framesize;
+  adapt.base_quality = p->quality;
+  xSemaphoreGive(adapt_lock);
+  return res;
+}
+
+// Named sensor profiles kept in NVS:
+//   /profile                 -> stored names, boot profile and the last switch
+//   /profile?save=<name>     -> stores the current settings (plus PLL/window if set through this server)
+//   /profile?apply=<name>    -> applies one in a single pass
+//   /profile?delete=<name>, /profile?boot=<name> (empty to clear)
+static esp_err_t profile_handler(httpd_req_t *req) {
+  MemScope mem(MEM_PROFILE);
+  char name[SENSOR_PROFILE_NAME_MAX + 1];
+  sensor_profile_t profile;
+  bool ok = true;
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  if (httpd_req_get_url_query_len(req)) {
+    char *buf = NULL;
+    if (parse_get(req, &buf) != ESP_OK) {
+      return ESP_FAIL;
+    }
+    if (httpd_query_key_value(buf, "save", name, sizeof(name)) == ESP_OK) {
+      sensor_profile_capture(esp_camera_sensor_get(), &profile);
+      profile.has_pll = sensor_custom.has_pll;
+      profile.pll = sensor_custom.pll;
+      profile.has_window = sensor_custom.has_window;
+      profile.window = sensor_custom.window;
+      adapt_state_t a = adapt_get();
+      if (a.enabled) {
+        // what the user picked, not where the controller is right now
+        profile.framesize = a.max_size;
+        profile.quality = a.base_quality;
+      }
+      ok = sensor_profile_save(name, &profile);
+      log_i("Save profile '%s': %s", name, ok ? "ok" : "failed");
+    } else if (httpd_query_key_value(buf, "apply", name, sizeof(name)) == ESP_OK) {
+      free(buf);
+      int writes = 0;
+      if (!sensor_profile_load(name, &profile) || profile_apply(&profile, &writes) < 0) {
+        return httpd_resp_send_500(req);
+      }
+      log_i("Apply profile '%s': %d writes, %ums", name, writes, profile_switch.switch_ms);
+      char json[96];
+      int len = snprintf(json, sizeof(json), "{\"profile\":\"%s\",\"writes\":%d,\"switch_ms\":%u}", name, writes, profile_switch.switch_ms);
+      httpd_resp_set_type(req, "application/json");
+      return httpd_resp_send(req, json, len);
+    } else if (httpd_query_key_value(buf, "delete", name, sizeof(name)) == ESP_OK) {
+      ok = sensor_profile_remove(name);
+    } else if (httpd_query_key_value(buf, "boot", name, sizeof(name)) == ESP_OK) {
+      ok = sensor_profile_set_boot(name);
+    } else {
+      free(buf);
+      return httpd_resp_send_404(req);
+    }
+    free(buf);
+    if (!ok) {
+      return httpd_resp_send_500(req);
+    }
+    return httpd_resp_send(req, NULL, 0);
+  }
+
+  char list[SENSOR_PROFILE_LIST_MAX];
+  char boot[SENSOR_PROFILE_NAME_MAX + 1];
+  // every name quoted: at most twice the list, for one-character names
+  static char json[SENSOR_PROFILE_LIST_MAX * 2 + 96];
+  sensor_profile_list(list, sizeof(list));
+  sensor_profile_get_boot(boot, sizeof(boot));
+  char *p = json;
+  int n = 0;
+  p += sprintf(p, "{\"profiles\":[");
+  for (char *item = strtok(list, ","); item; item = strtok(NULL, ",")) {
+    p += sprintf(p, n++ ? ",\"%s\"" : "\"%s\"", item);
+  }
+  p += sprintf(p, "],\"boot\":\"%s\",\"switch_ms\":%u,\"frames_lost\":%d}", boot, profile_switch.switch_ms, profile_switch.frames_lost);
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_send(req, json, p - json);
+}
+
+#define CAMERA_BENCH_FRAMES     30
+#define CAMERA_BENCH_MAX_FRAMES 200
+#define CAMERA_BENCH_MAX_XCLK   4
+
+// Restarts the driver with `c` and puts the sensor settings back, including PLL and window.
+// Streams are ended first; their grabs would come back empty while the driver is down.
+static esp_err_t camera_reinit(const camera_setup_t *c) {
+  streams_stop();
+  sensor_profile_t profile;
+  sensor_profile_capture(esp_camera_sensor_get(), &profile);
+  profile.has_pll = sensor_custom.has_pll;
+  profile.pll = sensor_custom.pll;
+  profile.has_window = sensor_custom.has_window;
+  profile.window = sensor_custom.window;
+
+  esp_err_t err = camera_setup_reinit(c);
+  int writes;
+  sensor_profile_apply(esp_camera_sensor_get(), &profile, &writes);
+  reg_shadow_invalidate();
+  frame_ring_flush();
+  return err;
+}
+
+static int print_camera_setup(char *p, const camera_setup_t *c) {
+  return sprintf(p, "\"fb_count\":%u,\"grab_mode\":%u,\"fb_location\":%u,\"xclk\":%u", c->fb_count, c->grab_mode, c->fb_location, c->xclk_mhz);
+}
+
+// Frame buffer setup (see camera_setup.h), restarts the camera driver:
+//   /camera                                                  -> running setup
+//   /camera?fb_count=2&grab_mode=1&fb_location=0&xclk=20     -> re-init with the given fields changed, saved when it works
+//   /camera?reset=1                                          -> drops the saved setup, the board defaults apply from the next boot
+//   /camera?bench=1[&frames=30][&xclk=10,20]                 -> measures every fb_count/grab_mode/fb_location combination
+// Streams are ended before the driver restarts. The bench blocks the server for a few seconds per combination.
+static esp_err_t camera_handler(httpd_req_t *req) {
+  MemScope mem(MEM_CAMERA);
+  char *buf = NULL;
+  camera_setup_t setup;
+  camera_setup_get(&setup);
+  // /xclk changes the clock without a re-init
+  setup.xclk_mhz = esp_camera_sensor_get()->xclk_freq_hz / 1000000;
+  static char json[192];
+  char *p = json;
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  if (httpd_req_get_url_query_len(req)) {
+    if (parse_get(req, &buf) != ESP_OK) {
+      return ESP_FAIL;
+    }
+    if (parse_get_var(buf, "reset", 0)) {
+      free(buf);
+      if (!camera_setup_clear()) {
+        return httpd_resp_send_500(req);
+      }
+      return httpd_resp_send(req, NULL, 0);
+    }
+
+    if (parse_get_var(buf, "bench", 0)) {
+      int frames = parse_get_var(buf, "frames", CAMERA_BENCH_FRAMES);
+      int xclk[CAMERA_BENCH_MAX_XCLK] = {setup.xclk_mhz};
+      int xclk_count = 1;
+      char list[32];
+      if (httpd_query_key_value(buf, "xclk", list, sizeof(list)) == ESP_OK) {
+        xclk_count = 0;
+        for (char *item = strtok(list, ","); item && xclk_count < CAMERA_BENCH_MAX_XCLK; item = strtok(NULL, ",")) {
+          xclk[xclk_count++] = atoi(item);
+        }
+      }
+      free(buf);
+      if (frames < 1 || frames > CAMERA_BENCH_MAX_FRAMES || !xclk_count) {
+        return httpd_resp_send_500(req);
+      }
+
+      // one chunk per combination, so the client sees progress
+      camera_setup_t restore = setup;
+      camera_bench_t best;
+      memset(&best, 0, sizeof(best));
+      int n = 0;
+      httpd_resp_set_type(req, "application/json");
+      p += sprintf(p, "{\"frames\":%d,\"results\":[", frames);
+      httpd_resp_send_chunk(req, json, p - json);
+      for (int x = 0; x < xclk_count; x++) {
+        for (int location = CAMERA_FB_IN_PSRAM; location <= CAMERA_FB_IN_DRAM; location++) {
+          for (int count = 1; count <= 3; count++) {
+            for (int mode = CAMERA_GRAB_WHEN_EMPTY; mode <= CAMERA_GRAB_LATEST; mode++) {
+              camera_setup_t c = {CAMERA_SETUP_VERSION, (uint8_t)count, (uint8_t)mode, (uint8_t)location, (uint8_t)xclk[x]};
+              if (!camera_setup_valid(&c)) {
+                continue;
+              }
+              camera_bench_t r;
+              memset(&r, 0, sizeof(r));
+              r.setup = c;
+              if (camera_reinit(&c) == ESP_OK) {
+                camera_setup_bench(frames, &r);
+              }
+              log_i(
+                "Bench fb_count %u, grab_mode %u, fb_location %u, xclk %u: %s %u.%u fps, wait %uus, age %uus", c.fb_count, c.grab_mode, c.fb_location, c.xclk_mhz,
+                r.ok ? "ok" : "failed", r.fps_x10 / 10, r.fps_x10 % 10, r.wait_us, r.age_us
+              );
+              // fastest, then freshest
+              if (r.ok && (!best.ok || r.fps_x10 > best.fps_x10 || (r.fps_x10 == best.fps_x10 && r.age_us < best.age_us))) {
+                best = r;
+              }
+              p = json;
+              p += sprintf(p, n++ ? ",{" : "{");
+              p += print_camera_setup(p, &c);
+              p += sprintf(p, ",\"ok\":%u,\"fps\":%u.%u,\"wait_us\":%u,\"age_us\":%u}", r.ok, r.fps_x10 / 10, r.fps_x10 % 10, r.wait_us, r.age_us);
+              httpd_resp_send_chunk(req, json, p - json);
+            }
+          }
+        }
+      }
+      p = json;
+      p += sprintf(p, "],\"best\":");
+      if (best.ok) {
+        *p++ = '{';
+        p += print_camera_setup(p, &best.setup);
+        *p++ = '}';
+      } else {
+        p += sprintf(p, "null");
+      }
+      *p++ = '}';
+      if (camera_reinit(&restore) != ESP_OK) {
+        log_e("Could not restore the camera setup after the bench");
+      }
+      httpd_resp_send_chunk(req, json, p - json);
+      return httpd_resp_send_chunk(req, NULL, 0);
+    }
+
+    setup.fb_count = parse_get_var(buf, "fb_count", setup.fb_count);
+    setup.grab_mode = parse_get_var(buf, "grab_mode", setup.grab_mode);
+    setup.fb_location = parse_get_var(buf, "fb_location", setup.fb_location);
+    setup.xclk_mhz = parse_get_var(buf, "xclk", setup.xclk_mhz);
+    free(buf);
+    if (!camera_setup_valid(&setup)) {
+      return httpd_resp_send_500(req);
+    }
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = camera_reinit(&setup);
+    log_i("Camera re-init: 0x%x, %ums", err, (uint32_t)((esp_timer_get_time() - start) / 1000));
+    if (err != ESP_OK || !camera_setup_save(&setup)) {
+      return httpd_resp_send_500(req);
+    }
+  }
+
+  camera_setup_get(&setup);
+  *p++ = '{';
+  p += print_camera_setup(p, &setup);
+  p += sprintf(p, ",\"psram\":%u}", psramFound());
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_send(req, json, p - json);
+}
+
+// Supervisor: the Arduino loop task waits for fault events and recovers from them in place,
+// without a reboot:
+//   Wi-Fi disconnected  -> esp_wifi_connect() with backoff, recovered when the station has an IP again
+//   failed captures     -> camera driver re-init, recovered at the next good frame
+//   stalled stream      -> ends it so the client reconnects, recovered when frames flow again
+//   heap low water      -> drops idle conversion buffers, then the stream
+// Time to recovery is kept per fault kind and reported by /health.
+#define SUPERVISOR_TICK_MS             1000
+#define SUPERVISOR_CAPTURE_FAILURES    3      // in a row
+#define SUPERVISOR_CAMERA_RETRY_MS     5000
+#define SUPERVISOR_WIFI_BACKOFF_MS     500
+#define SUPERVISOR_WIFI_BACKOFF_MAX_MS 8000
+#define SUPERVISOR_STREAM_STALL_MS     10000
+#define SUPERVISOR_HEAP_LOW            (24 * 1024)  // free internal RAM
+#define SUPERVISOR_HEAP_OK             (32 * 1024)
+
+#define SUPERVISOR_WIFI_DOWN   (1 << 0)
+#define SUPERVISOR_WIFI_UP     (1 << 1)
+#define SUPERVISOR_CAPTURE_BAD (1 << 2)
+#define SUPERVISOR_CAPTURE_OK  (1 << 3)
+#define SUPERVISOR_HEAP_FAILED (1 << 4)
+#define SUPERVISOR_EVENTS      0x1F
+
+typedef enum {
+  FAULT_WIFI,
+  FAULT_CAMERA,
+  FAULT_STREAM,
+  FAULT_HEAP,
+  FAULT_KINDS
+} fault_kind_t;
+
+static const char *const fault_names[FAULT_KINDS] = {"wifi", "camera", "stream", "heap"};
+
+typedef struct {
+  int64_t since;  // start of the ongoing fault, 0 when healthy
+  int64_t retry;  // next recovery action
+  uint32_t faults;
+  uint32_t actions;  // recovery attempts
+  uint32_t recoveries;
+  uint32_t total_ms;
+  uint32_t last_ms;
+  uint32_t max_ms;
+} fault_stats_t;
+
+static fault_stats_t faults[FAULT_KINDS];
+static EventGroupHandle_t supervisor_events = NULL;
+
+static void supervisor_wifi_event(void *arg, esp_event_base_t base, int32_t id, void *data) {
+  xEventGroupSetBits(supervisor_events, base == IP_EVENT ? SUPERVISOR_WIFI_UP : SUPERVISOR_WIFI_DOWN);
+}
+
+static void supervisor_capture_event(int failures) {
+  if (failures == SUPERVISOR_CAPTURE_FAILURES) {
+    xEventGroupSetBits(supervisor_events, SUPERVISOR_CAPTURE_BAD);
+  } else if (!failures) {
+    xEventGroupSetBits(supervisor_events, SUPERVISOR_CAPTURE_OK);
+  }
+}
+
+// PSRAM running out (frame buffers, thumbs) is not what the heap fault is about
+static void supervisor_alloc_failed(size_t size, uint32_t caps, const char *function_name) {
+  if (caps & MALLOC_CAP_INTERNAL) {
+    xEventGroupSetBits(supervisor_events, SUPERVISOR_HEAP_FAILED);
+  }
+}
+
+// Returns true when this starts a new fault
+static bool fault_begin(fault_kind_t kind, int64_t now) {
+  fault_stats_t *f = &faults[kind];
+  if (f->since) {
+    return false;
+  }
+  f->since = now;
+  f->retry = now;
+  f->faults++;
+  log_e("Fault: %s", fault_names[kind]);
+  return true;
+}
+
+static void fault_end(fault_kind_t kind, int64_t now) {
+  fault_stats_t *f = &faults[kind];
+  if (!f->since) {
+    return;
+  }
+  uint32_t ms = (now - f->since) / 1000;
+  f->since = 0;
+  f->recoveries++;
+  f->total_ms += ms;
+  f->last_ms = ms;
+  if (ms > f->max_ms) {
+    f->max_ms = ms;
+  }
+  log_i("Recovered from %s fault in %ums after %u actions, mean %ums", fault_names[kind], ms, f->actions, f->total_ms / f->recoveries);
+}
+
+static void supervisor_start() {
+  supervisor_events = xEventGroupCreate();
+  esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, supervisor_wifi_event, NULL);
+  esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, supervisor_wifi_event, NULL);
+  camera_setup_on_failure(supervisor_capture_event);
+  heap_caps_register_failed_alloc_callback(supervisor_alloc_failed);
+  // the heap action trims the pool, also when a failed camera init kept the servers from starting
+  frame_pool_init();
+}
+
+// One pass of the supervisor, run from loop(). Waits for a fault event or the next tick.
+void supervisorLoop() {
+  if (!supervisor_events) {
+    supervisor_start();
+  }
+  EventBits_t ev = xEventGroupWaitBits(supervisor_events, SUPERVISOR_EVENTS, pdTRUE, pdFALSE, SUPERVISOR_TICK_MS / portTICK_PERIOD_MS);
+  int64_t now = esp_timer_get_time();
+
+  // Wi-Fi: every failed attempt reports another disconnect, the backoff only restarts with a new fault
+  static uint32_t wifi_backoff = SUPERVISOR_WIFI_BACKOFF_MS;
+  if ((ev & SUPERVISOR_WIFI_DOWN) && fault_begin(FAULT_WIFI, now)) {
+    wifi_backoff = SUPERVISOR_WIFI_BACKOFF_MS;
+  }
+  if (ev & SUPERVISOR_WIFI_UP) {
+    fault_end(FAULT_WIFI, now);
+  }
+  fault_stats_t *f = &faults[FAULT_WIFI];
+  if (f->since && now >= f->retry) {
+    f->actions++;
+    esp_wifi_connect();
+    f->retry = now + wifi_backoff * 1000LL;
+    wifi_backoff = wifi_backoff * 2 > SUPERVISOR_WIFI_BACKOFF_MAX_MS ? SUPERVISOR_WIFI_BACKOFF_MAX_MS : wifi_backoff * 2;
+  }
 
-  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  return httpd_resp_send(req, NULL, 0);
-}
+  // Camera: re-init, then check with a grab of our own in case nothing else is pulling frames
+  if (ev & SUPERVISOR_CAPTURE_BAD) {
+    fault_begin(FAULT_CAMERA, now);
+  }
+  if (ev & SUPERVISOR_CAPTURE_OK) {
+    fault_end(FAULT_CAMERA, now);
+  }
+  f = &faults[FAULT_CAMERA];
+  if (f->since && now >= f->retry) {
+    f->actions++;
+    f->retry = now + SUPERVISOR_CAMERA_RETRY_MS * 1000LL;
+    camera_setup_t setup;
+    camera_setup_get(&setup);
+    if (camera_reinit(&setup) == ESP_OK) {
+      camera_fb_t *fb = camera_fb_get();
+      if (fb) {
+        camera_fb_return(fb);
+        fault_end(FAULT_CAMERA, esp_timer_get_time());
+      }
+    }
+  }
 
-static esp_err_t greg_handler(httpd_req_t *req) {
-  char *buf = NULL;
-  char _reg[32];
-  char _mask[32];
+  // Stream: a stream that stops sending is ended, frames reaching the client again end the fault
+  bool stalled = streams_open && now - stream_sent > SUPERVISOR_STREAM_STALL_MS * 1000LL;
+  f = &faults[FAULT_STREAM];
+  if (stalled && fault_begin(FAULT_STREAM, now)) {
+    f->actions++;
+    stream_epoch++;
+  } else if (!stalled) {
+    fault_end(FAULT_STREAM, now);
+  }
 
-  if (parse_get(req, &buf) != ESP_OK) {
-    return ESP_FAIL;
+  // Heap: cached buffers go first, the stream and its buffers on the next tick
+  size_t heap_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+  if ((ev & SUPERVISOR_HEAP_FAILED) || heap_free < SUPERVISOR_HEAP_LOW) {
+    fault_begin(FAULT_HEAP, now);
   }
-  if (httpd_query_key_value(buf, "reg", _reg, sizeof(_reg)) != ESP_OK || httpd_query_key_value(buf, "mask", _mask, sizeof(_mask)) != ESP_OK) {
-    free(buf);
-    httpd_resp_send_404(req);
-    return ESP_FAIL;
+  f = &faults[FAULT_HEAP];
+  if (f->since && heap_free >= SUPERVISOR_HEAP_OK) {
+    fault_end(FAULT_HEAP, now);
+  } else if (f->since && now >= f->retry) {
+    f->actions++;
+    if (f->retry == f->since) {
+      frame_pool_trim();
+    } else {
+      stream_epoch++;
+    }
+    f->retry = now + SUPERVISOR_TICK_MS * 1000LL;
   }
-  free(buf);
+}
 
-  int reg = atoi(_reg);
-  int mask = atoi(_mask);
-  sensor_t *s = esp_camera_sensor_get();
-  int res = s->get_reg(s, reg, mask);
-  if (res < 0) {
-    return httpd_resp_send_500(req);
+// Fault counts and time to recovery per kind and overall
+static esp_err_t health_handler(httpd_req_t *req) {
+  static char json[1536];
+  char *p = json;
+  int64_t now = esp_timer_get_time();
+  uint32_t recoveries = 0;
+  uint32_t total_ms = 0;
+
+  p += sprintf(
+    p, "{\"uptime_s\":%u,\"heap_free\":%u,\"heap_min\":%u,\"faults\":{", (uint32_t)(now / 1000000), heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+    heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL)
+  );
+  for (int i = 0; i < FAULT_KINDS; i++) {
+    fault_stats_t *f = &faults[i];
+    p += sprintf(
+      p, "%s\"%s\":{\"active_ms\":%u,\"faults\":%u,\"actions\":%u,\"recoveries\":%u,\"mttr_ms\":%u,\"last_ms\":%u,\"max_ms\":%u}", i ? "," : "", fault_names[i],
+      f->since ? (uint32_t)((now - f->since) / 1000) : 0, f->faults, f->actions, f->recoveries, f->recoveries ? f->total_ms / f->recoveries : 0, f->last_ms, f->max_ms
+    );
+    recoveries += f->recoveries;
+    total_ms += f->total_ms;
   }
-  log_i("Get Register: reg: 0x%02x, mask: 0x%02x, value: 0x%02x", reg, mask, res);
+  p += sprintf(p, "},\"recoveries\":%u,\"mttr_ms\":%u", recoveries, recoveries ? total_ms / recoveries : 0);
 
-  char buffer[20];
-  const char *val = itoa(res, buffer, 10);
+  p += sprintf(p, ",\"low_memory\":%u,\"largest_free\":%u", CONFIG_LOW_MEMORY, heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+#if CONFIG_LOW_MEMORY
+  p += sprintf(p, ",\"work_arena\":%u,\"work_arena_peak\":%u", WORK_ARENA_SIZE, work_arena_peak);
+#endif
+  p += sprintf(p, "}");
+  httpd_resp_set_type(req, "application/json");
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  return httpd_resp_send(req, val, strlen(val));
+  return httpd_resp_send(req, json, p - json);
 }
 
-static int parse_get_var(char *buf, const char *key, int def) {
-  char _int[16];
-  if (httpd_query_key_value(buf, key, _int, sizeof(_int)) != ESP_OK) {
-    return def;
+// Current use of each heap, then per request type what it took from each heap at most and the
+// least free memory and largest free block seen while serving it
+// Takes the result of an snprintf() at buf + *len into size - *len bytes: advances *len past it,
+// or returns false when it didn't fit
+static bool chunk_fit(size_t size, size_t *len, int n) {
+  if (n < 0 || (size_t)n >= size - *len) {
+    return false;
   }
-  return atoi(_int);
+  *len += n;
+  return true;
 }
 
-static esp_err_t pll_handler(httpd_req_t *req) {
-  char *buf = NULL;
-
-  if (parse_get(req, &buf) != ESP_OK) {
-    return ESP_FAIL;
+// Appends to the chunk in json, ok drops to false once something doesn't fit
+#define METRICS_PRINTF(...) (ok = ok && chunk_fit(sizeof(json), &len, snprintf(json + len, sizeof(json) - len, __VA_ARGS__)))
+
+// Sent in chunks, the heaps first and then one per request type, so the buffer only has to hold
+// the largest of them
+static esp_err_t metrics_handler(httpd_req_t *req) {
+  static char json[384];
+  size_t len = 0;
+  bool ok = true;
+
+  METRICS_PRINTF("{\"heaps\":{");
+  for (int i = 0; i < MEM_HEAPS; i++) {
+    size_t total = heap_caps_get_total_size(mem_heap_caps[i]);
+    size_t available = heap_caps_get_free_size(mem_heap_caps[i]);
+    METRICS_PRINTF(
+      "%s\"%s\":{\"total\":%u,\"free\":%u,\"used\":%u,\"min_free\":%u,\"largest\":%u}", i ? "," : "", mem_heap_names[i], total, available, total - available,
+      heap_caps_get_minimum_free_size(mem_heap_caps[i]), heap_caps_get_largest_free_block(mem_heap_caps[i])
+    );
   }
+  METRICS_PRINTF("},\"low_memory\":%u", CONFIG_LOW_MEMORY);
+#if CONFIG_LOW_MEMORY
+  METRICS_PRINTF(",\"work_arena\":%u,\"work_arena_peak\":%u", WORK_ARENA_SIZE, work_arena_peak);
+#endif
+  METRICS_PRINTF(",\"requests\":{");
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  esp_err_t res = ok ? httpd_resp_send_chunk(req, json, len) : ESP_FAIL;
+
+  for (int i = 0; i < MEM_ENDPOINTS && res == ESP_OK; i++) {
+    mem_stats_t *m = &mem_stats[i];
+    len = 0;
+    METRICS_PRINTF(
+      "%s\"%s\":{\"budget\":%u,\"requests\":%u,\"rejected\":%u,\"failures\":%u,\"min_stack\":%u", i ? "," : "", m->name, m->budget, m->requests, m->rejected,
+      m->failures, m->min_stack
+    );
+    for (int h = 0; h < MEM_HEAPS; h++) {
+      mem_heap_stats_t *hs = &m->heap[h];
+      METRICS_PRINTF(",\"%s\":{\"peak\":%u,\"min_free\":%u,\"min_largest\":%u}", mem_heap_names[h], hs->peak, hs->min_free, hs->min_largest);
+    }
+    METRICS_PRINTF("}");
+    res = ok ? httpd_resp_send_chunk(req, json, len) : ESP_FAIL;
+  }
+  if (!ok) {
+    log_e("Metrics don't fit in %u bytes", sizeof(json));
+  }
+  if (res == ESP_OK) {
+    res = httpd_resp_send_chunk(req, "}}", 2);
+  }
+  if (res == ESP_OK) {
+    res = httpd_resp_send_chunk(req, NULL, 0);
+  }
+  return res;
+}
+#undef METRICS_PRINTF
 
-  int bypass = parse_get_var(buf, "bypass", 0);
-  int mul = parse_get_var(buf, "mul", 0);
-  int sys = parse_get_var(buf, "sys", 0);
-  int root = parse_get_var(buf, "root", 0);
-  int pre = parse_get_var(buf, "pre", 0);
-  int seld5 = parse_get_var(buf, "seld5", 0);
-  int pclken = parse_get_var(buf, "pclken", 0);
-  int pclk = parse_get_var(buf, "pclk", 0);
-  free(buf);
+// The page is served at a fixed URL, so it can't be cached forever: after a reflash the old page
+// is used for at most this long, then revalidated against the ETag (a 304 is a few hundred bytes).
+// The shared assets are requested with ?v=<hash> and are immutable.
+#define INDEX_CACHE_CONTROL  "public, max-age=86400"
+#define STATIC_CACHE_CONTROL "public, max-age=31536000, immutable"
 
-  log_i("Set Pll: bypass: %d, mul: %d, sys: %d, root: %d, pre: %d, seld5: %d, pclken: %d, pclk: %d", bypass, mul, sys, root, pre, seld5, pclken, pclk);
-  sensor_t *s = esp_camera_sensor_get();
-  int res = s->set_pll(s, bypass, mul, sys, root, pre, seld5, pclken, pclk);
-  if (res) {
-    return httpd_resp_send_500(req);
-  }
+typedef struct {
+  const uint8_t *data;
+  size_t len;
+  const char *etag;
+} web_asset_data_t;
 
-  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  return httpd_resp_send(req, NULL, 0);
-}
+typedef struct {
+  const char *type;
+  web_asset_data_t gz;
+#if CONFIG_UI_BROTLI
+  web_asset_data_t br;
+#endif
+} web_asset_t;
 
-static esp_err_t win_handler(httpd_req_t *req) {
-  char *buf = NULL;
+#if CONFIG_UI_BROTLI
+#define WEB_ASSET(name, type) \
+  { type, {name##_gz, name##_gz_len, name##_gz_etag}, {name##_br, name##_br_len, name##_br_etag} }
+#else
+#define WEB_ASSET(name, type) \
+  { type, {name##_gz, name##_gz_len, name##_gz_etag} }
+#endif
 
-  if (parse_get(req, &buf) != ESP_OK) {
-    return ESP_FAIL;
+static const web_asset_t style_asset = WEB_ASSET(style_css, "text/css");
+static const web_asset_t control_js_asset = WEB_ASSET(control_js, "text/javascript");
+static const web_asset_t index_ov2640_asset = WEB_ASSET(index_ov2640_html, "text/html");
+static const web_asset_t index_ov3660_asset = WEB_ASSET(index_ov3660_html, "text/html");
+static const web_asset_t index_ov5640_asset = WEB_ASSET(index_ov5640_html, "text/html");
+
+// True when Accept-Encoding lists `coding` and doesn't give it q=0
+static bool accepts_encoding(httpd_req_t *req, const char *coding) {
+  char buf[96];
+  size_t len = httpd_req_get_hdr_value_len(req, "Accept-Encoding");
+  if (len == 0 || len >= sizeof(buf) || httpd_req_get_hdr_value_str(req, "Accept-Encoding", buf, sizeof(buf)) != ESP_OK) {
+    return false;
   }
+  size_t n = strlen(coding);
+  char *p = buf;
+  while (p != NULL) {
+    while (*p == ' ') {
+      p++;
+    }
+    char *next = strchr(p, ',');
+    if (strncmp(p, coding, n) == 0 && (p[n] == '\0' || p[n] == ',' || p[n] == ';' || p[n] == ' ')) {
+      char *q = strstr(p, "q=");
+      return q == NULL || (next != NULL && q > next) || atof(q + 2) > 0;
+    }
+    p = next ? next + 1 : NULL;
+  }
+  return false;
+}
 
-  int startX = parse_get_var(buf, "sx", 0);
-  int startY = parse_get_var(buf, "sy", 0);
-  int endX = parse_get_var(buf, "ex", 0);
-  int endY = parse_get_var(buf, "ey", 0);
-  int offsetX = parse_get_var(buf, "offx", 0);
-  int offsetY = parse_get_var(buf, "offy", 0);
-  int totalX = parse_get_var(buf, "tx", 0);
-  int totalY = parse_get_var(buf, "ty", 0);  // codespell:ignore totaly
-  int outputX = parse_get_var(buf, "ox", 0);
-  int outputY = parse_get_var(buf, "oy", 0);
-  bool scale = parse_get_var(buf, "scale", 0) == 1;
-  bool binning = parse_get_var(buf, "binning", 0) == 1;
-  free(buf);
-
-  log_i(
-    "Set Window: Start: %d %d, End: %d %d, Offset: %d %d, Total: %d %d, Output: %d %d, Scale: %u, Binning: %u", startX, startY, endX, endY, offsetX, offsetY,
-    totalX, totalY, outputX, outputY, scale, binning  // codespell:ignore totaly
-  );
-  sensor_t *s = esp_camera_sensor_get();
-  int res = s->set_res_raw(s, startX, startY, endX, endY, offsetX, offsetY, totalX, totalY, outputX, outputY, scale, binning);  // codespell:ignore totaly
-  if (res) {
-    return httpd_resp_send_500(req);
+// Sends a precompressed asset from camera_index.h, or 304 when the browser already has it.
+// Every client gets gzip unless it takes br; all browsers accept gzip.
+static esp_err_t send_asset(httpd_req_t *req, const web_asset_t *asset, const char *cache_control) {
+  const web_asset_data_t *data = &asset->gz;
+  const char *encoding = "gzip";
+#if CONFIG_UI_BROTLI
+  if (accepts_encoding(req, "br")) {
+    data = &asset->br;
+    encoding = "br";
+  }
+#endif
+  httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+  httpd_resp_set_hdr(req, "Cache-Control", cache_control);
+  httpd_resp_set_hdr(req, "ETag", data->etag);
+
+  char match[64];
+  size_t match_len = httpd_req_get_hdr_value_len(req, "If-None-Match");
+  // If-None-Match may carry a list and W/ prefixes, a substring test covers both
+  if (match_len > 0 && match_len < sizeof(match) && httpd_req_get_hdr_value_str(req, "If-None-Match", match, sizeof(match)) == ESP_OK
+      && (strstr(match, data->etag) != NULL || strcmp(match, "*") == 0)) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    return httpd_resp_send(req, NULL, 0);
   }
 
-  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  return httpd_resp_send(req, NULL, 0);
+  httpd_resp_set_type(req, asset->type);
+  httpd_resp_set_hdr(req, "Content-Encoding", encoding);
+  return httpd_resp_send(req, (const char *)data->data, data->len);
+}
+
+// Assets shared by all pages, user_ctx points to the web_asset_t
+static esp_err_t static_asset_handler(httpd_req_t *req) {
+  MemScope mem(MEM_PAGE);
+  const web_asset_t *asset = (const web_asset_t *)req->user_ctx;
+  return send_asset(req, asset, httpd_req_get_url_query_len(req) > 0 ? STATIC_CACHE_CONTROL : INDEX_CACHE_CONTROL);
 }
 
 static esp_err_t index_handler(httpd_req_t *req) {
-  httpd_resp_set_type(req, "text/html");
-  httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+  MemScope mem(MEM_PAGE);
   sensor_t *s = esp_camera_sensor_get();
   if (s != NULL) {
     if (s->id.PID == OV3660_PID) {
-      return httpd_resp_send(req, (const char *)index_ov3660_html_gz, index_ov3660_html_gz_len);
+      return send_asset(req, &index_ov3660_asset, INDEX_CACHE_CONTROL);
     } else if (s->id.PID == OV5640_PID) {
-      return httpd_resp_send(req, (const char *)index_ov5640_html_gz, index_ov5640_html_gz_len);
+      return send_asset(req, &index_ov5640_asset, INDEX_CACHE_CONTROL);
     } else {
-      return httpd_resp_send(req, (const char *)index_ov2640_html_gz, index_ov2640_html_gz_len);
+      return send_asset(req, &index_ov2640_asset, INDEX_CACHE_CONTROL);
     }
   } else {
     log_e("Camera sensor not found");
@@ -1142,7 +4243,13 @@ static esp_err_t index_handler(httpd_req_t *req) {
 
 void startCameraServer() {
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-  config.max_uri_handlers = 16;
+  config.max_uri_handlers = 24;
+#if CONFIG_LOW_MEMORY
+  // handlers on these tasks keep their big buffers static or in the work arena, streams run on
+  // their own workers. /metrics shows the least stack left per endpoint.
+  config.stack_size = 3072;
+  config.max_open_sockets = 4;
+#endif
 
   httpd_uri_t index_uri = {
     .uri = "/",
@@ -1157,6 +4264,44 @@ void startCameraServer() {
 #endif
   };
 
+  httpd_uri_t style_uri = {
+    .uri = "/style.css",
+    .method = HTTP_GET,
+    .handler = static_asset_handler,
+    .user_ctx = (void *)&style_asset
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_uri_t control_js_uri = {
+    .uri = "/control.js",
+    .method = HTTP_GET,
+    .handler = static_asset_handler,
+    .user_ctx = (void *)&control_js_asset
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+  httpd_uri_t ws_uri = {
+    .uri = "/ws",
+    .method = HTTP_GET,
+    .handler = ws_control_handler,
+    .user_ctx = NULL,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+  };
+#endif
+
   httpd_uri_t status_uri = {
     .uri = "/status",
     .method = HTTP_GET,
@@ -1199,7 +4344,7 @@ void startCameraServer() {
   httpd_uri_t stream_uri = {
     .uri = "/stream",
     .method = HTTP_GET,
-    .handler = stream_handler,
+    .handler = stream_async_handler,
     .user_ctx = NULL
 #ifdef CONFIG_HTTPD_WS_SUPPORT
     ,
@@ -1222,6 +4367,32 @@ void startCameraServer() {
 #endif
   };
 
+  httpd_uri_t raw_uri = {
+    .uri = "/raw",
+    .method = HTTP_GET,
+    .handler = raw_handler,
+    .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_uri_t raw_stream_uri = {
+    .uri = "/raw_stream",
+    .method = HTTP_GET,
+    .handler = raw_stream_async_handler,
+    .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
   httpd_uri_t xclk_uri = {
     .uri = "/xclk",
     .method = HTTP_GET,
@@ -1261,6 +4432,97 @@ void startCameraServer() {
 #endif
   };
 
+  httpd_uri_t regs_uri = {
+    .uri = "/regs",
+    .method = HTTP_GET,
+    .handler = regs_handler,
+    .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_uri_t profile_uri = {
+    .uri = "/profile",
+    .method = HTTP_GET,
+    .handler = profile_handler,
+    .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_uri_t camera_uri = {
+    .uri = "/camera",
+    .method = HTTP_GET,
+    .handler = camera_handler,
+    .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_uri_t health_uri = {
+    .uri = "/health",
+    .method = HTTP_GET,
+    .handler = health_handler,
+    .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_uri_t metrics_uri = {
+    .uri = "/metrics",
+    .method = HTTP_GET,
+    .handler = metrics_handler,
+    .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_uri_t timelapse_uri = {
+    .uri = "/timelapse",
+    .method = HTTP_GET,
+    .handler = timelapse_handler,
+    .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_uri_t timelapse_frames_uri = {
+    .uri = "/timelapse/frames",
+    .method = HTTP_GET,
+    .handler = timelapse_frames_handler,
+    .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    ,
+    .is_websocket = true,
+    .handle_ws_control_frames = false,
+    .supported_subprotocol = NULL
+#endif
+  };
+
   httpd_uri_t pll_uri = {
     .uri = "/pll",
     .method = HTTP_GET,
@@ -1288,24 +4550,36 @@ void startCameraServer() {
   };
 
   ra_filter_init(&ra_filter, 20);
+  settings_init();
+  adapt_init();
+  timelapse_init();
+  frame_pool_init();
+  frame_ring_init();
 
-#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-  recognizer.set_partition(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "fr");
-
-  // load ids from flash partition
-  recognizer.set_ids_from_flash();
-#endif
   log_i("Starting web server on port: '%d'", config.server_port);
   if (httpd_start(&camera_httpd, &config) == ESP_OK) {
     httpd_register_uri_handler(camera_httpd, &index_uri);
+    httpd_register_uri_handler(camera_httpd, &style_uri);
+    httpd_register_uri_handler(camera_httpd, &control_js_uri);
     httpd_register_uri_handler(camera_httpd, &cmd_uri);
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+    httpd_register_uri_handler(camera_httpd, &ws_uri);
+#endif
     httpd_register_uri_handler(camera_httpd, &status_uri);
     httpd_register_uri_handler(camera_httpd, &capture_uri);
     httpd_register_uri_handler(camera_httpd, &bmp_uri);
+    httpd_register_uri_handler(camera_httpd, &raw_uri);
 
     httpd_register_uri_handler(camera_httpd, &xclk_uri);
     httpd_register_uri_handler(camera_httpd, &reg_uri);
     httpd_register_uri_handler(camera_httpd, &greg_uri);
+    httpd_register_uri_handler(camera_httpd, &regs_uri);
+    httpd_register_uri_handler(camera_httpd, &profile_uri);
+    httpd_register_uri_handler(camera_httpd, &camera_uri);
+    httpd_register_uri_handler(camera_httpd, &health_uri);
+    httpd_register_uri_handler(camera_httpd, &metrics_uri);
+    httpd_register_uri_handler(camera_httpd, &timelapse_uri);
+    httpd_register_uri_handler(camera_httpd, &timelapse_frames_uri);
     httpd_register_uri_handler(camera_httpd, &pll_uri);
     httpd_register_uri_handler(camera_httpd, &win_uri);
   }
@@ -1313,11 +4587,34 @@ void startCameraServer() {
   config.server_port += 1;
   config.ctrl_port += 1;
   log_i("Starting stream server on port: '%d'", config.server_port);
+  stream_workers_start(&config);
   if (httpd_start(&stream_httpd, &config) == ESP_OK) {
     httpd_register_uri_handler(stream_httpd, &stream_uri);
+    httpd_register_uri_handler(stream_httpd, &raw_stream_uri);
   }
 }
 
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+static void face_ids_load(void *arg) {
+  int64_t start = esp_timer_get_time();
+  recognizer.set_partition(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "fr");
+
+  // load ids from flash partition
+  recognizer.set_ids_from_flash();
+  face_ids_loaded = true;
+  log_i("Face IDs loaded: %d in %ums", recognizer.get_enrolled_id_num(), (uint32_t)((esp_timer_get_time() - start) / 1000));
+  vTaskDelete(NULL);
+}
+#endif
+
+// Reads the enrolled face IDs from the "fr" partition in the background, so it doesn't hold up
+// camera init or the servers. Recognition answers "Loading IDs" until it's done.
+void loadFaceIds() {
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+  xTaskCreate(face_ids_load, "face_ids", 4096, NULL, 5, NULL);
+#endif
+}
+
 void setupLedFlash(int pin) {
 #if CONFIG_LED_ILLUMINATOR_ENABLED
   ledcSetup(LEDC_CHANNEL_0, 5000, 8);
@@ -0,0 +1,328 @@
+"""Load generator and benchmark for the camera web server.
+
+Opens N concurrent /stream clients while other threads hammer /capture and
+/control (over HTTP or the binary /ws socket), then prints one JSON document
+with per-client FPS, frame-interval jitter, time-to-first-frame and request
+round-trip latencies. Works against a device or against camera_sim.py:
+
+    python3 camera_bench.py --url http://192.168.1.123 --streams 2 --duration 20
+    python3 camera_bench.py --url http://127.0.0.1:8080 --stream-url http://127.0.0.1:8081/stream
+    python3 camera_bench.py --url http://127.0.0.1:8080 --streams 0 --control-rate 0 --ws-controls 1 --ws-pipeline 8
+
+Only the Python standard library is used.
+"""
+
+import argparse
+import base64
+import http.client
+import json
+import os
+import socket
+import statistics
+import struct
+import sys
+import threading
+import time
+from urllib.parse import urlparse
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    values = sorted(values)
+    k = (len(values) - 1) * p / 100.0
+    lo = int(k)
+    hi = min(lo + 1, len(values) - 1)
+    return values[lo] + (values[hi] - values[lo]) * (k - lo)
+
+
+def summarize_ms(samples):
+    """Latency summary in milliseconds from a list of seconds."""
+    ms = [s * 1000.0 for s in samples]
+    if not ms:
+        return {"count": 0}
+    return {
+        "count": len(ms),
+        "mean_ms": round(statistics.mean(ms), 2),
+        "p50_ms": round(percentile(ms, 50), 2),
+        "p95_ms": round(percentile(ms, 95), 2),
+        "max_ms": round(max(ms), 2),
+    }
+
+
+def connect(url, timeout):
+    u = urlparse(url)
+    return http.client.HTTPConnection(u.hostname, u.port or 80, timeout=timeout)
+
+
+class StreamClient(threading.Thread):
+    """Reads multipart frames from /stream and records when each one completed."""
+
+    def __init__(self, url, stop, timeout):
+        super().__init__(daemon=True)
+        self.url = url
+        self.stop = stop
+        self.timeout = timeout
+        self.arrivals = []
+        self.sizes = []
+        self.faces = 0
+        self.connected_at = None
+        self.error = None
+
+    def run(self):
+        try:
+            self.read_stream()
+        except Exception as e:  # report, don't kill the run
+            if not self.stop.is_set():
+                self.error = repr(e)
+
+    def read_stream(self):
+        u = urlparse(self.url)
+        self.connected_at = time.monotonic()
+        conn = connect(self.url, self.timeout)
+        conn.request("GET", u.path + ("?" + u.query if u.query else ""))
+        resp = conn.getresponse()
+        if resp.status != 200:
+            raise RuntimeError("HTTP %d" % resp.status)
+        while not self.stop.is_set():
+            headers = {}
+            line = resp.fp.readline()
+            # skip the boundary and blank lines up to the part headers
+            while line and not line.lower().startswith(b"content-type"):
+                line = resp.fp.readline()
+            if not line:
+                raise RuntimeError("stream closed")
+            while line not in (b"\r\n", b"\n", b""):
+                key, _, value = line.decode("latin-1").partition(":")
+                headers[key.strip().lower()] = value.strip()
+                line = resp.fp.readline()
+            length = int(headers["content-length"])
+            data = resp.fp.read(length)
+            if len(data) != length:
+                raise RuntimeError("short frame")
+            self.arrivals.append(time.monotonic())
+            self.sizes.append(length)
+            if headers.get("x-faces"):
+                self.faces += 1
+        conn.close()
+
+    def report(self):
+        r = {"frames": len(self.arrivals)}
+        if self.error:
+            r["error"] = self.error
+        if not self.arrivals:
+            return r
+        r["time_to_first_frame_ms"] = round((self.arrivals[0] - self.connected_at) * 1000.0, 2)
+        intervals = [b - a for a, b in zip(self.arrivals, self.arrivals[1:])]
+        if intervals:
+            span = self.arrivals[-1] - self.arrivals[0]
+            ms = [i * 1000.0 for i in intervals]
+            r["fps"] = round(len(intervals) / span, 2) if span > 0 else None
+            r["interval_mean_ms"] = round(statistics.mean(ms), 2)
+            r["interval_p95_ms"] = round(percentile(ms, 95), 2)
+            r["jitter_ms"] = round(statistics.pstdev(ms), 2)
+            r["kbps"] = round(sum(self.sizes[1:]) * 8 / 1000.0 / span, 1) if span > 0 else None
+        r["mean_frame_bytes"] = int(statistics.mean(self.sizes))
+        r["frames_with_faces"] = self.faces
+        return r
+
+
+class RequestLoop(threading.Thread):
+    """Issues GET requests back to back (or at `rate` per second) and records round-trip times."""
+
+    def __init__(self, base, paths, stop, timeout, rate=0):
+        super().__init__(daemon=True)
+        self.base = base
+        self.paths = paths
+        self.stop = stop
+        self.timeout = timeout
+        self.rate = rate
+        self.latencies = []
+        self.bytes = 0
+        self.errors = 0
+
+    def run(self):
+        conn = None
+        i = 0
+        next_time = time.monotonic()
+        while not self.stop.is_set():
+            path = self.paths[i % len(self.paths)]
+            i += 1
+            start = time.monotonic()
+            try:
+                if conn is None:
+                    conn = connect(self.base, self.timeout)
+                conn.request("GET", path)
+                resp = conn.getresponse()
+                body = resp.read()
+                if resp.status != 200:
+                    self.errors += 1
+                else:
+                    self.latencies.append(time.monotonic() - start)
+                    self.bytes += len(body)
+                if resp.getheader("Connection", "").lower() == "close":
+                    conn.close()
+                    conn = None
+            except (OSError, http.client.HTTPException):
+                self.errors += 1
+                if conn:
+                    conn.close()
+                conn = None
+            if self.rate:
+                next_time += 1.0 / self.rate
+                self.stop.wait(max(0.0, next_time - time.monotonic()))
+
+
+CTRL_MSG = struct.Struct("<BBHi")
+CTRL_OP_SET, CTRL_OP_REPLY = 1, 0x80
+
+
+class WsControlLoop(threading.Thread):
+    """Sends /control settings over the /ws socket, keeping up to `pipeline` commands in flight."""
+
+    def __init__(self, base, var, values, stop, timeout, pipeline=1):
+        super().__init__(daemon=True)
+        self.base = base
+        self.var = var
+        self.values = values
+        self.stop = stop
+        self.timeout = timeout
+        self.pipeline = pipeline
+        self.latencies = []
+        self.errors = 0
+        self.error = None
+
+    def run(self):
+        try:
+            self.loop()
+        except Exception as e:  # report, don't kill the run
+            if not self.stop.is_set():
+                self.error = repr(e)
+
+    def handshake(self):
+        u = urlparse(self.base)
+        sock = socket.create_connection((u.hostname, u.port or 80), timeout=self.timeout)
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        key = base64.b64encode(os.urandom(16)).decode()
+        sock.sendall(("GET /ws HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                      "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n" % (u.netloc, key)).encode())
+        self.rfile = sock.makefile("rb")
+        status = self.rfile.readline()
+        if b" 101 " not in status:
+            raise RuntimeError("no websocket: %s" % status.decode("latin-1").strip())
+        while self.rfile.readline() not in (b"\r\n", b""):
+            pass
+        return sock
+
+    def send(self, sock, opcode, payload):
+        mask = os.urandom(4)
+        head = struct.pack("BB", 0x80 | opcode, 0x80 | len(payload))
+        sock.sendall(head + mask + bytes(b ^ mask[i % 4] for i, b in enumerate(payload)))
+
+    def recv(self):
+        head = self.rfile.read(2)
+        if len(head) < 2:
+            raise RuntimeError("socket closed")
+        length = head[1] & 0x7F
+        if length == 126:
+            length = struct.unpack(">H", self.rfile.read(2))[0]
+        return head[0] & 0x0F, self.rfile.read(length)
+
+    def loop(self):
+        sock = self.handshake()
+        self.send(sock, 0x1, b"params")
+        _, names = self.recv()
+        param = names.decode().split(",").index(self.var)
+        sent = {}
+        seq = 0
+        while not self.stop.is_set():
+            while len(sent) < self.pipeline:
+                seq = (seq + 1) & 0xFFFF
+                sent[seq] = time.monotonic()
+                self.send(sock, 0x2, CTRL_MSG.pack(CTRL_OP_SET, param, seq, self.values[seq % len(self.values)]))
+            opcode, payload = self.recv()
+            now = time.monotonic()
+            for op, _, reply_seq, value in CTRL_MSG.iter_unpack(payload):
+                start = sent.pop(reply_seq, None)
+                if start is None or op != CTRL_OP_SET | CTRL_OP_REPLY or value < 0:
+                    self.errors += 1
+                else:
+                    self.latencies.append(now - start)
+        sock.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--url", default="http://192.168.1.123", help="base URL of the main server")
+    parser.add_argument("--stream-url", help="stream URL, defaults to the main host on port 81")
+    parser.add_argument("--streams", type=int, default=1, help="concurrent /stream clients")
+    parser.add_argument("--captures", type=int, default=0, help="threads requesting /capture back to back")
+    parser.add_argument("--controls", type=int, default=1, help="threads sending /control requests")
+    parser.add_argument("--control-rate", type=float, default=5, help="/control requests per second per thread, 0 for back to back")
+    parser.add_argument("--control-var", default="quality", help="control variable to toggle")
+    parser.add_argument("--control-values", default="10,12", help="comma separated values to cycle through")
+    parser.add_argument("--ws-controls", type=int, default=0, help="threads sending the same settings over the /ws socket, back to back")
+    parser.add_argument("--ws-pipeline", type=int, default=1, help="/ws commands each thread keeps in flight")
+    parser.add_argument("--duration", type=float, default=10, help="seconds to run")
+    parser.add_argument("--timeout", type=float, default=10, help="socket timeout in seconds")
+    parser.add_argument("--out", help="write the JSON report here instead of stdout")
+    args = parser.parse_args()
+
+    base = args.url.rstrip("/")
+    stream_url = args.stream_url or "http://%s:81/stream" % urlparse(base).hostname
+    control_paths = ["/control?var=%s&val=%s" % (args.control_var, v) for v in args.control_values.split(",")]
+
+    stop = threading.Event()
+    streams = [StreamClient(stream_url, stop, args.timeout) for _ in range(args.streams)]
+    captures = [RequestLoop(base, ["/capture"], stop, args.timeout) for _ in range(args.captures)]
+    controls = [RequestLoop(base, control_paths, stop, args.timeout, args.control_rate) for _ in range(args.controls)]
+    ws_values = [int(v) for v in args.control_values.split(",")]
+    ws_controls = [WsControlLoop(base, args.control_var, ws_values, stop, args.timeout, args.ws_pipeline)
+                   for _ in range(args.ws_controls)]
+    workers = streams + captures + controls + ws_controls
+
+    started = time.monotonic()
+    for w in workers:
+        w.start()
+    stop.wait(args.duration)
+    stop.set()
+    elapsed = time.monotonic() - started
+    for w in workers:
+        w.join(timeout=1)
+
+    stream_reports = [s.report() for s in streams]
+    total_fps = sum(r.get("fps") or 0 for r in stream_reports)
+    capture_latencies = [l for c in captures for l in c.latencies]
+    control_latencies = [l for c in controls for l in c.latencies]
+    report = {
+        "url": base,
+        "stream_url": stream_url,
+        "duration_s": round(elapsed, 2),
+        "streams": stream_reports,
+        "stream_total_fps": round(total_fps, 2),
+        "capture": dict(summarize_ms(capture_latencies), errors=sum(c.errors for c in captures),
+                        per_second=round(len(capture_latencies) / elapsed, 2),
+                        bytes=sum(c.bytes for c in captures)),
+        "control": dict(summarize_ms(control_latencies), errors=sum(c.errors for c in controls),
+                        per_second=round(len(control_latencies) / elapsed, 2)),
+    }
+    if ws_controls:
+        ws_latencies = [l for c in ws_controls for l in c.latencies]
+        report["ws_control"] = dict(summarize_ms(ws_latencies), errors=sum(c.errors for c in ws_controls),
+                                    per_second=round(len(ws_latencies) / elapsed, 2), pipeline=args.ws_pipeline)
+        failures = [c.error for c in ws_controls if c.error]
+        if failures:
+            report["ws_control"]["error"] = failures[0]
+
+    text = json.dumps(report, indent=2)
+    if args.out:
+        with open(args.out, "w") as f:
+            f.write(text + "\n")
+    else:
+        print(text)
+    # non-zero exit when a stream client never got a frame, so scripted runs catch it
+    sys.exit(0 if all(r["frames"] for r in stream_reports) else 1)
+
+
+if __name__ == "__main__":
+    main()
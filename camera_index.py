@@ -0,0 +1,99 @@
+"""Generates camera_index.h from the web UI sources in ui/.
+
+ui/style.css and ui/control.js are shared by all sensors and served from /;
+the pages ui/index_<sensor>.html only hold what differs per sensor and refer
+to them as <name>?v=<hash>, so browsers can keep them until they change.
+Every asset is stripped of indentation and stored twice, gzipped and brotli
+compressed, each with its own length and an ETag derived from the compressed
+bytes. The brotli arrays sit behind CONFIG_UI_BROTLI. Run it after editing a page:
+
+    python3 camera_index.py            # rewrite camera_index.h
+    python3 camera_index.py --check    # exit 1 when camera_index.h is out of date
+
+Needs the brotli module (pip install brotli).
+"""
+
+import argparse
+import gzip
+import hashlib
+import os
+import sys
+
+try:
+    import brotli
+except ImportError:
+    sys.exit("camera_index.py needs the brotli module: pip install brotli")
+
+ROOT = os.path.dirname(os.path.abspath(__file__))
+SOURCES = os.path.join(ROOT, "ui")
+HEADER = os.path.join(ROOT, "camera_index.h")
+SHARED = ["style.css", "control.js"]
+PAGES = ["index_ov2640.html", "index_ov3660.html", "index_ov5640.html"]
+BYTES_PER_LINE = 26
+
+
+def content_hash(data):
+    return hashlib.sha256(data).hexdigest()[:16]
+
+
+def minify(text):
+    """Drops indentation and blank lines. The pages have no <pre> or multi-line template
+    strings, and the line breaks are kept, so neither rendering nor JS semicolon insertion change."""
+    return b"\n".join(line.strip() for line in text.split(b"\n") if line.strip()) + b"\n"
+
+
+def c_array(name, data):
+    symbol = name.replace(".", "_")
+    lines = [
+        "//File: %s, Size: %d" % (name, len(data)),
+        "#define %s_len %d" % (symbol, len(data)),
+        '#define %s_etag "\\"%s\\""' % (symbol, content_hash(data)),
+        "const uint8_t %s[] = {" % symbol,
+    ]
+    for i in range(0, len(data), BYTES_PER_LINE):
+        row = ", ".join("0x%02X" % b for b in data[i:i + BYTES_PER_LINE])
+        lines.append("  " + row + ("," if i + BYTES_PER_LINE < len(data) else ""))
+    lines.append("};")
+    return "\n".join(lines)
+
+
+def read(name):
+    with open(os.path.join(SOURCES, name), "rb") as f:
+        return minify(f.read())
+
+
+def generate():
+    assets = [(name, read(name)) for name in SHARED]
+    for page in PAGES:
+        html = read(page)
+        for name, data in assets[:len(SHARED)]:
+            ref = ('="%s"' % name).encode()
+            if ref not in html:
+                sys.exit("%s does not refer to %s" % (page, name))
+            html = html.replace(ref, ('="%s?v=%s"' % (name, content_hash(data))).encode())
+        assets.append((page, html))
+
+    gz = [c_array(name + ".gz", gzip.compress(data, 9, mtime=0)) for name, data in assets]
+    br = [c_array(name + ".br", brotli.compress(data, mode=brotli.MODE_TEXT, quality=11)) for name, data in assets]
+    return "\n\n" + "\n\n".join(gz) + "\n\n#if CONFIG_UI_BROTLI\n\n" + "\n\n".join(br) + "\n\n#endif\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--check", action="store_true", help="only compare against the existing header")
+    parser.add_argument("--out", default=HEADER)
+    args = parser.parse_args()
+
+    text = generate()
+    if args.check:
+        with open(args.out) as f:
+            if f.read() != text:
+                print("%s is out of date, run camera_index.py" % args.out)
+                sys.exit(1)
+        return
+    with open(args.out, "w") as f:
+        f.write(text)
+
+
+if __name__ == "__main__":
+    main()
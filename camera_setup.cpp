@@ -0,0 +1,222 @@
+#include <string.h>
+#include <atomic>
+#include <Preferences.h>
+#include "sdkconfig.h"
+#include "esp_timer.h"
+#include "esp32-hal-psram.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "camera_setup.h"
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
+#include "esp32-hal-log.h"
+#endif
+
+#define SETUP_NAMESPACE "camera"
+#define SETUP_KEY       "setup"
+
+#define REINIT_WAIT_MS 2000  // for frames in use to come back
+#define BENCH_WARMUP   3     // frames dropped after init, the first ones come before AEC settles
+
+static camera_config_t base_config;
+static camera_setup_t active;
+
+static SemaphoreHandle_t reinit_lock = NULL;  // one re-init at a time, held from the wait to the init
+static SemaphoreHandle_t gate = NULL;
+static int fbs_out = 0;  // taken from the driver and not returned yet
+static bool blocked = false;
+static std::atomic<int> failures(0);  // driver grabs in a row that returned no frame, from any task
+static void (*failure_cb)(int failures) = NULL;
+
+static void fbs_out_add(int n) {
+  xSemaphoreTake(gate, portMAX_DELAY);
+  fbs_out += n;
+  xSemaphoreGive(gate);
+}
+
+void camera_setup_defaults(camera_setup_t *c) {
+  c->version = CAMERA_SETUP_VERSION;
+  c->fb_count = psramFound() ? 2 : 1;
+  c->grab_mode = CAMERA_GRAB_WHEN_EMPTY;
+  c->fb_location = psramFound() ? CAMERA_FB_IN_PSRAM : CAMERA_FB_IN_DRAM;
+  c->xclk_mhz = 20;
+}
+
+bool camera_setup_valid(const camera_setup_t *c) {
+  return c->version == CAMERA_SETUP_VERSION && c->fb_count >= 1 && c->fb_count <= 3 && c->grab_mode <= CAMERA_GRAB_LATEST
+         && (c->fb_location == CAMERA_FB_IN_DRAM || (c->fb_location == CAMERA_FB_IN_PSRAM && psramFound())) && c->xclk_mhz >= 5 && c->xclk_mhz <= 24;
+}
+
+bool camera_setup_load(camera_setup_t *c) {
+  camera_setup_t stored;
+  Preferences prefs;
+  if (!prefs.begin(SETUP_NAMESPACE, true)) {
+    return false;
+  }
+  bool ok = prefs.getBytesLength(SETUP_KEY) == sizeof(stored) && prefs.getBytes(SETUP_KEY, &stored, sizeof(stored)) == sizeof(stored) && camera_setup_valid(&stored);
+  prefs.end();
+  if (ok) {
+    *c = stored;
+  }
+  return ok;
+}
+
+bool camera_setup_save(const camera_setup_t *c) {
+  Preferences prefs;
+  if (!camera_setup_valid(c) || !prefs.begin(SETUP_NAMESPACE, false)) {
+    return false;
+  }
+  bool ok = prefs.putBytes(SETUP_KEY, c, sizeof(*c)) == sizeof(*c);
+  prefs.end();
+  return ok;
+}
+
+bool camera_setup_clear() {
+  Preferences prefs;
+  if (!prefs.begin(SETUP_NAMESPACE, false)) {
+    return false;
+  }
+  prefs.remove(SETUP_KEY);
+  prefs.end();
+  return true;
+}
+
+static esp_err_t driver_init(const camera_setup_t *c) {
+  camera_config_t config = base_config;
+  config.fb_count = c->fb_count;
+  config.grab_mode = (camera_grab_mode_t)c->grab_mode;
+  config.fb_location = (camera_fb_location_t)c->fb_location;
+  config.xclk_freq_hz = c->xclk_mhz * 1000000;
+  esp_err_t err = esp_camera_init(&config);
+  if (err == ESP_OK) {
+    active = *c;
+  }
+  return err;
+}
+
+esp_err_t camera_setup_init(const camera_config_t *config, const camera_setup_t *c) {
+  if (!gate) {
+    gate = xSemaphoreCreateMutex();
+    reinit_lock = xSemaphoreCreateMutex();
+  }
+  base_config = *config;
+  return driver_init(c);
+}
+
+void camera_setup_get(camera_setup_t *c) {
+  xSemaphoreTake(reinit_lock, portMAX_DELAY);
+  *c = active;
+  xSemaphoreGive(reinit_lock);
+}
+
+esp_err_t camera_setup_reinit(const camera_setup_t *c) {
+  if (!camera_setup_valid(c)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  xSemaphoreTake(reinit_lock, portMAX_DELAY);
+  xSemaphoreTake(gate, portMAX_DELAY);
+  blocked = true;
+  xSemaphoreGive(gate);
+
+  int64_t deadline = esp_timer_get_time() + REINIT_WAIT_MS * 1000LL;
+  while (fbs_out > 0 && esp_timer_get_time() < deadline) {
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+  }
+  esp_err_t err = ESP_ERR_TIMEOUT;
+  if (fbs_out > 0) {
+    log_e("Camera re-init: %d frames still in use", fbs_out);
+  } else {
+    camera_setup_t previous = active;
+    esp_camera_deinit();
+    err = driver_init(c);
+    if (err != ESP_OK) {
+      log_e("Camera init with fb_count %u, grab_mode %u, fb_location %u, xclk %u failed: 0x%x", c->fb_count, c->grab_mode, c->fb_location, c->xclk_mhz, err);
+      esp_camera_deinit();
+      if (driver_init(&previous) != ESP_OK) {
+        log_e("Camera init with the previous setup failed too");
+      }
+    }
+  }
+
+  xSemaphoreTake(gate, portMAX_DELAY);
+  blocked = false;
+  xSemaphoreGive(gate);
+  xSemaphoreGive(reinit_lock);
+  return err;
+}
+
+void camera_setup_bench(int frames, camera_bench_t *out) {
+  memset(out, 0, sizeof(*out));
+  camera_setup_get(&out->setup);
+  for (int i = 0; i < BENCH_WARMUP; i++) {
+    camera_fb_t *fb = camera_fb_get();
+    if (fb) {
+      camera_fb_return(fb);
+    }
+  }
+
+  int64_t wait = 0;
+  int64_t age = 0;
+  int got = 0;
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < frames; i++) {
+    int64_t t = esp_timer_get_time();
+    camera_fb_t *fb = camera_fb_get();
+    int64_t now = esp_timer_get_time();
+    if (!fb) {
+      continue;
+    }
+    wait += now - t;
+    // the driver stamps frames from esp_timer at VSYNC
+    age += now - ((int64_t)fb->timestamp.tv_sec * 1000000LL + fb->timestamp.tv_usec);
+    got++;
+    camera_fb_return(fb);
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+  if (!got) {
+    return;
+  }
+  out->ok = true;
+  out->fps_x10 = got * 10000000LL / elapsed;
+  out->wait_us = wait / got;
+  out->age_us = age / got;
+}
+
+camera_fb_t *camera_fb_get() {
+  if (!gate) {
+    return esp_camera_fb_get();
+  }
+  xSemaphoreTake(gate, portMAX_DELAY);
+  bool ok = !blocked;
+  if (ok) {
+    fbs_out++;
+  }
+  xSemaphoreGive(gate);
+  if (!ok) {
+    return NULL;
+  }
+  camera_fb_t *fb = esp_camera_fb_get();
+  int n = 0;
+  if (!fb) {
+    fbs_out_add(-1);
+    n = ++failures;
+  } else if (!failures.exchange(0)) {
+    return fb;
+  }
+  if (failure_cb) {
+    failure_cb(n);
+  }
+  return fb;
+}
+
+void camera_fb_return(camera_fb_t *fb) {
+  esp_camera_fb_return(fb);
+  if (gate) {
+    fbs_out_add(-1);
+  }
+}
+
+void camera_setup_on_failure(void (*cb)(int failures)) {
+  failure_cb = cb;
+}
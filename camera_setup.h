@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_camera.h"
+
+#define CAMERA_SETUP_VERSION 1
+
+// Driver settings that can only change through esp_camera_init(), stored in the "camera" NVS
+// namespace. Boards can set their own defaults in camera_pins.h with CAMERA_FB_COUNT,
+// CAMERA_GRAB_MODE, CAMERA_FB_LOCATION and CAMERA_XCLK_MHZ.
+typedef struct {
+  uint8_t version;
+  uint8_t fb_count;     // 1..3
+  uint8_t grab_mode;    // camera_grab_mode_t
+  uint8_t fb_location;  // camera_fb_location_t
+  uint8_t xclk_mhz;
+} camera_setup_t;
+
+// One combination measured by camera_setup_bench()
+typedef struct {
+  camera_setup_t setup;
+  bool ok;           // false when the driver couldn't init with it
+  uint32_t fps_x10;  // delivered frames per second * 10
+  uint32_t wait_us;  // average time spent in esp_camera_fb_get()
+  uint32_t age_us;   // average time from VSYNC to the frame reaching the caller
+} camera_bench_t;
+
+// Driver defaults: two frame buffers in PSRAM when there is PSRAM, one in DRAM otherwise
+void camera_setup_defaults(camera_setup_t *c);
+bool camera_setup_valid(const camera_setup_t *c);
+// Overwrites `c` with the stored setup, if there is a valid one
+bool camera_setup_load(camera_setup_t *c);
+bool camera_setup_save(const camera_setup_t *c);
+bool camera_setup_clear();
+
+// First init from setup(). `config` is kept for later re-inits, with `c` applied on top.
+esp_err_t camera_setup_init(const camera_config_t *config, const camera_setup_t *c);
+// The setup the driver is currently running with
+void camera_setup_get(camera_setup_t *c);
+// Blocks new grabs, waits for the frames in use to come back and restarts the driver with `c`.
+// Falls back to the previous setup when the driver can't init with `c`. Sensor settings are reset.
+// A second caller waits for the running re-init to finish.
+esp_err_t camera_setup_reinit(const camera_setup_t *c);
+// Times `frames` grabs with the running setup, after a short warm-up. Anything else pulling frames
+// at the same time (streams, keep-warm) skews the result.
+void camera_setup_bench(int frames, camera_bench_t *out);
+
+// esp_camera_fb_get()/esp_camera_fb_return() for everything outside setup(), so a re-init knows
+// which frames are still in use. Returns NULL while the driver is restarting.
+camera_fb_t *camera_fb_get();
+void camera_fb_return(camera_fb_t *fb);
+// Called from the grabbing task when a grab fails, with the number of failures in a row, and with 0
+// at the first good frame after them
+void camera_setup_on_failure(void (*cb)(int failures));
@@ -0,0 +1,485 @@
+"""Stand-in for the ESP32 camera web server, for benchmarking without hardware.
+
+Serves the same endpoints as app_httpd.cpp (/, /status, /control, the /ws
+control socket, /regs, /profile, /capture, /bmp and /stream on the second
+port) from a directory of JPEG files that are played back at a fixed frame
+rate, the way esp_camera_fb_get() hands out sensor frames. Only the Python standard library
+is needed; /bmp additionally uses Pillow when it is installed.
+
+The stream port serves as many streams at once as the device has stream workers and answers
+503 to the next client, like the device does. The main port serves requests concurrently, while
+the device has a single task there, so its latencies under parallel load are optimistic.
+
+    python3 camera_sim.py --frames ./frames --fps 20 --port 8080 --stream-port 8081
+"""
+
+import argparse
+import base64
+import hashlib
+import io
+import json
+import logging
+import os
+import re
+import struct
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+PART_BOUNDARY = "123456789000000000000987654321"
+STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" + PART_BOUNDARY
+STREAM_BOUNDARY = "\r\n--" + PART_BOUNDARY + "\r\n"
+MULTIPART_END = "\r\n--" + PART_BOUNDARY + "--\r\n"
+BURST_CONTENT_TYPE = "multipart/mixed;boundary=" + PART_BOUNDARY
+BURST_MAX_FRAMES = 16
+REGS_MAX_COUNT = 64
+WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+CTRL_MSG = struct.Struct("<BBHi")
+CTRL_OP_SET, CTRL_OP_PING, CTRL_OP_REPLY = 1, 2, 0x80
+# Same ids as control_params in app_httpd.cpp
+CONTROL_PARAMS = [
+    "framesize", "quality", "contrast", "brightness", "saturation", "gainceiling", "colorbar", "awb",
+    "agc", "aec", "hmirror", "vflip", "awb_gain", "agc_gain", "aec_value", "aec2",
+    "dcw", "bpc", "wpc", "raw_gma", "lenc", "special_effect", "wb_mode", "ae_level",
+    "keep_warm", "led_intensity", "mcu_overlay", "face_detect", "face_enroll", "face_recognize",
+    "adaptive", "adapt_fps",
+]
+STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %d.%06d\r\n\r\n"
+
+INDEX_HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), "camera_index.h")
+INDEX_CACHE_CONTROL = "public, max-age=86400"
+STATIC_CACHE_CONTROL = "public, max-age=31536000, immutable"
+
+# Defaults as reported by an OV2640 after esp_camera_init() in CameraWebServer.ino
+DEFAULT_STATUS = {
+    "xclk": 20, "pixformat": 4, "framesize": 13, "quality": 10,
+    "brightness": 0, "contrast": 0, "saturation": 0, "sharpness": 0,
+    "special_effect": 0, "wb_mode": 0, "awb": 1, "awb_gain": 1,
+    "aec": 1, "aec2": 0, "ae_level": 0, "aec_value": 168,
+    "agc": 1, "agc_gain": 0, "gainceiling": 0, "bpc": 0, "wpc": 1,
+    "raw_gma": 1, "lenc": 1, "hmirror": 0, "dcw": 1, "colorbar": 0,
+    "keep_warm": 0, "led_intensity": 0, "adaptive": 0, "adapt_fps": 15,
+}
+
+logging.basicConfig(level=logging.INFO, format="%(asctime)s - %(levelname)s - %(message)s")
+
+
+def load_assets(path=INDEX_HEADER):
+    """Returns {symbol: (bytes, etag)} for the arrays in camera_index.h, e.g. "style_css_gz"."""
+    assets = {}
+    with open(path) as f:
+        text = f.read()
+    for m in re.finditer(r'#define (\w+)_etag "(.*?)"\nconst uint8_t \w+\[\] = \{(.*?)\};', text, re.S):
+        data = bytes(int(v, 16) for v in re.findall(r"0x[0-9A-Fa-f]{2}", m.group(3)))
+        assets[m.group(1)] = (data, m.group(2).replace('\\"', '"'))
+    return assets
+
+
+def accepts_encoding(header, coding):
+    for item in header.split(","):
+        name, _, params = item.strip().partition(";")
+        if name.strip() == coding:
+            q = params.strip()
+            return not q.startswith("q=") or float(q[2:] or 0) > 0
+    return False
+
+
+class FrameSource:
+    """Cycles through the frames at `fps`, like the camera driver filling its frame buffers.
+
+    get() blocks until a frame newer than the one the caller saw last is available,
+    which gives every client the same pacing a real sensor would.
+    """
+
+    def __init__(self, frames, fps):
+        self.frames = frames
+        self.period = 1.0 / fps
+        self.cond = threading.Condition()
+        self.seq = 0
+        self.frame = frames[0]
+        self.timestamp = time.time()
+        threading.Thread(target=self._run, daemon=True).start()
+
+    def _run(self):
+        next_time = time.monotonic()
+        while True:
+            next_time += self.period
+            time.sleep(max(0.0, next_time - time.monotonic()))
+            with self.cond:
+                self.seq += 1
+                self.frame = self.frames[self.seq % len(self.frames)]
+                self.timestamp = time.time()
+                self.cond.notify_all()
+
+    def get(self, last_seq=-1):
+        with self.cond:
+            while self.seq == last_seq:
+                self.cond.wait()
+            return self.seq, self.frame, self.timestamp
+
+
+def load_frames(path):
+    names = sorted(n for n in os.listdir(path) if n.lower().endswith((".jpg", ".jpeg")))
+    if not names:
+        raise SystemExit("no .jpg files in %s" % path)
+    frames = []
+    for name in names:
+        with open(os.path.join(path, name), "rb") as f:
+            frames.append(f.read())
+    return frames
+
+
+def timestamp_hdr(ts):
+    return "%d.%06d" % (int(ts), int((ts % 1) * 1000000))
+
+
+class CameraHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "camera_sim"
+
+    def log_message(self, fmt, *args):
+        logging.debug("%s - %s", self.address_string(), fmt % args)
+
+    def send_body(self, body, content_type=None, code=200, headers=None):
+        self.send_response(code)
+        if content_type:
+            self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        self.send_header("Access-Control-Allow-Origin", "*")
+        for key, value in (headers or {}).items():
+            self.send_header(key, value)
+        self.end_headers()
+        self.throttled_write(body)
+
+    def throttled_write(self, data):
+        """Writes data at the configured link rate, to approximate Wi-Fi throughput."""
+        rate = self.server.sim.bandwidth
+        if not rate:
+            self.wfile.write(data)
+            return
+        chunk = 4096
+        for i in range(0, len(data), chunk):
+            start = time.monotonic()
+            self.wfile.write(data[i:i + chunk])
+            delay = len(data[i:i + chunk]) / rate - (time.monotonic() - start)
+            if delay > 0:
+                time.sleep(delay)
+
+    def send_error_code(self, code):
+        self.send_body(b"", code=code)
+
+    def do_GET(self):
+        url = urlparse(self.path)
+        query = {k: v[0] for k, v in parse_qs(url.query, keep_blank_values=True).items()}
+        route = self.routes().get(url.path)
+        if not route:
+            self.send_error_code(404)
+            return
+        try:
+            route(self, query)
+        except (BrokenPipeError, ConnectionResetError):
+            pass
+
+    def routes(self):
+        return {}
+
+
+class MainHandler(CameraHandler):
+    def routes(self):
+        return {
+            "/": MainHandler.index,
+            "/style.css": MainHandler.style,
+            "/status": MainHandler.status,
+            "/control": MainHandler.control,
+            "/control.js": MainHandler.control_js,
+            "/ws": MainHandler.ws,
+            "/regs": MainHandler.regs,
+            "/profile": MainHandler.profile,
+            "/capture": MainHandler.capture,
+            "/bmp": MainHandler.bmp,
+        }
+
+    def index(self, query):
+        self.send_asset("index_%s_html" % self.server.sim.sensor, "text/html", INDEX_CACHE_CONTROL)
+
+    def style(self, query):
+        self.send_asset("style_css", "text/css", STATIC_CACHE_CONTROL if query else INDEX_CACHE_CONTROL)
+
+    def control_js(self, query):
+        self.send_asset("control_js", "text/javascript", STATIC_CACHE_CONTROL if query else INDEX_CACHE_CONTROL)
+
+    def send_asset(self, name, content_type, cache_control):
+        assets = self.server.sim.assets
+        encoding = "gzip"
+        if name + "_br" in assets and accepts_encoding(self.headers.get("Accept-Encoding", ""), "br"):
+            encoding = "br"
+        data, etag = assets[name + "_" + encoding[:2]]
+        headers = {"Vary": "Accept-Encoding", "Cache-Control": cache_control, "ETag": etag}
+        match = self.headers.get("If-None-Match", "")
+        if etag in match or match == "*":
+            self.send_body(b"", code=304, headers=headers)
+            return
+        headers["Content-Encoding"] = encoding
+        self.send_body(data, content_type, headers=headers)
+
+    def status(self, query):
+        sim = self.server.sim
+        with sim.lock:
+            body = json.dumps(sim.status, separators=(",", ":")).encode()
+        self.send_body(body, "application/json")
+
+    def control(self, query):
+        sim = self.server.sim
+        if "var" not in query or "val" not in query:
+            self.send_error_code(404)
+            return
+        try:
+            val = int(query["val"])
+        except ValueError:
+            val = 0
+        logging.info("%s = %d", query["var"], val)
+        if sim.apply_control(query["var"], val) < 0:
+            self.send_error_code(500)
+            return
+        self.send_body(b"")
+
+    def regs(self, query):
+        """Bulk register access, see regs_handler in app_httpd.cpp. Registers start out as 0."""
+        sim = self.server.sim
+        if "reg" not in query:
+            self.send_error_code(404)
+            return
+        reg = int(query["reg"], 0)
+        mask = int(query.get("mask", "0xFF"), 0)
+        with sim.lock:
+            if "val" in query:
+                for i, v in enumerate(v for v in query["val"].split(",") if v):
+                    old = sim.registers.get(reg + i, 0)
+                    sim.registers[reg + i] = (old & ~mask) | (int(v, 0) & mask)
+                self.send_body(b"")
+                return
+            count = int(query.get("count", 1))
+            if not 1 <= count <= REGS_MAX_COUNT:
+                self.send_error_code(500)
+                return
+            values = [sim.registers.get(reg + i, 0) & mask for i in range(count)]
+        self.send_body(json.dumps(values, separators=(",", ":")).encode(), "application/json")
+
+    def profile(self, query):
+        """Named profiles, kept in memory instead of NVS. A switch never costs frames here."""
+        sim = self.server.sim
+        with sim.lock:
+            if not query:
+                body = {"profiles": list(sim.profiles), "boot": sim.boot_profile, "switch_ms": 0, "frames_lost": 0}
+                self.send_body(json.dumps(body, separators=(",", ":")).encode(), "application/json")
+                return
+            if "save" in query:
+                sim.profiles[query["save"]] = dict(sim.status)
+            elif "apply" in query:
+                if query["apply"] not in sim.profiles:
+                    self.send_error_code(500)
+                    return
+                old = dict(sim.status)
+                sim.status.update(sim.profiles[query["apply"]])
+                writes = sum(1 for k in sim.status if sim.status[k] != old[k])
+                body = {"profile": query["apply"], "writes": writes, "switch_ms": 0}
+                self.send_body(json.dumps(body, separators=(",", ":")).encode(), "application/json")
+                return
+            elif "delete" in query:
+                if sim.profiles.pop(query["delete"], None) is None:
+                    self.send_error_code(500)
+                    return
+            elif "boot" in query:
+                sim.boot_profile = query["boot"]
+            else:
+                self.send_error_code(404)
+                return
+        self.send_body(b"")
+
+    def ws(self, query):
+        """Binary control socket, see ws_control_handler in app_httpd.cpp."""
+        key = self.headers.get("Sec-WebSocket-Key")
+        if not key or self.headers.get("Upgrade", "").lower() != "websocket":
+            self.send_error_code(400)
+            return
+        accept = base64.b64encode(hashlib.sha1((key + WS_GUID).encode()).digest()).decode()
+        self.send_response(101)
+        self.send_header("Upgrade", "websocket")
+        self.send_header("Connection", "Upgrade")
+        self.send_header("Sec-WebSocket-Accept", accept)
+        self.end_headers()
+        self.close_connection = True
+        sim = self.server.sim
+        while True:
+            opcode, payload = self.ws_read()
+            if opcode is None or opcode == 0x8:
+                return
+            if opcode == 0x9:
+                self.ws_write(0xA, payload)
+            elif opcode == 0x1 and payload == b"params":
+                self.ws_write(0x1, ",".join(CONTROL_PARAMS).encode())
+            elif opcode == 0x2 and len(payload) % CTRL_MSG.size == 0:
+                out = []
+                for op, param, seq, value in CTRL_MSG.iter_unpack(payload):
+                    if op == CTRL_OP_SET:
+                        value = sim.apply_control(CONTROL_PARAMS[param], value) if param < len(CONTROL_PARAMS) else -1
+                    elif op != CTRL_OP_PING:
+                        value = -1
+                    out.append(CTRL_MSG.pack(op | CTRL_OP_REPLY, param, seq, value))
+                self.ws_write(0x2, b"".join(out))
+
+    def ws_read(self):
+        head = self.rfile.read(2)
+        if len(head) < 2:
+            return None, None
+        opcode, length = head[0] & 0x0F, head[1] & 0x7F
+        if length == 126:
+            length = struct.unpack(">H", self.rfile.read(2))[0]
+        elif length == 127:
+            length = struct.unpack(">Q", self.rfile.read(8))[0]
+        mask = self.rfile.read(4) if head[1] & 0x80 else b"\0\0\0\0"
+        data = self.rfile.read(length)
+        return opcode, bytes(b ^ mask[i % 4] for i, b in enumerate(data))
+
+    def ws_write(self, opcode, payload):
+        if len(payload) < 126:
+            head = struct.pack("BB", 0x80 | opcode, len(payload))
+        else:
+            head = struct.pack(">BBH", 0x80 | opcode, 126, len(payload))
+        self.wfile.write(head + payload)
+
+    def capture(self, query):
+        if int(query.get("burst", 0)) > 0:
+            self.burst(min(int(query["burst"]), BURST_MAX_FRAMES), int(query.get("interval_ms", 0)))
+            return
+        _, frame, ts = self.server.sim.source.get()
+        self.send_body(frame, "image/jpeg", headers={
+            "Content-Disposition": "inline; filename=capture.jpg",
+            "X-Timestamp": timestamp_hdr(ts),
+        })
+
+    def burst(self, count, interval_ms):
+        source = self.server.sim.source
+        self.send_response(200)
+        self.send_header("Content-Type", BURST_CONTENT_TYPE)
+        self.send_header("Access-Control-Allow-Origin", "*")
+        self.send_header("Transfer-Encoding", "chunked")
+        self.end_headers()
+        seq = -1
+        next_time = time.monotonic()
+        for i in range(count):
+            seq, frame, ts = source.get(seq)
+            part = STREAM_BOUNDARY + STREAM_PART % (len(frame), int(ts), int((ts % 1) * 1000000))
+            self.write_chunk(part.encode() + frame)
+            if interval_ms and i + 1 < count:
+                next_time += interval_ms / 1000.0
+                time.sleep(max(0.0, next_time - time.monotonic()))
+        self.write_chunk(MULTIPART_END.encode())
+        self.write_chunk(b"")
+
+    def write_chunk(self, data):
+        self.throttled_write(b"%x\r\n%s\r\n" % (len(data), data))
+
+    def bmp(self, query):
+        try:
+            from PIL import Image
+        except ImportError:
+            self.send_error_code(501)
+            return
+        _, frame, ts = self.server.sim.source.get()
+        out = io.BytesIO()
+        Image.open(io.BytesIO(frame)).convert("RGB").save(out, "BMP")
+        self.send_body(out.getvalue(), "image/x-windows-bmp", headers={
+            "Content-Disposition": "inline; filename=capture.bmp",
+            "X-Timestamp": timestamp_hdr(ts),
+        })
+
+
+class StreamHandler(CameraHandler):
+    def routes(self):
+        return {"/stream": StreamHandler.stream}
+
+    def stream(self, query):
+        workers = self.server.sim.stream_workers
+        if not workers.acquire(blocking=False):
+            logging.info("No stream worker free")
+            self.send_body(b"", code=503, headers={"Retry-After": "1"})
+            return
+        try:
+            self.send_frames()
+        finally:
+            workers.release()
+
+    def send_frames(self):
+        source = self.server.sim.source
+        self.send_response(200)
+        self.send_header("Content-Type", STREAM_CONTENT_TYPE)
+        self.send_header("Access-Control-Allow-Origin", "*")
+        self.send_header("X-Framerate", "60")
+        self.send_header("Connection", "close")
+        self.end_headers()
+        self.close_connection = True
+        seq = -1
+        while True:
+            seq, frame, ts = source.get(seq)
+            part = STREAM_BOUNDARY + STREAM_PART % (len(frame), int(ts), int((ts % 1) * 1000000))
+            self.throttled_write(part.encode() + frame)
+
+
+class Simulator:
+    def __init__(self, args):
+        self.source = FrameSource(load_frames(args.frames), args.fps)
+        self.assets = load_assets()
+        if not args.brotli:
+            self.assets = {k: v for k, v in self.assets.items() if not k.endswith("_br")}
+        self.sensor = args.sensor
+        self.bandwidth = args.bandwidth * 1000 / 8
+        self.stream_workers = threading.BoundedSemaphore(args.stream_workers)
+        self.status = dict(DEFAULT_STATUS)
+        self.registers = {}
+        self.profiles = {}
+        self.boot_profile = ""
+        self.lock = threading.Lock()
+
+    def apply_control(self, var, val):
+        with self.lock:
+            if var not in self.status:
+                logging.info("Unknown command: %s", var)
+                return -1
+            self.status[var] = val
+        return 0
+
+    def serve(self, host, port, stream_port):
+        servers = [ThreadingHTTPServer((host, port), MainHandler), ThreadingHTTPServer((host, stream_port), StreamHandler)]
+        for server in servers:
+            server.daemon_threads = True
+            server.sim = self
+            threading.Thread(target=server.serve_forever, daemon=True).start()
+        logging.info("Camera Ready! Use 'http://%s:%d' to connect, stream on port %d", host, port, stream_port)
+        return servers
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--frames", required=True, help="directory of .jpg frames, played back in name order")
+    parser.add_argument("--fps", type=float, default=20, help="sensor frame rate")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8080, help="port for /, /status, /control, /capture, /bmp")
+    parser.add_argument("--stream-port", type=int, default=8081, help="port for /stream (81 on the device)")
+    parser.add_argument("--sensor", default="ov2640", choices=["ov2640", "ov3660", "ov5640"], help="which UI page to serve")
+    parser.add_argument("--brotli", action="store_true", help="serve br to clients that accept it, like CONFIG_UI_BROTLI")
+    parser.add_argument("--stream-workers", type=int, default=3, help="streams served at once, STREAM_WORKERS on the device (1 without PSRAM)")
+    parser.add_argument("--bandwidth", type=float, default=0, help="per-connection link rate in kbit/s, 0 for unlimited")
+    args = parser.parse_args()
+
+    Simulator(args).serve(args.host, args.port, args.stream_port)
+    try:
+        while True:
+            time.sleep(3600)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,56 @@
+#pragma once
+
+// What the Arduino core puts in front of every sketch source: its own headers and the newlib
+// extensions the sketch relies on.
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#ifdef __cplusplus
+#include <cstdio>  // undefines the printf family, so it has to come before the wrappers below
+#endif
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp32-hal-log.h"
+#include "esp32-hal-ledc.h"
+#include "esp32-hal-psram.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#define INPUT_PULLUP 0x05
+
+char *itoa(int value, char *str, int base);
+
+// app_httpd.cpp makes -Wformat an error, and its formats are right for a 32 bit target. size_t
+// and time_t are wider here, so the sketch's sprintf calls go through wrappers the checker skips.
+int host_snprintf(char *buf, size_t len, const char *fmt, ...);
+int host_sprintf(char *buf, const char *fmt, ...);
+#define snprintf host_snprintf
+#define sprintf  host_sprintf
+
+void delay(uint32_t ms);
+unsigned long millis();
+void pinMode(uint8_t pin, uint8_t mode);
+
+#ifdef __cplusplus
+class IPAddress {
+public:
+  uint32_t addr = 0;
+};
+
+class HardwareSerial {
+public:
+  void begin(unsigned long baud);
+  void setDebugOutput(bool enable);
+  size_t print(const char *str);
+  size_t print(char c);
+  size_t print(int value);
+  size_t print(const IPAddress &ip);
+  size_t println(const char *str = "");
+  size_t printf(const char *fmt, ...);
+};
+
+extern HardwareSerial Serial;
+#endif
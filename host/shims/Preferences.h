@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// NVS stand-in kept in memory for the life of the process
+class Preferences {
+public:
+  bool begin(const char *name, bool readOnly = false, const char *partition_label = NULL);
+  void end();
+  bool remove(const char *key);
+  bool isKey(const char *key);
+  size_t putString(const char *key, const char *value);
+  size_t getString(const char *key, char *value, size_t maxLen);
+  size_t putBytes(const char *key, const void *value, size_t len);
+  size_t getBytesLength(const char *key);
+  size_t getBytes(const char *key, void *buf, size_t maxLen);
+  size_t putUChar(const char *key, uint8_t value);
+  uint8_t getUChar(const char *key, uint8_t defaultValue = 0);
+  size_t putUInt(const char *key, uint32_t value);
+  uint32_t getUInt(const char *key, uint32_t defaultValue = 0);
+
+private:
+  char ns[16] = "";
+  bool read_only = true;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Arduino.h"
+
+typedef enum {
+  WL_IDLE_STATUS,
+  WL_NO_SSID_AVAIL,
+  WL_SCAN_COMPLETED,
+  WL_CONNECTED,
+  WL_CONNECT_FAILED,
+  WL_CONNECTION_LOST,
+  WL_DISCONNECTED
+} wl_status_t;
+
+class WiFiClass {
+public:
+  wl_status_t begin(const char *ssid, const char *passphrase = NULL, int32_t channel = 0, const uint8_t *bssid = NULL, bool connect = true);
+  wl_status_t status();
+  IPAddress localIP();
+  int32_t channel();
+  uint8_t *BSSID();
+  int8_t RSSI();
+  bool disconnect(bool wifioff = false);
+  bool setAutoReconnect(bool autoReconnect);
+  bool setSleep(bool enabled);
+};
+
+extern WiFiClass WiFi;
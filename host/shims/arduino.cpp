@@ -0,0 +1,257 @@
+// The rest of the Arduino core and IDF surface the sketch touches, all inert
+#include <map>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "Preferences.h"
+#include "WiFi.h"
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "fb_gfx.h"
+#include "human_face_detect_msr01.hpp"
+
+void host_log(char level, const char *fmt, ...) {
+  if (!getenv("HOST_LOG")) {
+    return;
+  }
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "[%c] ", level);
+  vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+  va_end(args);
+}
+
+int host_snprintf(char *buf, size_t len, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(buf, len, fmt, args);
+  va_end(args);
+  return n;
+}
+
+int host_sprintf(char *buf, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vsprintf(buf, fmt, args);
+  va_end(args);
+  return n;
+}
+
+char *itoa(int value, char *str, int base) {
+  if (base == 16) {
+    host_sprintf(str, "%x", value);
+  } else {
+    host_sprintf(str, "%d", value);
+  }
+  return str;
+}
+
+void delay(uint32_t ms) {
+  vTaskDelay(ms);
+}
+
+unsigned long millis() {
+  return esp_timer_get_time() / 1000;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+HardwareSerial Serial;
+
+void HardwareSerial::begin(unsigned long baud) {}
+void HardwareSerial::setDebugOutput(bool enable) {}
+
+size_t HardwareSerial::print(const char *str) {
+  return fputs(str, stdout);
+}
+
+size_t HardwareSerial::print(char c) {
+  return fputc(c, stdout);
+}
+
+size_t HardwareSerial::print(int value) {
+  return ::printf("%d", value);
+}
+
+size_t HardwareSerial::print(const IPAddress &ip) {
+  return ::printf("%u.%u.%u.%u", ip.addr & 0xff, (ip.addr >> 8) & 0xff, (ip.addr >> 16) & 0xff, ip.addr >> 24);
+}
+
+size_t HardwareSerial::println(const char *str) {
+  return ::printf("%s\n", str);
+}
+
+size_t HardwareSerial::printf(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vprintf(fmt, args);
+  va_end(args);
+  return n;
+}
+
+WiFiClass WiFi;
+
+static uint8_t wifi_bssid[6] = {0x02, 0, 0, 0, 0, 1};
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *passphrase, int32_t channel, const uint8_t *bssid, bool connect) {
+  return WL_CONNECTED;
+}
+
+wl_status_t WiFiClass::status() {
+  return WL_CONNECTED;
+}
+
+IPAddress WiFiClass::localIP() {
+  IPAddress ip;
+  ip.addr = 0x0100007f;
+  return ip;
+}
+
+int32_t WiFiClass::channel() {
+  return 6;
+}
+
+uint8_t *WiFiClass::BSSID() {
+  return wifi_bssid;
+}
+
+int8_t WiFiClass::RSSI() {
+  return -50;
+}
+
+bool WiFiClass::disconnect(bool wifioff) {
+  return true;
+}
+
+bool WiFiClass::setAutoReconnect(bool autoReconnect) {
+  return true;
+}
+
+bool WiFiClass::setSleep(bool enabled) {
+  return true;
+}
+
+esp_event_base_t WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t IP_EVENT = "IP_EVENT";
+
+esp_err_t esp_event_handler_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg) {
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap) {
+  memset(ap, 0, sizeof(*ap));
+  memcpy(ap->bssid, wifi_bssid, 6);
+  ap->primary = 6;
+  ap->rssi = -50;
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void) {
+  return ESP_OK;
+}
+
+bool ledcWrite(uint8_t pin, uint32_t duty) {
+  return true;
+}
+
+uint32_t ledcSetup(uint8_t channel, uint32_t freq, uint8_t resolution_bits) {
+  return freq;
+}
+
+void ledcAttachPin(uint8_t pin, uint8_t channel) {}
+
+// Namespaced key/value store shared by every Preferences instance
+static std::map<std::string, std::vector<uint8_t>> nvs;
+
+static std::string nvs_key(const char *ns, const char *key) {
+  return std::string(ns) + "/" + key;
+}
+
+bool Preferences::begin(const char *name, bool readOnly, const char *partition_label) {
+  strncpy(ns, name, sizeof(ns) - 1);
+  read_only = readOnly;
+  return true;
+}
+
+void Preferences::end() {
+  ns[0] = 0;
+}
+
+bool Preferences::remove(const char *key) {
+  return !read_only && nvs.erase(nvs_key(ns, key));
+}
+
+bool Preferences::isKey(const char *key) {
+  return nvs.count(nvs_key(ns, key));
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len) {
+  if (read_only) {
+    return 0;
+  }
+  const uint8_t *p = (const uint8_t *)value;
+  nvs[nvs_key(ns, key)].assign(p, p + len);
+  return len;
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+  auto it = nvs.find(nvs_key(ns, key));
+  return it == nvs.end() ? 0 : it->second.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen) {
+  auto it = nvs.find(nvs_key(ns, key));
+  if (it == nvs.end() || it->second.size() > maxLen) {
+    return 0;
+  }
+  memcpy(buf, it->second.data(), it->second.size());
+  return it->second.size();
+}
+
+size_t Preferences::putString(const char *key, const char *value) {
+  return putBytes(key, value, strlen(value) + 1) ? strlen(value) : 0;
+}
+
+size_t Preferences::getString(const char *key, char *value, size_t maxLen) {
+  size_t n = getBytes(key, value, maxLen);
+  return n ? n - 1 : 0;
+}
+
+size_t Preferences::putUChar(const char *key, uint8_t value) {
+  return putBytes(key, &value, 1);
+}
+
+uint8_t Preferences::getUChar(const char *key, uint8_t defaultValue) {
+  uint8_t value;
+  return getBytes(key, &value, 1) == 1 ? value : defaultValue;
+}
+
+size_t Preferences::putUInt(const char *key, uint32_t value) {
+  return putBytes(key, &value, 4);
+}
+
+uint32_t Preferences::getUInt(const char *key, uint32_t defaultValue) {
+  uint32_t value;
+  return getBytes(key, &value, 4) == 4 ? value : defaultValue;
+}
+
+void fb_gfx_fillRect(fb_data_t *fb, int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color) {}
+void fb_gfx_drawFastHLine(fb_data_t *fb, int32_t x, int32_t y, int32_t w, uint32_t color) {}
+void fb_gfx_drawFastVLine(fb_data_t *fb, int32_t x, int32_t y, int32_t h, uint32_t color) {}
+
+uint8_t fb_gfx_putc(fb_data_t *fb, int32_t x, int32_t y, uint32_t color, unsigned char c) {
+  return 8;
+}
+
+uint32_t fb_gfx_print(fb_data_t *fb, int32_t x, int32_t y, uint32_t color, const char *str) {
+  return strlen(str) * 8;
+}
+
+std::list<dl::detect::result_t> host_detect_results;
+int host_detect_calls;
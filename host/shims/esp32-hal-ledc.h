@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+bool ledcWrite(uint8_t pin, uint32_t duty);
+uint32_t ledcSetup(uint8_t channel, uint32_t freq, uint8_t resolution_bits);
+void ledcAttachPin(uint8_t pin, uint8_t channel);
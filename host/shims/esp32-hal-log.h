@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdio.h>
+
+#define ARDUHAL_LOG_LEVEL_NONE  0
+#define ARDUHAL_LOG_LEVEL_ERROR 1
+#define ARDUHAL_LOG_LEVEL_WARN  2
+#define ARDUHAL_LOG_LEVEL_INFO  3
+#ifndef ARDUHAL_LOG_LEVEL
+#define ARDUHAL_LOG_LEVEL ARDUHAL_LOG_LEVEL_INFO
+#endif
+
+// Printed to stderr when HOST_LOG is set in the environment
+void host_log(char level, const char *fmt, ...);
+
+#define log_e(fmt, ...) host_log('E', fmt, ##__VA_ARGS__)
+#define log_w(fmt, ...) host_log('W', fmt, ##__VA_ARGS__)
+#define log_i(fmt, ...) host_log('I', fmt, ##__VA_ARGS__)
+#define log_d(fmt, ...) host_log('D', fmt, ##__VA_ARGS__)
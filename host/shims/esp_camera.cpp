@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "esp_camera.h"
+#include "esp_timer.h"
+#include "host.h"
+
+const resolution_info_t resolution[FRAMESIZE_INVALID] = {
+  {96, 96},    {160, 120},  {176, 144},  {240, 176},  {240, 240},  {320, 240},   {400, 296},   {480, 320},
+  {640, 480},  {800, 600},  {1024, 768}, {1280, 720}, {1280, 1024}, {1600, 1200}, {1920, 1080}, {720, 1280},
+  {864, 1536}, {2048, 1536}, {2560, 1440}, {2560, 1600}, {1080, 1920}, {2560, 1920},
+};
+
+#define FRAME_US 40000  // 25 fps
+
+static struct {
+  bool initialized;
+  bool fail;
+  pixformat_t format = PIXFORMAT_JPEG;
+  size_t width;
+  size_t height;
+  std::vector<uint8_t> buf;
+  int outstanding;
+  int grabs;
+  sensor_t sensor;
+} cam;
+
+void host_camera_set_frame(pixformat_t format, size_t width, size_t height, const uint8_t *buf, size_t len) {
+  cam.format = format;
+  cam.width = width;
+  cam.height = height;
+  cam.buf.assign(buf, buf + len);
+}
+
+void host_camera_fail(bool fail) {
+  cam.fail = fail;
+}
+
+int host_camera_outstanding() {
+  return cam.outstanding;
+}
+
+int host_camera_grabs() {
+  return cam.grabs;
+}
+
+// Setters just record the value, like a sensor that accepts everything
+#define SET_STATUS(name, field, type)                 \
+  static int name(sensor_t *s, type value) {          \
+    s->status.field = value;                          \
+    return 0;                                         \
+  }
+
+SET_STATUS(set_framesize, framesize, framesize_t)
+SET_STATUS(set_contrast, contrast, int)
+SET_STATUS(set_brightness, brightness, int)
+SET_STATUS(set_saturation, saturation, int)
+SET_STATUS(set_sharpness, sharpness, int)
+SET_STATUS(set_denoise, denoise, int)
+SET_STATUS(set_gainceiling, gainceiling, gainceiling_t)
+SET_STATUS(set_quality, quality, int)
+SET_STATUS(set_colorbar, colorbar, int)
+SET_STATUS(set_whitebal, awb, int)
+SET_STATUS(set_gain_ctrl, agc, int)
+SET_STATUS(set_exposure_ctrl, aec, int)
+SET_STATUS(set_hmirror, hmirror, int)
+SET_STATUS(set_vflip, vflip, int)
+SET_STATUS(set_aec2, aec2, int)
+SET_STATUS(set_awb_gain, awb_gain, int)
+SET_STATUS(set_agc_gain, agc_gain, int)
+SET_STATUS(set_aec_value, aec_value, int)
+SET_STATUS(set_special_effect, special_effect, int)
+SET_STATUS(set_wb_mode, wb_mode, int)
+SET_STATUS(set_ae_level, ae_level, int)
+SET_STATUS(set_dcw, dcw, int)
+SET_STATUS(set_bpc, bpc, int)
+SET_STATUS(set_wpc, wpc, int)
+SET_STATUS(set_raw_gma, raw_gma, int)
+SET_STATUS(set_lenc, lenc, int)
+
+static int set_pixformat(sensor_t *s, pixformat_t format) {
+  s->pixformat = format;
+  return 0;
+}
+
+static uint8_t regs[0x10000];
+
+static int get_reg(sensor_t *s, int reg, int mask) {
+  return regs[reg & 0xffff] & mask;
+}
+
+static int set_reg(sensor_t *s, int reg, int mask, int value) {
+  regs[reg & 0xffff] = (regs[reg & 0xffff] & ~mask) | (value & mask);
+  return 0;
+}
+
+static int set_res_raw(sensor_t *s, int sx, int sy, int ex, int ey, int ox, int oy, int tx, int ty, int w, int h, bool scale, bool binning) {
+  s->status.scale = scale;
+  s->status.binning = binning;
+  return 0;
+}
+
+static int set_pll(sensor_t *s, int bypass, int mul, int sys, int root, int pre, int seld5, int pclken, int pclk) {
+  return 0;
+}
+
+static int set_xclk(sensor_t *s, int timer, int xclk) {
+  s->xclk_freq_hz = xclk * 1000000;
+  return 0;
+}
+
+esp_err_t esp_camera_init(const camera_config_t *config) {
+  sensor_t *s = &cam.sensor;
+  memset(s, 0, sizeof(*s));
+  s->id.PID = OV2640_PID;
+  s->pixformat = config->pixel_format;
+  s->xclk_freq_hz = config->xclk_freq_hz;
+  s->status.framesize = config->frame_size;
+  s->status.quality = config->jpeg_quality;
+  s->status.awb = s->status.aec = s->status.agc = 1;
+  s->set_pixformat = set_pixformat;
+  s->set_framesize = set_framesize;
+  s->set_contrast = set_contrast;
+  s->set_brightness = set_brightness;
+  s->set_saturation = set_saturation;
+  s->set_sharpness = set_sharpness;
+  s->set_denoise = set_denoise;
+  s->set_gainceiling = set_gainceiling;
+  s->set_quality = set_quality;
+  s->set_colorbar = set_colorbar;
+  s->set_whitebal = set_whitebal;
+  s->set_gain_ctrl = set_gain_ctrl;
+  s->set_exposure_ctrl = set_exposure_ctrl;
+  s->set_hmirror = set_hmirror;
+  s->set_vflip = set_vflip;
+  s->set_aec2 = set_aec2;
+  s->set_awb_gain = set_awb_gain;
+  s->set_agc_gain = set_agc_gain;
+  s->set_aec_value = set_aec_value;
+  s->set_special_effect = set_special_effect;
+  s->set_wb_mode = set_wb_mode;
+  s->set_ae_level = set_ae_level;
+  s->set_dcw = set_dcw;
+  s->set_bpc = set_bpc;
+  s->set_wpc = set_wpc;
+  s->set_raw_gma = set_raw_gma;
+  s->set_lenc = set_lenc;
+  s->get_reg = get_reg;
+  s->set_reg = set_reg;
+  s->set_res_raw = set_res_raw;
+  s->set_pll = set_pll;
+  s->set_xclk = set_xclk;
+  cam.initialized = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_camera_deinit() {
+  cam.initialized = false;
+  return ESP_OK;
+}
+
+// Every grab waits out one frame period and is stamped at its VSYNC
+camera_fb_t *esp_camera_fb_get() {
+  int64_t vsync = esp_timer_get_time();
+  host_sleep(FRAME_US);
+  if (!cam.initialized || cam.fail || cam.buf.empty()) {
+    return NULL;
+  }
+  camera_fb_t *fb = new camera_fb_t();
+  fb->timestamp.tv_sec = vsync / 1000000;
+  fb->timestamp.tv_usec = vsync % 1000000;
+  fb->buf = (uint8_t *)malloc(cam.buf.size());
+  memcpy(fb->buf, cam.buf.data(), cam.buf.size());
+  fb->len = cam.buf.size();
+  fb->width = cam.width;
+  fb->height = cam.height;
+  fb->format = cam.format;
+  cam.outstanding++;
+  cam.grabs++;
+  return fb;
+}
+
+void esp_camera_fb_return(camera_fb_t *fb) {
+  free(fb->buf);
+  delete fb;
+  cam.outstanding--;
+}
+
+sensor_t *esp_camera_sensor_get() {
+  return cam.initialized ? &cam.sensor : NULL;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef const char *esp_event_base_t;
+extern esp_event_base_t WIFI_EVENT;
+extern esp_event_base_t IP_EVENT;
+
+enum {
+  WIFI_EVENT_STA_CONNECTED = 4,
+  WIFI_EVENT_STA_DISCONNECTED = 5
+};
+enum {
+  IP_EVENT_STA_GOT_IP = 0,
+  IP_EVENT_STA_LOST_IP = 1
+};
+
+typedef void (*esp_event_handler_t)(void *arg, esp_event_base_t base, int32_t id, void *data);
+esp_err_t esp_event_handler_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg);
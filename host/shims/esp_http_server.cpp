@@ -0,0 +1,223 @@
+#include <map>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "esp_http_server.h"
+#include "host.h"
+
+// One server per port, holding its registered handlers
+typedef struct {
+  httpd_config_t config;
+  std::vector<httpd_uri_t> uris;
+} host_server_t;
+
+static std::map<uint16_t, host_server_t> servers;
+static int async_open;
+
+httpd_req_t *host_req_new(const char *uri, const char *query) {
+  httpd_req_t *r = (httpd_req_t *)calloc(1, sizeof(httpd_req_t));
+  host_req_t *h = new host_req_t();
+  h->uri = uri;
+  h->query = query;
+  strncpy((char *)r->uri, uri, sizeof(r->uri) - 1);
+  r->method = HTTP_GET;
+  r->aux = h;
+  return r;
+}
+
+void host_req_free(httpd_req_t *r) {
+  delete host_req(r);
+  free(r);
+}
+
+host_req_t *host_req(httpd_req_t *r) {
+  return (host_req_t *)r->aux;
+}
+
+esp_err_t host_req_call(uint16_t port, httpd_req_t *r) {
+  host_server_t &server = servers[port];
+  for (const httpd_uri_t &u : server.uris) {
+    if (host_req(r)->uri == u.uri) {
+      r->user_ctx = u.user_ctx;
+      r->handle = &server;
+      return u.handler(r);
+    }
+  }
+  return httpd_resp_send_404(r);
+}
+
+int host_async_open() {
+  return async_open;
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config) {
+  host_server_t &server = servers[config->server_port];
+  server.config = *config;
+  server.uris.clear();
+  *handle = &server;
+  return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle) {
+  return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler) {
+  host_server_t *server = (host_server_t *)handle;
+  if (server->uris.size() >= server->config.max_uri_handlers) {
+    return ESP_ERR_HTTPD_HANDLERS_FULL;
+  }
+  server->uris.push_back(*uri_handler);
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type) {
+  host_req(r)->type = type;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value) {
+  host_req(r)->resp_headers[field] = value;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status) {
+  host_req(r)->status = status;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len) {
+  host_req_t *h = host_req(r);
+  if (h->finished) {
+    return ESP_ERR_HTTPD_INVALID_REQ;
+  }
+  if (buf) {
+    h->resp.append(buf, buf_len < 0 ? strlen(buf) : buf_len);
+  }
+  h->finished = true;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len) {
+  host_req_t *h = host_req(r);
+  if (h->finished) {
+    return ESP_ERR_HTTPD_INVALID_REQ;
+  }
+  if (h->fail_after >= 0 && h->chunks >= h->fail_after) {
+    return ESP_FAIL;
+  }
+  if (!buf || !buf_len) {
+    h->finished = true;
+    return ESP_OK;
+  }
+  h->resp.append(buf, buf_len < 0 ? strlen(buf) : buf_len);
+  h->chunks++;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *r, httpd_err_code_t error, const char *msg) {
+  host_req_t *h = host_req(r);
+  if (h->chunks) {
+    // a status line after chunked data corrupts the response on the wire
+    h->corrupt = true;
+    return ESP_ERR_HTTPD_INVALID_REQ;
+  }
+  static const char *status[] = {"500 Internal Server Error", "400 Bad Request", "404 Not Found", "408 Request Timeout"};
+  h->status = status[error];
+  return httpd_resp_send(r, msg, msg ? -1 : 0);
+}
+
+esp_err_t httpd_resp_send_500(httpd_req_t *r) {
+  return httpd_resp_send_err(r, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+}
+
+esp_err_t httpd_resp_send_404(httpd_req_t *r) {
+  return httpd_resp_send_err(r, HTTPD_404_NOT_FOUND, NULL);
+}
+
+esp_err_t httpd_resp_send_408(httpd_req_t *r) {
+  return httpd_resp_send_err(r, HTTPD_408_REQ_TIMEOUT, NULL);
+}
+
+size_t httpd_req_get_url_query_len(httpd_req_t *r) {
+  return host_req(r)->query.size();
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len) {
+  const std::string &q = host_req(r)->query;
+  if (q.empty()) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  strncpy(buf, q.c_str(), buf_len);
+  buf[buf_len - 1] = 0;
+  return q.size() >= buf_len ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size) {
+  size_t key_len = strlen(key);
+  const char *p = qry;
+  while (p && *p) {
+    const char *end = strchr(p, '&');
+    size_t len = end ? (size_t)(end - p) : strlen(p);
+    if (len > key_len && !strncmp(p, key, key_len) && p[key_len] == '=') {
+      size_t n = len - key_len - 1;
+      size_t copy = n < val_size - 1 ? n : val_size - 1;
+      memcpy(val, p + key_len + 1, copy);
+      val[copy] = 0;
+      return n > copy ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+    }
+    p = end ? end + 1 : NULL;
+  }
+  return ESP_ERR_NOT_FOUND;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field) {
+  auto it = host_req(r)->headers.find(field);
+  return it == host_req(r)->headers.end() ? 0 : it->second.size();
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size) {
+  auto it = host_req(r)->headers.find(field);
+  if (it == host_req(r)->headers.end()) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  strncpy(val, it->second.c_str(), val_size);
+  val[val_size - 1] = 0;
+  return it->second.size() >= val_size ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len) {
+  std::string &body = host_req(r)->body;
+  size_t n = body.size() < buf_len ? body.size() : buf_len;
+  memcpy(buf, body.data(), n);
+  body.erase(0, n);
+  return n;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r) {
+  return 3;
+}
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out) {
+  httpd_req_t *copy = (httpd_req_t *)malloc(sizeof(httpd_req_t));
+  memcpy(copy, r, sizeof(*r));
+  copy->aux = r->aux;  // shares the recorded response so the test can read it back
+  *out = copy;
+  async_open++;
+  return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *r) {
+  free(r);
+  async_open--;
+  return ESP_OK;
+}
+
+esp_err_t httpd_ws_recv_frame(httpd_req_t *req, httpd_ws_frame_t *pkt, size_t max_len) {
+  return ESP_FAIL;
+}
+
+esp_err_t httpd_ws_send_frame(httpd_req_t *req, httpd_ws_frame_t *pkt) {
+  return ESP_FAIL;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "face_recognition_tool.hpp"
+
+class FaceRecognition112V1S16 : public HostFaceRecognizer {};
@@ -0,0 +1,326 @@
+// FreeRTOS on one core: every task is a thread, but a single baton decides which of them runs,
+// and it only changes hands when the running task blocks. Tasks run while the test's main()
+// blocks (in vTaskDelay, a semaphore, or host_run()), and the virtual clock jumps to the next
+// timeout whenever nothing can run.
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "host.h"
+
+#define FOREVER INT64_MAX
+#define MAIN_WAIT_MAX_US (60 * 1000000LL)  // main() gives up on a wait nothing will end
+
+typedef struct host_tcb {
+  std::string name;
+  TaskFunction_t fn;
+  void *arg;
+  std::function<bool()> ready;  // what the task waits for, empty when it only sleeps
+  int64_t wake = FOREVER;
+  bool done = false;
+  uint32_t notified = 0;
+} host_tcb_t;
+
+static int64_t clock_us;
+static host_tcb_t main_tcb;
+static std::vector<host_tcb_t *> tcbs;
+static thread_local host_tcb_t *self = &main_tcb;
+
+// never destroyed: threads of deleted tasks stay parked on them through exit()
+static std::mutex &baton_lock = *new std::mutex;
+static std::condition_variable &baton_cv = *new std::condition_variable;
+static host_tcb_t *running = &main_tcb;
+
+void host_time_advance(int64_t us) {
+  clock_us += us;
+}
+
+int64_t esp_timer_get_time(void) {
+  return clock_us;
+}
+
+// Hands the baton to next and waits for it to come back
+static void baton_pass(host_tcb_t *next) {
+  std::unique_lock<std::mutex> lock(baton_lock);
+  host_tcb_t *me = self;
+  running = next;
+  baton_cv.notify_all();
+  baton_cv.wait(lock, [me] {
+    return running == me;
+  });
+}
+
+static bool runnable(host_tcb_t *t) {
+  return !t->done && ((t->ready && t->ready()) || clock_us >= t->wake);
+}
+
+// Runs tasks from main() until done() holds or the clock reaches until
+static bool schedule(int64_t until, const std::function<bool()> &done) {
+  while (true) {
+    if (done && done()) {
+      return true;
+    }
+    bool ran = false;
+    for (size_t i = 0; i < tcbs.size(); i++) {
+      if (runnable(tcbs[i])) {
+        baton_pass(tcbs[i]);
+        ran = true;
+        if (done && done()) {
+          return true;
+        }
+      }
+    }
+      if (ran) {
+      continue;
+    }
+    int64_t next = until;
+    for (host_tcb_t *t : tcbs) {
+      if (!t->done && t->wake < next) {
+        next = t->wake;
+      }
+    }
+    if (next >= until) {
+      if (until != FOREVER && until > clock_us) {
+        clock_us = until;
+      }
+      return done && done();
+    }
+    clock_us = next;
+  }
+}
+
+// Blocks the caller until ready() holds or timeout_us (-1 for ever) passes, returns ready()
+static bool block(int64_t timeout_us, std::function<bool()> ready) {
+  if (ready && ready()) {
+    return true;
+  }
+  if (ready && !timeout_us) {
+    return false;
+  }
+  if (self == &main_tcb) {
+    return schedule(clock_us + (timeout_us < 0 ? MAIN_WAIT_MAX_US : timeout_us), ready) || !ready;
+  }
+  self->ready = ready;
+  self->wake = timeout_us < 0 ? FOREVER : clock_us + timeout_us;
+  baton_pass(&main_tcb);
+  self->ready = nullptr;
+  self->wake = FOREVER;
+  return !ready || ready();
+}
+
+static int64_t ticks_us(TickType_t t) {
+  return t == portMAX_DELAY ? -1 : (int64_t)t * 1000 * portTICK_PERIOD_MS;
+}
+
+void host_run(int64_t us) {
+  schedule(clock_us + us, nullptr);
+}
+
+bool host_run_until(std::function<bool()> done, int64_t max_us) {
+  return schedule(clock_us + max_us, done);
+}
+
+void host_sleep(int64_t us) {
+  block(us, nullptr);
+}
+
+void vTaskDelay(TickType_t t) {
+  block(ticks_us(t), nullptr);
+}
+
+TickType_t xTaskGetTickCount(void) {
+  return clock_us / 1000 / portTICK_PERIOD_MS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *handle) {
+  host_tcb_t *t = new host_tcb_t();
+  t->name = name;
+  t->fn = fn;
+  t->arg = arg;
+  t->wake = clock_us;  // ready to start
+  tcbs.push_back(t);
+  std::thread([t] {
+    self = t;
+    {
+      std::unique_lock<std::mutex> lock(baton_lock);
+      baton_cv.wait(lock, [t] {
+        return running == t;
+      });
+    }
+    t->wake = FOREVER;
+      t->fn(t->arg);
+      vTaskDelete(NULL);
+  }).detach();
+  if (handle) {
+    *handle = t;
+  }
+  return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *handle, BaseType_t core) {
+  return xTaskCreate(fn, name, stack, arg, prio, handle);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  host_tcb_t *t = task ? (host_tcb_t *)task : self;
+  t->done = true;
+  if (t == self && t != &main_tcb) {
+    // the thread parks for good, like a deleted task's stack
+    std::unique_lock<std::mutex> lock(baton_lock);
+    running = &main_tcb;
+    baton_cv.notify_all();
+    baton_cv.wait(lock, [] {
+      return false;
+    });
+  }
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+  return self;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+  return 1024;
+}
+
+int host_tasks_running(const char *name) {
+  int n = 0;
+  for (host_tcb_t *t : tcbs) {
+    n += !t->done && t->name == name;
+  }
+  return n;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  ((host_tcb_t *)task)->notified++;
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t t) {
+  host_tcb_t *me = self;
+  block(ticks_us(t), [me] {
+    return me->notified > 0;
+  });
+  uint32_t n = me->notified;
+  me->notified = clear ? 0 : (n ? n - 1 : 0);
+  return n;
+}
+
+struct host_semaphore {
+  UBaseType_t count;
+  UBaseType_t max;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+  return new host_semaphore{1, 1};
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+  return new host_semaphore{0, 1};
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+  return new host_semaphore{initial, max};
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t t) {
+  if (!block(ticks_us(t), [sem] {
+        return sem->count > 0;
+      })) {
+    return pdFALSE;
+  }
+  sem->count--;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  if (sem->count == sem->max) {
+    return pdFALSE;
+  }
+  sem->count++;
+  return pdTRUE;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t sem) {
+  return sem->count;
+}
+
+struct host_queue {
+  UBaseType_t length;
+  UBaseType_t item_size;
+  std::deque<std::vector<uint8_t>> items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  return new host_queue{length, item_size, {}};
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t t) {
+  if (!block(ticks_us(t), [q] {
+        return q->items.size() < q->length;
+      })) {
+    return pdFALSE;
+  }
+  const uint8_t *p = (const uint8_t *)item;
+  q->items.emplace_back(p, p + q->item_size);
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t t) {
+  if (!block(ticks_us(t), [q] {
+        return !q->items.empty();
+      })) {
+    return pdFALSE;
+  }
+  memcpy(item, q->items.front().data(), q->item_size);
+  q->items.pop_front();
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+  return q->items.size();
+}
+
+struct host_event_group {
+  EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void) {
+  return new host_event_group{0};
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t g, EventBits_t bits) {
+  return g->bits |= bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t g, EventBits_t bits) {
+  EventBits_t old = g->bits;
+  g->bits &= ~bits;
+  return old;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t g, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t t) {
+  auto met = [g, bits, all] {
+    return all ? (g->bits & bits) == bits : (g->bits & bits) != 0;
+  };
+  block(ticks_us(t), met);
+  EventBits_t old = g->bits;
+  if (met() && clear) {
+    g->bits &= ~bits;
+  }
+  return old;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t g) {
+  return g->bits;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// One core, tasks switch only when they block; see freertos.cpp
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef void *StackType_t;
+
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY      0xffffffff
+#define pdTRUE             1
+#define pdFALSE            0
+#define pdPASS             1
+#define pdFAIL             0
+#define pdMS_TO_TICKS(x)   (x)
+#define tskNO_AFFINITY     0x7fffffff
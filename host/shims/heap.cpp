@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include "esp_heap_caps.h"
+#include "esp32-hal-psram.h"
+#include "host.h"
+
+#ifdef BOARD_HAS_PSRAM
+#define PSRAM_SIZE (4 * 1024 * 1024)
+#else
+#define PSRAM_SIZE 0
+#endif
+
+static size_t heap_free[2] = {200 * 1024, PSRAM_SIZE};
+static size_t heap_largest[2] = {110 * 1024, PSRAM_SIZE};
+static uint32_t heap_fail_caps;
+static esp_alloc_failed_hook_t failed_hook;
+
+static int heap_index(uint32_t caps) {
+  return (caps & MALLOC_CAP_SPIRAM) ? 1 : 0;
+}
+
+void host_heap_set(uint32_t caps, size_t free_size, size_t largest) {
+  heap_free[heap_index(caps)] = free_size;
+  heap_largest[heap_index(caps)] = largest;
+}
+
+void host_heap_fail(uint32_t caps) {
+  heap_fail_caps = caps;
+}
+
+bool psramFound() {
+#ifdef BOARD_HAS_PSRAM
+  return true;
+#else
+  return false;
+#endif
+}
+
+static void *heap_failed(size_t size, uint32_t caps, const char *function_name) {
+  if (failed_hook) {
+    failed_hook(size, caps, function_name);
+  }
+  return NULL;
+}
+
+static bool heap_fails(uint32_t caps) {
+  return (heap_fail_caps && (caps & heap_fail_caps)) || ((caps & MALLOC_CAP_SPIRAM) && !PSRAM_SIZE);
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+  if (heap_fails(caps)) {
+    return heap_failed(size, caps, __func__);
+  }
+  return malloc(size);
+}
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps) {
+  if (heap_fails(caps)) {
+    return heap_failed(size, caps, __func__);
+  }
+  return realloc(ptr, size);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+  return heap_free[heap_index(caps)];
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+  return heap_largest[heap_index(caps)];
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+  return heap_free[heap_index(caps)];
+}
+
+size_t heap_caps_get_total_size(uint32_t caps) {
+  return heap_index(caps) ? PSRAM_SIZE : 320 * 1024;
+}
+
+esp_err_t heap_caps_register_failed_alloc_callback(esp_alloc_failed_hook_t callback) {
+  failed_hook = callback;
+  return ESP_OK;
+}
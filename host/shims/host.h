@@ -0,0 +1,58 @@
+#pragma once
+
+// Test-side controls for the stand-ins in this directory. Nothing in the sketch includes this.
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "esp_camera.h"
+#include "esp_http_server.h"
+#include "freertos/task.h"
+
+// What esp_http_server would have read off the socket and what the handler wrote back
+typedef struct {
+  std::string uri;
+  std::string query;
+  std::map<std::string, std::string> headers;
+  std::string body;  // request body, drained by httpd_req_recv
+
+  std::string status = "200 OK";
+  std::string type;
+  std::map<std::string, std::string> resp_headers;
+  std::string resp;
+  int chunks = 0;
+  int fail_after = -1;  // chunks accepted before sends start failing, so stream loops end
+  bool finished = false;
+  bool corrupt = false;  // an error status was sent after chunked data had gone out
+  bool async = false;  // copy made by httpd_req_async_handler_begin
+} host_req_t;
+
+httpd_req_t *host_req_new(const char *uri, const char *query = "");
+void host_req_free(httpd_req_t *r);
+host_req_t *host_req(httpd_req_t *r);
+esp_err_t host_req_call(uint16_t port, httpd_req_t *r);  // runs the handler registered for r's uri
+int host_async_open();  // async copies not yet completed
+
+// Camera: every grab hands out a copy of the configured frame
+void host_camera_set_frame(pixformat_t format, size_t width, size_t height, const uint8_t *buf, size_t len);
+void host_camera_fail(bool fail);
+int host_camera_outstanding();
+int host_camera_grabs();
+
+// Virtual clock: esp_timer_get_time() and the tick count only move when a task delays or a
+// frame is grabbed
+void host_time_advance(int64_t us);
+
+// Tasks only run while main() blocks. These block it on purpose: for us of virtual time, until
+// done() holds (giving up after max_us), or as a delay in the current task.
+void host_run(int64_t us);
+bool host_run_until(std::function<bool()> done, int64_t max_us = 60 * 1000000LL);
+void host_sleep(int64_t us);
+int host_tasks_running(const char *name);
+
+// Heap: sizes reported per capability, and allocations with matching caps fail
+void host_heap_set(uint32_t caps, size_t free_size, size_t largest);
+void host_heap_fail(uint32_t caps);
+
+// libjpeg encode of a flat grey-gradient test image
+std::vector<uint8_t> host_test_jpeg(int width, int height, int quality = 80);
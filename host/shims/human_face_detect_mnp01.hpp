@@ -0,0 +1,13 @@
+#pragma once
+
+#include "human_face_detect_msr01.hpp"
+
+class HumanFaceDetectMNP01 {
+public:
+  HumanFaceDetectMNP01(float score_threshold, float nms_threshold, int top_k) {}
+
+  template<typename T> std::list<dl::detect::result_t> &infer(T *input_element, std::vector<int> input_shape, std::list<dl::detect::result_t> &candidates) {
+    host_detect_calls++;
+    return host_detect_results;
+  }
+};
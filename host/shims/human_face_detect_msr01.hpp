@@ -0,0 +1,30 @@
+#pragma once
+
+#include <list>
+#include <vector>
+
+namespace dl {
+namespace detect {
+typedef struct {
+  int category;
+  float score;
+  std::vector<int> box;
+  std::vector<int> keypoint;
+} result_t;
+}  // namespace detect
+}  // namespace dl
+
+// What every detector stage returns, set by the test before running a frame
+extern std::list<dl::detect::result_t> host_detect_results;
+extern int host_detect_calls;
+
+class HumanFaceDetectMSR01 {
+public:
+  HumanFaceDetectMSR01(float score_threshold, float nms_threshold, int top_k, float resize_scale) {}
+
+  // esp-dl takes the shape by value, so every call builds a vector
+  template<typename T> std::list<dl::detect::result_t> &infer(T *input_element, std::vector<int> input_shape) {
+    host_detect_calls++;
+    return host_detect_results;
+  }
+};
@@ -0,0 +1,268 @@
+// img_converters / esp_jpg_decode backed by libjpeg, keeping the esp32-camera output layouts:
+// RGB888 comes out as BGR, RGB565 is big-endian, and the JPEG writer callback sees the same
+// start / strip / end calls as the TJpgDec based decoder.
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <jpeglib.h>
+#include "esp_jpg_decode.h"
+#include "host.h"
+
+namespace {
+
+struct jpeg_error {
+  struct jpeg_error_mgr mgr;
+  jmp_buf jump;
+};
+
+void jpeg_error_exit(j_common_ptr cinfo) {
+  longjmp(((jpeg_error *)cinfo->err)->jump, 1);
+}
+
+void jpeg_silent(j_common_ptr cinfo) {}
+
+// Decodes src into 8 bit RGB rows, calling row(y, rgb) for each
+template<typename F> bool decode(const uint8_t *src, size_t len, int scale_denom, int *width, int *height, F row) {
+  struct jpeg_decompress_struct cinfo;
+  jpeg_error jerr;
+  cinfo.err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = jpeg_error_exit;
+  jerr.mgr.output_message = jpeg_silent;
+  if (setjmp(jerr.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, src, len);
+  jpeg_read_header(&cinfo, TRUE);
+  cinfo.out_color_space = JCS_RGB;
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = scale_denom;
+  jpeg_start_decompress(&cinfo);
+  *width = cinfo.output_width;
+  *height = cinfo.output_height;
+  std::vector<uint8_t> line(cinfo.output_width * 3);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW p = line.data();
+    int y = cinfo.output_scanline;
+    jpeg_read_scanlines(&cinfo, &p, 1);
+    if (!row(y, line.data())) {
+      jpeg_destroy_decompress(&cinfo);
+      return false;
+    }
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return true;
+}
+
+// Any camera format to 8 bit RGB
+bool to_rgb(const uint8_t *src, size_t len, uint16_t width, uint16_t height, pixformat_t format, std::vector<uint8_t> &rgb) {
+  size_t n = (size_t)width * height;
+  rgb.resize(n * 3);
+  for (size_t i = 0; i < n; i++) {
+    uint8_t *o = &rgb[i * 3];
+    switch (format) {
+      case PIXFORMAT_RGB565: {
+        if (len < n * 2) return false;
+        uint16_t c = (src[i * 2] << 8) | src[i * 2 + 1];
+        o[0] = (c >> 8) & 0xF8;
+        o[1] = (c >> 3) & 0xFC;
+        o[2] = (c << 3) & 0xF8;
+        break;
+      }
+      case PIXFORMAT_GRAYSCALE:
+        if (len < n) return false;
+        o[0] = o[1] = o[2] = src[i];
+        break;
+      case PIXFORMAT_RGB888:  // BGR in memory, as the converters produce it
+        if (len < n * 3) return false;
+        o[0] = src[i * 3 + 2];
+        o[1] = src[i * 3 + 1];
+        o[2] = src[i * 3];
+        break;
+      case PIXFORMAT_YUV422:
+        if (len < n * 2) return false;
+        o[0] = o[1] = o[2] = src[i * 2];
+        break;
+      default: return false;
+    }
+  }
+  return true;
+}
+
+bool encode(const std::vector<uint8_t> &rgb, uint16_t width, uint16_t height, uint8_t quality, uint8_t **out, size_t *out_len) {
+  struct jpeg_compress_struct cinfo;
+  jpeg_error jerr;
+  unsigned char *mem = NULL;
+  unsigned long mem_len = 0;
+  cinfo.err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = jpeg_error_exit;
+  jerr.mgr.output_message = jpeg_silent;
+  if (setjmp(jerr.jump)) {
+    jpeg_destroy_compress(&cinfo);
+    free(mem);
+    return false;
+  }
+  jpeg_create_compress(&cinfo);
+  jpeg_mem_dest(&cinfo, &mem, &mem_len);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality > 100 ? 100 : quality, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW p = (JSAMPROW)&rgb[cinfo.next_scanline * width * 3];
+    jpeg_write_scanlines(&cinfo, &p, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  *out = mem;
+  *out_len = mem_len;
+  return true;
+}
+
+}  // namespace
+
+bool fmt2rgb888(const uint8_t *src_buf, size_t src_len, pixformat_t format, uint8_t *rgb_buf) {
+  if (format != PIXFORMAT_JPEG) {
+    // the sketch converts row strips, so the width is not known here; the layouts are per pixel anyway
+    size_t bpp = format == PIXFORMAT_GRAYSCALE ? 1 : format == PIXFORMAT_RGB888 ? 3 : 2;
+    std::vector<uint8_t> rgb;
+    if (!to_rgb(src_buf, src_len, src_len / bpp, 1, format, rgb)) {
+      return false;
+    }
+    for (size_t i = 0; i < rgb.size(); i += 3) {
+      rgb_buf[i] = rgb[i + 2];
+      rgb_buf[i + 1] = rgb[i + 1];
+      rgb_buf[i + 2] = rgb[i];
+    }
+    return true;
+  }
+  int w, h;
+  return decode(src_buf, src_len, 1, &w, &h, [&](int y, const uint8_t *line) {
+    uint8_t *o = rgb_buf + (size_t)y * w * 3;
+    for (int x = 0; x < w; x++) {
+      o[x * 3] = line[x * 3 + 2];
+      o[x * 3 + 1] = line[x * 3 + 1];
+      o[x * 3 + 2] = line[x * 3];
+    }
+    return true;
+  });
+}
+
+bool jpg2rgb565(const uint8_t *src, size_t src_len, uint8_t *out, jpg_scale_t scale) {
+  int w, h;
+  return decode(src, src_len, 1 << scale, &w, &h, [&](int y, const uint8_t *line) {
+    uint8_t *o = out + (size_t)y * w * 2;
+    for (int x = 0; x < w; x++) {
+      const uint8_t *p = &line[x * 3];
+      uint16_t c = ((p[0] & 0xF8) << 8) | ((p[1] & 0xFC) << 3) | (p[2] >> 3);
+      o[x * 2] = c >> 8;
+      o[x * 2 + 1] = c;
+    }
+    return true;
+  });
+}
+
+esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void *arg) {
+  std::vector<uint8_t> src(len);
+  if (reader(arg, 0, src.data(), len) != len) {
+    return ESP_FAIL;
+  }
+  int w = 0, h = 0;
+  bool started = false;
+  const int strip = 16;
+  std::vector<uint8_t> rows;
+  int strip_y = 0;
+  bool ok = decode(src.data(), len, 1 << scale, &w, &h, [&](int y, const uint8_t *line) {
+    if (!started) {
+      started = true;
+      if (!writer(arg, 0, 0, w, h, NULL)) {
+        return false;
+      }
+      rows.reserve(strip * w * 3);
+    }
+    // TJpgDec hands out BGR
+    for (int x = 0; x < w; x++) {
+      rows.push_back(line[x * 3 + 2]);
+      rows.push_back(line[x * 3 + 1]);
+      rows.push_back(line[x * 3]);
+    }
+    int n = rows.size() / (w * 3);
+    if (n == strip || y == h - 1) {
+      bool s = writer(arg, 0, strip_y, w, n, rows.data());
+      strip_y += n;
+      rows.clear();
+      return s;
+    }
+    return true;
+  });
+  if (!ok) {
+    return ESP_FAIL;
+  }
+  writer(arg, w, h, 0, 0, NULL);
+  return ESP_OK;
+}
+
+bool fmt2jpg(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, uint8_t **out, size_t *out_len) {
+  std::vector<uint8_t> rgb;
+  if (!to_rgb(src, src_len, width, height, format, rgb)) {
+    return false;
+  }
+  return encode(rgb, width, height, quality, out, out_len);
+}
+
+bool frame2jpg(camera_fb_t *fb, uint8_t quality, uint8_t **out, size_t *out_len) {
+  return fmt2jpg(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, out, out_len);
+}
+
+bool fmt2jpg_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpg_out_cb cb, void *arg) {
+  uint8_t *jpg;
+  size_t jpg_len;
+  if (!fmt2jpg(src, src_len, width, height, format, quality, &jpg, &jpg_len)) {
+    return false;
+  }
+  // the encoder's output buffer is 1 KiB on the device
+  bool ok = true;
+  for (size_t i = 0; ok && i < jpg_len; i += 1024) {
+    size_t n = jpg_len - i < 1024 ? jpg_len - i : 1024;
+    ok = cb(arg, i, jpg + i, n) == n;
+  }
+  free(jpg);
+  return ok;
+}
+
+bool frame2jpg_cb(camera_fb_t *fb, uint8_t quality, jpg_out_cb cb, void *arg) {
+  return fmt2jpg_cb(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, cb, arg);
+}
+
+bool fmt2bmp(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t **out, size_t *out_len) {
+  return false;
+}
+
+bool frame2bmp(camera_fb_t *fb, uint8_t **out, size_t *out_len) {
+  return false;
+}
+
+std::vector<uint8_t> host_test_jpeg(int width, int height, int quality) {
+  std::vector<uint8_t> rgb(width * height * 3);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      uint8_t *p = &rgb[(y * width + x) * 3];
+      p[0] = x * 255 / width;
+      p[1] = y * 255 / height;
+      p[2] = 128;
+    }
+  }
+  uint8_t *jpg;
+  size_t len;
+  encode(rgb, width, height, quality, &jpg, &len);
+  std::vector<uint8_t> out(jpg, jpg + len);
+  free(jpg);
+  return out;
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+#define CONFIG_ARDUHAL_ESP_LOG 1
@@ -0,0 +1,173 @@
+// Counts heap allocations per detected frame. Face results live in fixed storage, so a frame with
+// eight faces must cost exactly what a frame with one does, and the only allocations left are the
+// ones esp-dl's signatures force on the caller: infer() takes the input shape as a vector by value
+// and Tensor::set_shape() copies one.
+#include <new>
+#include "../../app_httpd.cpp"
+#include "check.h"
+
+static long allocs;
+static bool counting;
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  allocs += counting;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+  allocs += counting;
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  allocs += counting;
+  return __real_realloc(ptr, size);
+}
+}
+
+void *operator new(size_t size) {
+  allocs += counting;
+  void *p = __real_malloc(size);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  free(p);
+}
+
+void operator delete(void *p, size_t size) noexcept {
+  free(p);
+}
+
+void operator delete[](void *p, size_t size) noexcept {
+  free(p);
+}
+
+// Takes the frame and drops it, so only the detector side is counted
+class NullEncoder {
+public:
+  static const bool accepts_jpeg = true;
+
+  esp_err_t frame(frame_out_t *out) {
+    frame_return_fb(out);
+    return ESP_OK;
+  }
+
+  esp_err_t pixels(frame_out_t *out, const uint8_t *buf, size_t len, int w, int h, pixformat_t format, uint8_t quality) {
+    frame_return_fb(out);
+    return ESP_OK;
+  }
+
+  esp_err_t encoded(frame_out_t *out, uint8_t *buf, size_t len) {
+    free(buf);
+    return ESP_OK;
+  }
+};
+
+static void set_faces(size_t n) {
+  host_detect_results.clear();
+  for (size_t i = 0; i < n; i++) {
+    dl::detect::result_t face;
+    face.category = 0;
+    face.score = 0.9f;
+    face.box = {(int)i * 30, 20, (int)i * 30 + 25, 60};
+    face.keypoint = {5, 30, 10, 50, 15, 40, 20, 30, 25, 50};
+    host_detect_results.push_back(face);
+  }
+}
+
+// Allocations for one frame through the detector, after a warm-up frame has filled the pools
+static long frame_allocs(FaceDetector &det, size_t faces) {
+  set_faces(faces);
+  long n = 0;
+  for (int i = 0; i < 2; i++) {
+    frame_out_t out;
+    frame_out_init(&out, esp_camera_fb_get());
+    NullEncoder enc;
+    allocs = 0;
+    counting = true;
+    CHECK(frame_process(det, enc, &out) == ESP_OK);
+    counting = false;
+    n = allocs;
+    CHECK(out.faces && out.faces->count == faces);
+    frame_out_release(&out);
+  }
+  return n;
+}
+
+int main() {
+  camera_config_t config = {};
+  config.pixel_format = PIXFORMAT_RGB565;
+  config.frame_size = FRAMESIZE_QVGA;
+  esp_camera_init(&config);
+  settings_init();
+  frame_pool_init();
+  face_ids_loaded = true;
+
+  settings_t *next = settings_edit();
+  next->detection_enabled = 1;
+  settings_publish(next);
+
+  // RGB565 frames are detected and drawn on in place
+  std::vector<uint8_t> rgb(320 * 240 * 2);
+  host_camera_set_frame(PIXFORMAT_RGB565, 320, 240, rgb.data(), rgb.size());
+  FaceDetector det;
+  long one = frame_allocs(det, 1);
+  long most = frame_allocs(det, FACE_RESULTS_MAX);
+  fprintf(stderr, "rgb565: %ld allocations with 1 face, %ld with %d\n", one, most, FACE_RESULTS_MAX);
+  CHECK(one == most);
+  CHECK(one == (TWO_STAGE ? 2 : 1));
+
+  // the X-Faces header and the stream part headers are printed into fixed buffers
+  face_results_t faces;
+  set_faces(FACE_RESULTS_MAX);
+  char hdr[FACE_RESULTS_MAX * 32];
+  allocs = 0;
+  counting = true;
+  face_results_set(&faces, host_detect_results, 2);
+  face_results_print(&faces, hdr, sizeof(hdr));
+  counting = false;
+  CHECK(allocs == 0);
+
+  // recognition copies the landmarks into a vector sized once up front
+  next = settings_edit();
+  next->recognition_enabled = 1;
+  settings_publish(next);
+  std::vector<uint8_t> jpg = host_test_jpeg(320, 240);
+  host_camera_set_frame(PIXFORMAT_JPEG, 320, 240, jpg.data(), jpg.size());
+  one = frame_allocs(det, 1);
+  most = frame_allocs(det, FACE_RESULTS_MAX);
+  fprintf(stderr, "recognition: %ld allocations with 1 face, %ld with %d\n", one, most, FACE_RESULTS_MAX);
+  CHECK(one == most);
+
+  std::vector<int> landmarks(FACE_KEYPOINTS);
+  std::vector<uint8_t> bgr(320 * 240 * 3);
+  fb_data_t rfb;
+  rfb.width = 320;
+  rfb.height = 240;
+  rfb.data = bgr.data();
+  rfb.bytes_per_pixel = 3;
+  rfb.format = FB_BGR888;
+  allocs = 0;
+  counting = true;
+  run_face_recognition(&rfb, &faces, landmarks, false);
+  counting = false;
+  CHECK(allocs == 2);  // set_shape({h, w, 3}): the initializer list's vector and the tensor's copy
+  return 0;
+}
@@ -0,0 +1,165 @@
+// Boots the sketch as the Arduino core would and drives the real handlers on both ports
+#include <vector>
+#include "check.h"
+#include "esp_timer.h"
+
+void setup();
+
+// multipart frames sent so far
+static int parts(httpd_req_t *r) {
+  int n = 0;
+  for (size_t at = 0; (at = host_req(r)->resp.find("X-Timestamp", at)) != std::string::npos; at++) {
+    n++;
+  }
+  return n;
+}
+
+int main() {
+  std::vector<uint8_t> jpg = host_test_jpeg(800, 600);
+  host_camera_set_frame(PIXFORMAT_JPEG, 800, 600, jpg.data(), jpg.size());
+  setup();
+
+  httpd_req_t *r = get(80, "/status");
+  CHECK(host_req(r)->status == "200 OK");
+  CHECK(starts_with(host_req(r)->resp, "{"));
+  host_req_free(r);
+
+  r = get(80, "/capture");
+  CHECK(host_req(r)->type == "image/jpeg");
+  CHECK(starts_with(host_req(r)->resp, "\xff\xd8"));
+  host_req_free(r);
+
+  r = get(80, "/bmp");
+  CHECK(host_req(r)->type == "image/x-windows-bmp");
+  CHECK(host_req(r)->resp.size() == 54 + 800 * 600 * 3);
+  host_req_free(r);
+
+  // a client that goes away mid-BMP gets no status line after the data
+  r = get(80, "/bmp", "", 2);
+  CHECK(host_req(r)->chunks == 2);
+  CHECK(!host_req(r)->corrupt);
+  host_req_free(r);
+
+  // with the flash on, /capture waits for a frame whose whole exposure came after the LED went on:
+  // the first one is stamped as the LED goes on, the next a frame period later
+  r = get(80, "/control", "var=led_intensity&val=255");
+  host_req_free(r);
+  int grabs = host_camera_grabs();
+  int64_t lit = esp_timer_get_time();
+  r = get(80, "/capture");
+  CHECK(host_camera_grabs() - grabs == 2);
+  CHECK(atof(host_req(r)->resp_headers["X-Timestamp"].c_str()) * 1000000 >= lit + 40000);
+  host_req_free(r);
+  r = get(80, "/control", "var=led_intensity&val=0");
+  host_req_free(r);
+
+  r = get(80, "/control", "var=framesize&val=5");
+  CHECK(host_req(r)->status == "200 OK");
+  host_req_free(r);
+
+  r = get(80, "/metrics");
+  CHECK(starts_with(host_req(r)->resp, "{\"heaps\":{"));
+  CHECK(host_req(r)->resp.find("\"timelapse\":{\"budget\"") != std::string::npos);
+  CHECK(host_req(r)->resp.substr(host_req(r)->resp.size() - 3) == "}}}");
+  CHECK(host_req(r)->finished);
+  host_req_free(r);
+
+  // profiles are saved until their names fill the list, the listing of a full list still fits
+  const char *chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  char name[3] = "";
+  char last[8] = "";
+  int saved = 0;
+  for (int i = 0; i < 200; i++) {
+    name[0] = chars[i % 62];
+    name[1] = i < 62 ? 0 : chars[i / 62];
+    r = get(80, "/profile", (std::string("save=") + name).c_str());
+    bool ok = host_req(r)->status == "200 OK";
+    host_req_free(r);
+    if (!ok) {
+      break;
+    }
+    snprintf(last, sizeof(last), "\"%s\"]", name);
+    saved++;
+  }
+  CHECK(saved > 62 && saved < 200);
+  r = get(80, "/profile", (std::string("apply=") + name).c_str());
+  CHECK(host_req(r)->status != "200 OK");
+  host_req_free(r);
+  r = get(80, "/profile");
+  CHECK(starts_with(host_req(r)->resp, "{\"profiles\":[\"a\","));
+  CHECK(host_req(r)->resp.find(last) != std::string::npos);
+  CHECK(host_req(r)->resp.back() == '}');
+  host_req_free(r);
+
+  // the stream ends when the client goes away, here after ten chunks
+  r = get(81, "/stream", "", 10);
+  CHECK(starts_with(host_req(r)->type, "multipart/x-mixed-replace"));
+  CHECK(host_req(r)->chunks == 10);
+  CHECK(host_req(r)->resp.find("\xff\xd8") != std::string::npos);
+  host_req_free(r);
+
+  // each stream worker takes one client at a time, the one after them is turned away
+  int workers = host_tasks_running("stream");
+  CHECK(workers > 0);
+  std::vector<httpd_req_t *> streams;
+  for (int i = 0; i <= workers; i++) {
+    streams.push_back(get_async(81, "/stream", "", 10));
+  }
+  CHECK(host_req(streams[workers])->status == "503 Service Unavailable");
+  host_run_until([] {
+    return host_async_open() == 0;
+  });
+  for (int i = 0; i < workers; i++) {
+    CHECK(host_req(streams[i])->chunks == 10);
+  }
+  for (httpd_req_t *s : streams) {
+    host_req_free(s);
+  }
+
+  r = get(81, "/stream", "", 1);
+  CHECK(host_req(r)->chunks == 1);
+  host_req_free(r);
+
+  // the adaptive controller runs under the stream while /status reads it
+  r = get(80, "/control", "var=adaptive&val=1");
+  host_req_free(r);
+  r = get(81, "/stream", "", 60);
+  CHECK(host_req(r)->chunks == 60);
+  host_req_free(r);
+  r = get(80, "/status");
+  CHECK(host_req(r)->resp.find("\"adaptive\":1") != std::string::npos);
+  CHECK(host_req(r)->resp.find("\"adapt_decision\":\"") != std::string::npos);
+  host_req_free(r);
+  r = get(80, "/control", "var=adaptive&val=0");
+  host_req_free(r);
+
+  // scaled views of the SVGA frame fit the work arena of boards without PSRAM
+  r = get(81, "/stream", "variant=thumb", 3);
+  CHECK(parts(r) == 1);
+  host_req_free(r);
+  r = get(81, "/stream", "scale=4", 3);
+  CHECK(parts(r) == 1);
+  host_req_free(r);
+
+#ifdef BOARD_HAS_PSRAM
+  // thumbnails come from the shared thumb task; once they stop the last one goes out again every
+  // second until the stream times out after five
+  r = get_async(81, "/stream", "variant=thumb");
+  host_run_until([r] {
+    return parts(r) >= 1;
+  });
+  int sent = parts(r);
+  host_camera_fail(true);
+  host_run_until([] {
+    return host_async_open() == 0;
+  });
+  host_camera_fail(false);
+  CHECK(parts(r) - sent >= 4);
+  CHECK(parts(r) - sent <= 6);
+  host_req_free(r);
+#endif
+
+  CHECK(host_camera_outstanding() == 0);
+  CHECK(host_async_open() == 0);
+  return 0;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+
+#define CHECK(cond)                                                              \
+  do {                                                                           \
+    if (!(cond)) {                                                               \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);   \
+      exit(1);                                                                   \
+    }                                                                            \
+  } while (0)
+
+// Starts a GET against the handler registered for uri on port, without waiting for handlers
+// that hand the request over to another task
+static inline httpd_req_t *get_async(uint16_t port, const char *uri, const char *query = "", int fail_after = -1) {
+  host_run(0);  // let idle tasks get to their waits first
+  httpd_req_t *r = host_req_new(uri, query);
+  host_req(r)->fail_after = fail_after;
+  host_req_call(port, r);
+  return r;
+}
+
+// Runs one GET to the end and hands back the recorded request
+static inline httpd_req_t *get(uint16_t port, const char *uri, const char *query = "", int fail_after = -1) {
+  httpd_req_t *r = get_async(port, uri, query, fail_after);
+  host_run_until([] {
+    return host_async_open() == 0;
+  });
+  return r;
+}
+
+static inline bool starts_with(const std::string &s, const char *prefix) {
+  return !s.compare(0, strlen(prefix), prefix);
+}
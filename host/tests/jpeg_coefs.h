@@ -0,0 +1,126 @@
+#pragma once
+
+// libjpeg on both sides of the compressed-domain JPEG code: test images with a given sampling and
+// restart interval, and the quantized DCT blocks of a JPEG as libjpeg decodes them
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <jpeglib.h>
+
+typedef struct {
+  int h;  // sampling factors
+  int v;
+  int width_in_blocks;
+  int height_in_blocks;
+  std::vector<JCOEF> coefs;  // 64 per block, a row of blocks at a time
+
+  const JCOEF *block(int bx, int by) const {
+    return &coefs[(by * width_in_blocks + bx) * 64];
+  }
+} jpeg_comp_coefs_t;
+
+typedef struct {
+  int width;
+  int height;
+  int restart_interval;
+  std::vector<jpeg_comp_coefs_t> comps;
+} jpeg_coefs_t;
+
+struct jpeg_test_error {
+  struct jpeg_error_mgr mgr;
+  jmp_buf jump;
+  int warnings;  // corrupt data libjpeg recovered from
+};
+
+static void jpeg_test_error_exit(j_common_ptr cinfo) {
+  longjmp(((jpeg_test_error *)cinfo->err)->jump, 1);
+}
+
+static void jpeg_test_message(j_common_ptr cinfo, int level) {
+  if (level < 0) {
+    ((jpeg_test_error *)cinfo->err)->warnings++;
+  }
+}
+
+// Textured test image, so blocks carry AC coefficients. gray: one component, otherwise YCbCr with
+// luma sampled h x v times the chroma.
+static std::vector<uint8_t> jpeg_test_image(int width, int height, bool gray, int h, int v, int restart_interval) {
+  int ncomp = gray ? 1 : 3;
+  std::vector<uint8_t> pixels(width * height * ncomp);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      uint8_t *p = &pixels[(y * width + x) * ncomp];
+      for (int i = 0; i < ncomp; i++) {
+        p[i] = (x * (3 + i) + y * (5 - i) + ((x ^ y) & 8) * 9) & 0xFF;
+      }
+    }
+  }
+
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  unsigned char *buf = NULL;
+  unsigned long len = 0;
+  jpeg_mem_dest(&cinfo, &buf, &len);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = ncomp;
+  cinfo.in_color_space = gray ? JCS_GRAYSCALE : JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, 80, TRUE);
+  cinfo.comp_info[0].h_samp_factor = gray ? 1 : h;
+  cinfo.comp_info[0].v_samp_factor = gray ? 1 : v;
+  cinfo.restart_interval = restart_interval;
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row = &pixels[cinfo.next_scanline * width * ncomp];
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  std::vector<uint8_t> out(buf, buf + len);
+  free(buf);
+  return out;
+}
+
+// Fails on anything libjpeg has to recover from, not only on fatal errors
+static bool jpeg_read_coefs(const uint8_t *src, size_t len, jpeg_coefs_t *out) {
+  struct jpeg_decompress_struct cinfo;
+  jpeg_test_error jerr;
+  cinfo.err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = jpeg_test_error_exit;
+  jerr.mgr.emit_message = jpeg_test_message;
+  jerr.warnings = 0;
+  if (setjmp(jerr.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, src, len);
+  jpeg_read_header(&cinfo, TRUE);
+  jvirt_barray_ptr *arrays = jpeg_read_coefficients(&cinfo);
+  out->width = cinfo.image_width;
+  out->height = cinfo.image_height;
+  out->restart_interval = cinfo.restart_interval;
+  out->comps.clear();
+  for (int i = 0; i < cinfo.num_components; i++) {
+    jpeg_component_info *ci = &cinfo.comp_info[i];
+    jpeg_comp_coefs_t c;
+    c.h = ci->h_samp_factor;
+    c.v = ci->v_samp_factor;
+    c.width_in_blocks = ci->width_in_blocks;
+    c.height_in_blocks = ci->height_in_blocks;
+    for (int by = 0; by < c.height_in_blocks; by++) {
+      JBLOCKARRAY row = cinfo.mem->access_virt_barray((j_common_ptr)&cinfo, arrays[i], by, 1, FALSE);
+      for (int bx = 0; bx < c.width_in_blocks; bx++) {
+        c.coefs.insert(c.coefs.end(), row[0][bx], row[0][bx] + DCTSIZE2);
+      }
+    }
+    out->comps.push_back(c);
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return jerr.warnings == 0;
+}
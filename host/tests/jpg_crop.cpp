@@ -0,0 +1,99 @@
+// /stream?roi= crops cut by jpg_crop(): the DCT blocks libjpeg decodes from the crop must be the
+// source's blocks under the returned rectangle, bit for bit, whatever the sampling and restart
+// interval of the source
+#include "../../jpg_overlay.h"
+#include "check.h"
+#include "jpeg_coefs.h"
+
+typedef struct {
+  const char *name;
+  bool gray;
+  int h;  // luma sampling
+  int v;
+  int restart_interval;
+} sampling_t;
+
+static const sampling_t samplings[] = {
+  {"4:2:0", false, 2, 2, 0},
+  {"4:2:2", false, 2, 1, 0},
+  {"gray", true, 1, 1, 0},
+  {"4:2:0 dri", false, 2, 2, 3},
+  {"4:2:2 dri", false, 2, 1, 7},
+  {"gray dri", true, 1, 1, 5},
+};
+
+static const jpg_overlay_box_t rois[] = {
+  {0, 0, 150, 110},     // whole frame
+  {13, 7, 33, 21},      // off the MCU grid
+  {32, 48, 16, 16},     // on it
+  {15, 31, 2, 2},       // across an MCU corner
+  {-20, -10, 50, 40},   // starts before the frame
+  {100, 80, 100, 100},  // runs off the frame
+};
+
+#define WIDTH  150
+#define HEIGHT 110
+
+static int snap_down(int v, int grid) {
+  return v < 0 ? 0 : v / grid * grid;
+}
+
+static int snap_up(int v, int grid, int limit) {
+  v = (v + grid - 1) / grid * grid;
+  return v > limit ? limit : v;
+}
+
+static void check_crop(const std::vector<uint8_t> &jpg, const jpeg_coefs_t *src, jpg_overlay_box_t roi) {
+  int mcu_w = 8 * src->comps[0].h;
+  int mcu_h = 8 * src->comps[0].v;
+  jpg_overlay_box_t want;
+  want.x = snap_down(roi.x, mcu_w);
+  want.y = snap_down(roi.y, mcu_h);
+  want.w = snap_up(roi.x + roi.w, mcu_w, WIDTH) - want.x;
+  want.h = snap_up(roi.y + roi.h, mcu_h, HEIGHT) - want.y;
+
+  jpg_overlay_box_t rect = roi;
+  uint8_t *out = NULL;
+  size_t out_len = 0;
+  CHECK(jpg_crop(jpg.data(), jpg.size(), &rect, &out, &out_len));
+  CHECK(rect.x == want.x && rect.y == want.y && rect.w == want.w && rect.h == want.h);
+  jpeg_coefs_t dst;
+  CHECK(jpeg_read_coefs(out, out_len, &dst));
+  free(out);
+  CHECK(dst.width == rect.w && dst.height == rect.h);
+  CHECK(dst.restart_interval == 0);
+  CHECK(dst.comps.size() == src->comps.size());
+
+  for (size_t i = 0; i < dst.comps.size(); i++) {
+    const jpeg_comp_coefs_t *a = &src->comps[i];
+    const jpeg_comp_coefs_t *b = &dst.comps[i];
+    int bw = mcu_w / a->h;
+    int bh = mcu_h / a->v;
+    CHECK(b->width_in_blocks == (rect.w + bw - 1) / bw && b->height_in_blocks == (rect.h + bh - 1) / bh);
+    for (int by = 0; by < b->height_in_blocks; by++) {
+      for (int bx = 0; bx < b->width_in_blocks; bx++) {
+        CHECK(!memcmp(b->block(bx, by), a->block(bx + rect.x / bw, by + rect.y / bh), DCTSIZE2 * sizeof(JCOEF)));
+      }
+    }
+  }
+}
+
+int main() {
+  for (const sampling_t &s : samplings) {
+    printf("%s\n", s.name);
+    std::vector<uint8_t> jpg = jpeg_test_image(WIDTH, HEIGHT, s.gray, s.h, s.v, s.restart_interval);
+    jpeg_coefs_t src;
+    CHECK(jpeg_read_coefs(jpg.data(), jpg.size(), &src));
+    for (const jpg_overlay_box_t &roi : rois) {
+      check_crop(jpg, &src, roi);
+    }
+
+    // nothing of the frame left
+    jpg_overlay_box_t rect = {WIDTH + 10, 0, 20, 20};
+    uint8_t *out = NULL;
+    size_t out_len = 0;
+    CHECK(!jpg_crop(jpg.data(), jpg.size(), &rect, &out, &out_len));
+    CHECK(!out);
+  }
+  return 0;
+}
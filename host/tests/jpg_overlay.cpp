@@ -0,0 +1,112 @@
+// Face boxes drawn by jpg_overlay_boxes(), checked on the DCT blocks libjpeg decodes from its
+// output: blocks crossed by a box edge are flat, every other block is the source's
+#include "../../jpg_overlay.h"
+#include "check.h"
+#include "jpeg_coefs.h"
+
+typedef struct {
+  const char *name;
+  bool gray;
+  int h;  // luma sampling
+  int v;
+  int restart_interval;
+} sampling_t;
+
+static const sampling_t samplings[] = {
+  {"4:2:0", false, 2, 2, 0},
+  {"4:2:2", false, 2, 1, 0},
+  {"gray", true, 1, 1, 0},
+  {"4:2:0 dri", false, 2, 2, 3},
+  {"4:2:2 dri", false, 2, 1, 7},
+  {"gray dri", true, 1, 1, 5},
+};
+
+// on and off the MCU grid, the last one runs off the frame
+static const jpg_overlay_box_t boxes[] = {
+  {17, 9, 60, 41},
+  {16, 64, 48, 32},
+  {90, 50, 40, 55},
+  {130, 95, 40, 40},
+};
+#define BOXES (sizeof(boxes) / sizeof(boxes[0]))
+
+#define WIDTH  150
+#define HEIGHT 110
+
+// Whether the pixels x..x+w-1, y..y+h-1 take in any of the one pixel wide box outlines
+static bool on_outline(int x, int y, int w, int h) {
+  for (size_t i = 0; i < BOXES; i++) {
+    const jpg_overlay_box_t *b = &boxes[i];
+    for (int py = y; py < y + h; py++) {
+      for (int px = x; px < x + w; px++) {
+        bool inside = px >= b->x && px < b->x + b->w && py >= b->y && py < b->y + b->h;
+        bool interior = px > b->x && px < b->x + b->w - 1 && py > b->y && py < b->y + b->h - 1;
+        if (inside && !interior) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+static bool flat(const JCOEF *block) {
+  for (int k = 1; k < DCTSIZE2; k++) {
+    if (block[k]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void check_sampling(const sampling_t *s) {
+  printf("%s\n", s->name);
+  std::vector<uint8_t> jpg = jpeg_test_image(WIDTH, HEIGHT, s->gray, s->h, s->v, s->restart_interval);
+  jpeg_coefs_t src;
+  CHECK(jpeg_read_coefs(jpg.data(), jpg.size(), &src));
+
+  uint8_t *out = NULL;
+  size_t out_len = 0;
+  CHECK(jpg_overlay_boxes(jpg.data(), jpg.size(), boxes, BOXES, 0x00FFFF, &out, &out_len));
+  jpeg_coefs_t dst;
+  CHECK(jpeg_read_coefs(out, out_len, &dst));
+  free(out);
+  CHECK(dst.width == WIDTH && dst.height == HEIGHT);
+  CHECK(dst.restart_interval == s->restart_interval);
+  CHECK(dst.comps.size() == src.comps.size());
+
+  for (size_t i = 0; i < src.comps.size(); i++) {
+    const jpeg_comp_coefs_t *a = &src.comps[i];
+    const jpeg_comp_coefs_t *b = &dst.comps[i];
+    CHECK(b->width_in_blocks == a->width_in_blocks && b->height_in_blocks == a->height_in_blocks);
+    int bw = 8 * src.comps[0].h / a->h;
+    int bh = 8 * src.comps[0].v / a->v;
+    int edges = 0;
+    int textured = 0;
+    int dc = 0;
+    for (int by = 0; by < a->height_in_blocks; by++) {
+      for (int bx = 0; bx < a->width_in_blocks; bx++) {
+        const JCOEF *before = a->block(bx, by);
+        const JCOEF *after = b->block(bx, by);
+        if (!on_outline(bx * bw, by * bh, bw, bh)) {
+          CHECK(!memcmp(before, after, DCTSIZE2 * sizeof(JCOEF)));
+          continue;
+        }
+        CHECK(flat(after));
+        CHECK(!edges || after[0] == dc);
+        dc = after[0];
+        edges++;
+        textured += !flat(before);
+      }
+    }
+    CHECK(edges > 0);
+    CHECK(textured > 0);
+  }
+}
+
+int main() {
+  for (const sampling_t &s : samplings) {
+    check_sampling(&s);
+  }
+  return 0;
+}
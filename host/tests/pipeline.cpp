@@ -0,0 +1,124 @@
+// Every frame source through /capture, /bmp and /stream, with face detection off and on. The
+// stand-in detector reports one face wherever it is run.
+#include <vector>
+#include "check.h"
+#include "human_face_detect_msr01.hpp"
+
+void setup();
+
+#if defined(BOARD_HAS_PSRAM) && CONFIG_IDF_TARGET_ESP32S3
+#define FACES 1
+#else
+#define FACES 0
+#endif
+
+typedef struct {
+  const char *name;
+  pixformat_t format;
+  int width;
+  int height;
+  int scale;  // detector input to frame coordinates, JPEG frames are detected on a thumbnail
+} source_t;
+
+static const source_t sources[] = {
+  {"jpeg", PIXFORMAT_JPEG, 320, 240, 2},
+  {"jpeg", PIXFORMAT_JPEG, 800, 600, 4},
+  {"rgb565", PIXFORMAT_RGB565, 320, 240, 1},
+};
+
+static void set_source(const source_t *src) {
+  // let the frames the last stream left in the ring go stale
+  host_time_advance(1000000);
+  if (src->format == PIXFORMAT_JPEG) {
+    std::vector<uint8_t> jpg = host_test_jpeg(src->width, src->height);
+    host_camera_set_frame(src->format, src->width, src->height, jpg.data(), jpg.size());
+  } else {
+    std::vector<uint8_t> rgb(src->width * src->height * 2);
+    for (size_t i = 0; i < rgb.size(); i++) {
+      rgb[i] = i * 7;
+    }
+    host_camera_set_frame(src->format, src->width, src->height, rgb.data(), rgb.size());
+  }
+}
+
+// Width and height from the baseline SOF marker
+static bool jpeg_size(const std::string &jpg, int *width, int *height) {
+  for (size_t i = 2; i + 9 < jpg.size(); i++) {
+    if ((uint8_t)jpg[i] == 0xFF && (uint8_t)jpg[i + 1] == 0xC0) {
+      *height = ((uint8_t)jpg[i + 5] << 8) | (uint8_t)jpg[i + 6];
+      *width = ((uint8_t)jpg[i + 7] << 8) | (uint8_t)jpg[i + 8];
+      return true;
+    }
+  }
+  return false;
+}
+
+static void check_source(const source_t *src, bool detect, bool recognize = false) {
+  char faces[64];
+  int s = recognize ? 1 : src->scale;  // recognition needs full resolution landmarks
+  snprintf(faces, sizeof(faces), "%d,%d,%d,%d,90", 40 * s, 30 * s, 60 * s + 1, 80 * s + 1);
+  // without the thumbnail, frames over 400 wide are too slow to run the detector on
+  bool expect_faces = FACES && detect && !(recognize && src->width > 400);
+  fprintf(stderr, "%s %dx%d, detection %s%s\n", src->name, src->width, src->height, detect ? "on" : "off", recognize ? ", recognition on" : "");
+  set_source(src);
+  host_detect_calls = 0;
+
+  httpd_req_t *r = get(80, "/capture");
+  host_req_t *h = host_req(r);
+  int width, height;
+  CHECK(h->status == "200 OK");
+  CHECK(h->type == "image/jpeg");
+  CHECK(jpeg_size(h->resp, &width, &height));
+  CHECK(width == src->width && height == src->height);
+  CHECK(h->resp_headers.count("X-Faces") == expect_faces);
+  if (expect_faces) {
+    CHECK(h->resp_headers["X-Faces"] == faces);
+  }
+  host_req_free(r);
+
+  r = get(80, "/bmp");
+  h = host_req(r);
+  CHECK(h->type == "image/x-windows-bmp");
+  CHECK(h->resp.size() == 54 + (size_t)src->width * src->height * 3);
+  host_req_free(r);
+
+  r = get(81, "/stream", "", 9);
+  h = host_req(r);
+  CHECK(h->chunks == 9);
+  CHECK((h->resp.find(std::string("X-Faces: ") + faces) != std::string::npos) == expect_faces);
+  host_req_free(r);
+
+  CHECK((host_detect_calls > 0) == expect_faces);
+  CHECK(host_camera_outstanding() == 0);
+}
+
+int main() {
+  dl::detect::result_t face;
+  face.category = 0;
+  face.score = 0.9f;
+  face.box = {40, 30, 100, 110};
+  face.keypoint = {50, 50, 60, 90, 70, 70, 80, 50, 90, 90};
+  host_detect_results.push_back(face);
+
+  set_source(&sources[0]);
+  setup();
+
+  for (const source_t &src : sources) {
+    check_source(&src, false);
+  }
+  httpd_req_t *r = get(80, "/control", "var=face_detect&val=1");
+  CHECK(host_req(r)->status == (FACES ? "200 OK" : "500 Internal Server Error"));
+  host_req_free(r);
+  for (const source_t &src : sources) {
+    check_source(&src, true);
+  }
+#if FACES
+  r = get(80, "/control", "var=face_recognize&val=1");
+  CHECK(host_req(r)->status == "200 OK");
+  host_req_free(r);
+  for (const source_t &src : sources) {
+    check_source(&src, true, true);
+  }
+#endif
+  return 0;
+}
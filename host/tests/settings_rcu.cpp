@@ -0,0 +1,32 @@
+// A settings writer must not reuse a slot while a stream is still copying it
+#include "../../app_httpd.cpp"
+#include "check.h"
+
+static bool published;
+
+static void writer(void *arg) {
+  settings_t *next = settings_edit();
+  next->led_duty = 42;
+  settings_publish(next);
+  published = true;
+  vTaskDelete(NULL);
+}
+
+int main() {
+  settings_init();
+  // a reader caught mid-copy on the slot the next publish goes to
+  int slot = settings_spare;
+  settings_readers[slot]++;
+  xTaskCreate(writer, "writer", 4096, NULL, 5, NULL);
+  host_run(100 * 1000);
+  CHECK(!published);
+  CHECK(settings_get().led_duty == 0);
+
+  settings_readers[slot]--;
+  CHECK(host_run_until([] {
+    return published;
+  }));
+  CHECK(settings_current.load() == &settings_slots[slot]);
+  CHECK(settings_get().led_duty == 42);
+  return 0;
+}
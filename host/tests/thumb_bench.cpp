@@ -0,0 +1,51 @@
+// Detector input from a JPEG frame: the scaled thumbnail against a full fmt2rgb888 decode, per
+// frame size. Host timings only show the ratio; libjpeg also skips the IDCT at 1/8 scale.
+#include <chrono>
+#include "../../app_httpd.cpp"
+#include "check.h"
+
+#define BENCH_RUNS 20
+
+static double now_ms() {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main() {
+  frame_pool_init();
+  static const framesize_t sizes[] = {FRAMESIZE_QVGA, FRAMESIZE_VGA, FRAMESIZE_SVGA, FRAMESIZE_XGA, FRAMESIZE_UXGA};
+  printf("%-10s %6s %12s %12s %8s\n", "frame", "scale", "thumb ms", "rgb888 ms", "speedup");
+  for (framesize_t size : sizes) {
+    int width = resolution[size].width;
+    int height = resolution[size].height;
+    std::vector<uint8_t> jpg = host_test_jpeg(width, height);
+    camera_fb_t fb = {};
+    fb.buf = jpg.data();
+    fb.len = jpg.size();
+    fb.width = width;
+    fb.height = height;
+    fb.format = PIXFORMAT_JPEG;
+    std::vector<uint8_t> rgb(width * height * 3);
+
+    face_thumb_t thumb;
+    double start = now_ms();
+    for (int i = 0; i < BENCH_RUNS; i++) {
+      CHECK(face_thumb_decode(&fb, &thumb));
+      frame_pool_put(thumb.buf);
+    }
+    double thumb_ms = (now_ms() - start) / BENCH_RUNS;
+
+    start = now_ms();
+    for (int i = 0; i < BENCH_RUNS; i++) {
+      CHECK(fmt2rgb888(fb.buf, fb.len, fb.format, rgb.data()));
+    }
+    double full_ms = (now_ms() - start) / BENCH_RUNS;
+
+    char name[16];
+    snprintf(name, sizeof(name), "%dx%d", width, height);
+    printf("%-10s %4s%-2d %12.3f %12.3f %7.1fx\n", name, "1/", 1 << thumb.shift, thumb_ms, full_ms, full_ms / thumb_ms);
+    if (thumb.shift) {
+      CHECK(thumb_ms < full_ms);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,629 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "jpg_overlay.h"
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
+#include "esp32-hal-log.h"
+#endif
+
+#define JPG_MAX_COMPONENTS 3
+
+typedef struct {
+  uint8_t lut_len[256];  //8 bit lookahead, 0 when the code is longer
+  uint8_t lut_val[256];
+  int32_t mincode[17];
+  int32_t maxcode[17];
+  int32_t valptr[17];
+  uint8_t huffval[256];
+  uint16_t ehufco[256];
+  uint8_t ehufsi[256];
+  bool valid;
+} jpg_huff_t;
+
+typedef struct {
+  uint8_t id;
+  uint8_t h;
+  uint8_t v;
+  uint8_t tq;
+  uint8_t td;
+  uint8_t ta;
+  int paint_dc;
+  int pred_in;   //DC predictor of the source stream
+  int pred_out;  //DC predictor of the emitted stream
+} jpg_comp_t;
+
+typedef struct {
+  const uint8_t *src;
+  size_t pos;
+  size_t end;
+  uint32_t buf;
+  int count;
+  bool marker;
+} jpg_reader_t;
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  size_t cap;
+  uint32_t acc;
+  int n;
+  bool oom;
+} jpg_writer_t;
+
+typedef struct {
+  jpg_huff_t dc[4];
+  jpg_huff_t ac[4];
+  uint16_t qdc[4];
+  jpg_comp_t comp[JPG_MAX_COMPONENTS];
+  int ncomp;
+  int width;
+  int height;
+  int restart_interval;
+  jpg_reader_t r;
+  jpg_writer_t w;
+} jpg_overlay_t;
+
+static inline int be16(const uint8_t *p) {
+  return (p[0] << 8) | p[1];
+}
+
+static bool huff_build(jpg_huff_t *t, const uint8_t *bits, const uint8_t *vals, int nvals) {
+  memset(t, 0, sizeof(jpg_huff_t));
+  if (nvals > 256) {
+    return false;
+  }
+  memcpy(t->huffval, vals, nvals);
+  int32_t code = 0;
+  int k = 0;
+  for (int l = 1; l <= 16; l++) {
+    int cnt = bits[l - 1];
+    t->valptr[l] = k;
+    t->mincode[l] = code;
+    for (int i = 0; i < cnt; i++, k++, code++) {
+      if (k >= nvals) {
+        return false;
+      }
+      uint8_t sym = vals[k];
+      t->ehufco[sym] = code;
+      t->ehufsi[sym] = l;
+      if (l <= 8) {
+        int shift = 8 - l;
+        for (int j = 0; j < (1 << shift); j++) {
+          t->lut_len[(code << shift) | j] = l;
+          t->lut_val[(code << shift) | j] = sym;
+        }
+      }
+    }
+    t->maxcode[l] = cnt ? code - 1 : -1;
+    if (code > (1 << l)) {
+      return false;
+    }
+    code <<= 1;
+  }
+  t->valid = true;
+  return true;
+}
+
+static void reader_fill(jpg_reader_t *r) {
+  while (r->count <= 24) {
+    uint32_t b = 0;
+    if (!r->marker && r->pos < r->end) {
+      b = r->src[r->pos];
+      if (b == 0xFF) {
+        if (r->pos + 1 < r->end && r->src[r->pos + 1] == 0x00) {
+          r->pos += 2;
+        } else {
+          // a marker, feed zeros until the caller deals with it
+          r->marker = true;
+          b = 0;
+        }
+      } else {
+        r->pos++;
+      }
+    }
+    r->buf |= b << (24 - r->count);
+    r->count += 8;
+  }
+}
+
+static inline void reader_skip(jpg_reader_t *r, int n) {
+  r->buf <<= n;
+  r->count -= n;
+}
+
+static uint32_t reader_bits(jpg_reader_t *r, int n) {
+  if (!n) {
+    return 0;
+  }
+  reader_fill(r);
+  uint32_t v = r->buf >> (32 - n);
+  reader_skip(r, n);
+  return v;
+}
+
+static bool reader_restart(jpg_reader_t *r) {
+  r->buf = 0;
+  r->count = 0;
+  if (!r->marker || r->pos + 1 >= r->end || (r->src[r->pos + 1] & 0xF8) != 0xD0) {
+    return false;
+  }
+  r->pos += 2;
+  r->marker = false;
+  return true;
+}
+
+static int huff_decode(jpg_reader_t *r, const jpg_huff_t *t) {
+  reader_fill(r);
+  uint32_t look = r->buf >> 24;
+  if (t->lut_len[look]) {
+    reader_skip(r, t->lut_len[look]);
+    return t->lut_val[look];
+  }
+  for (int l = 9; l <= 16; l++) {
+    int32_t code = r->buf >> (32 - l);
+    if (code <= t->maxcode[l]) {
+      reader_skip(r, l);
+      return t->huffval[t->valptr[l] + code - t->mincode[l]];
+    }
+  }
+  return -1;
+}
+
+static inline int extend(uint32_t v, int s) {
+  return (s && v < (1u << (s - 1))) ? (int)v - (1 << s) + 1 : (int)v;
+}
+
+static void writer_byte(jpg_writer_t *w, uint8_t b) {
+  if (w->len >= w->cap) {
+    size_t cap = w->cap * 2;
+    uint8_t *buf = (uint8_t *)realloc(w->buf, cap);
+    if (!buf) {
+      w->oom = true;
+      return;
+    }
+    w->buf = buf;
+    w->cap = cap;
+  }
+  w->buf[w->len++] = b;
+}
+
+static void writer_bits(jpg_writer_t *w, uint32_t code, int len) {
+  w->acc = (w->acc << len) | (code & ((1u << len) - 1));
+  w->n += len;
+  while (w->n >= 8) {
+    uint8_t b = (w->acc >> (w->n - 8)) & 0xFF;
+    w->n -= 8;
+    writer_byte(w, b);
+    if (b == 0xFF) {
+      writer_byte(w, 0x00);
+    }
+  }
+}
+
+static void writer_flush(jpg_writer_t *w) {
+  if (w->n) {
+    writer_bits(w, 0xFF, 8 - w->n);
+  }
+}
+
+static bool encode_dc(jpg_writer_t *w, const jpg_huff_t *t, int diff) {
+  int v = diff < 0 ? -diff : diff;
+  int s = 0;
+  while (v) {
+    s++;
+    v >>= 1;
+  }
+  if (s > 11 || !t->ehufsi[s]) {
+    return false;
+  }
+  writer_bits(w, t->ehufco[s], t->ehufsi[s]);
+  if (s) {
+    writer_bits(w, diff < 0 ? diff - 1 : diff, s);
+  }
+  return true;
+}
+
+typedef enum {
+  BLOCK_COPY,
+  BLOCK_PAINT,  //flat block of the component's paint_dc
+  BLOCK_SKIP,   //decoded for the DC predictor, nothing written
+} jpg_block_mode_t;
+
+static bool transcode_block(jpg_overlay_t *ov, jpg_comp_t *c, jpg_block_mode_t mode) {
+  bool paint = mode == BLOCK_PAINT;
+  bool skip = mode == BLOCK_SKIP;
+  const jpg_huff_t *dct = &ov->dc[c->td];
+  const jpg_huff_t *act = &ov->ac[c->ta];
+
+  int s = huff_decode(&ov->r, dct);
+  if (s < 0 || s > 11) {
+    return false;
+  }
+  c->pred_in += extend(reader_bits(&ov->r, s), s);
+  int dc = paint ? c->paint_dc : c->pred_in;
+  if (!skip) {
+    if (!encode_dc(&ov->w, dct, dc - c->pred_out)) {
+      return false;
+    }
+    c->pred_out = dc;
+  }
+
+  for (int k = 1; k < 64;) {
+    int rs = huff_decode(&ov->r, act);
+    if (rs < 0) {
+      return false;
+    }
+    int run = rs >> 4;
+    int size = rs & 15;
+    uint32_t bits = reader_bits(&ov->r, size);
+    if (mode == BLOCK_COPY) {
+      writer_bits(&ov->w, act->ehufco[rs], act->ehufsi[rs]);
+      if (size) {
+        writer_bits(&ov->w, bits, size);
+      }
+    }
+    if (!size) {
+      if (run != 15) {
+        break;  //EOB
+      }
+      k += 16;
+    } else {
+      k += run + 1;
+    }
+  }
+  if (paint) {
+    writer_bits(&ov->w, act->ehufco[0x00], act->ehufsi[0x00]);
+  }
+  return true;
+}
+
+static bool block_on_edge(const jpg_overlay_box_t *boxes, size_t count, int x, int y, int w, int h) {
+  for (size_t i = 0; i < count; i++) {
+    const jpg_overlay_box_t *b = &boxes[i];
+    if (x >= b->x + b->w || x + w <= b->x || y >= b->y + b->h || y + h <= b->y) {
+      continue;
+    }
+    if (x >= b->x + 1 && x + w <= b->x + b->w - 1 && y >= b->y + 1 && y + h <= b->y + b->h - 1) {
+      continue;
+    }
+    return true;
+  }
+  return false;
+}
+
+static int paint_dc(int level, uint16_t q) {
+  int v = (level - 128) * 8;
+  return (v >= 0 ? v + q / 2 : v - q / 2) / q;
+}
+
+static size_t parse_headers(jpg_overlay_t *ov, const uint8_t *src, size_t src_len) {
+  if (src_len < 4 || src[0] != 0xFF || src[1] != 0xD8) {
+    return 0;
+  }
+  size_t pos = 2;
+  bool sof = false;
+  while (pos + 4 <= src_len) {
+    if (src[pos] != 0xFF) {
+      return 0;
+    }
+    uint8_t marker = src[pos + 1];
+    if (marker == 0xFF) {
+      pos++;
+      continue;
+    }
+    size_t seg_len = be16(src + pos + 2);
+    const uint8_t *seg = src + pos + 4;
+    const uint8_t *seg_end = src + pos + 2 + seg_len;
+    if (seg_len < 2 || pos + 2 + seg_len > src_len) {
+      return 0;
+    }
+    switch (marker) {
+      case 0xDB:  //DQT
+        while (seg < seg_end) {
+          int pq = seg[0] >> 4;
+          int tq = seg[0] & 3;
+          ov->qdc[tq] = pq ? be16(seg + 1) : seg[1];
+          seg += 1 + (pq ? 128 : 64);
+        }
+        break;
+      case 0xC4:  //DHT
+        while (seg + 17 <= seg_end) {
+          int tc = seg[0] >> 4;
+          int th = seg[0] & 3;
+          int n = 0;
+          for (int i = 1; i <= 16; i++) {
+            n += seg[i];
+          }
+          if (seg + 17 + n > seg_end || !huff_build(tc ? &ov->ac[th] : &ov->dc[th], seg + 1, seg + 17, n)) {
+            return 0;
+          }
+          seg += 17 + n;
+        }
+        break;
+      case 0xC0:  //SOF0 baseline
+      case 0xC1:  //SOF1 extended, huffman
+        if (seg[0] != 8 || seg[5] == 0 || seg[5] > JPG_MAX_COMPONENTS) {
+          return 0;
+        }
+        ov->height = be16(seg + 1);
+        ov->width = be16(seg + 3);
+        ov->ncomp = seg[5];
+        for (int i = 0; i < ov->ncomp; i++) {
+          ov->comp[i].id = seg[6 + i * 3];
+          ov->comp[i].h = seg[7 + i * 3] >> 4;
+          ov->comp[i].v = seg[7 + i * 3] & 15;
+          ov->comp[i].tq = seg[8 + i * 3] & 3;
+        }
+        sof = true;
+        break;
+      case 0xDD:  //DRI
+        ov->restart_interval = be16(seg);
+        break;
+      case 0xDA:  //SOS
+        if (!sof || seg[0] != ov->ncomp) {
+          return 0;
+        }
+        for (int i = 0; i < ov->ncomp; i++) {
+          if (seg[1 + i * 2] != ov->comp[i].id) {
+            return 0;
+          }
+          ov->comp[i].td = seg[2 + i * 2] >> 4;
+          ov->comp[i].ta = seg[2 + i * 2] & 3;
+        }
+        return pos + 2 + seg_len;
+      default:
+        if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+          return 0;  //progressive, lossless or arithmetic coded
+        }
+        break;
+    }
+    pos += 2 + seg_len;
+  }
+  return 0;
+}
+
+// Sampling factors and tables the transcoder can handle, and the MCU size in blocks
+static bool check_components(jpg_overlay_t *ov, int *hmax, int *vmax) {
+  *hmax = 1;
+  *vmax = 1;
+  if (ov->ncomp == 1) {
+    ov->comp[0].h = 1;
+    ov->comp[0].v = 1;
+  }
+  for (int i = 0; i < ov->ncomp; i++) {
+    jpg_comp_t *c = &ov->comp[i];
+    if (!c->h || !c->v || c->h > 2 || c->v > 2 || !ov->dc[c->td].valid || !ov->ac[c->ta].valid || !ov->ac[c->ta].ehufsi[0x00] || !ov->qdc[c->tq]) {
+      return false;
+    }
+    *hmax = c->h > *hmax ? c->h : *hmax;
+    *vmax = c->v > *vmax ? c->v : *vmax;
+  }
+  return true;
+}
+
+static size_t find_scan_end(const uint8_t *src, size_t start, size_t src_len) {
+  for (size_t i = start; i + 1 < src_len; i++) {
+    if (src[i] == 0xFF && src[i + 1] != 0x00 && (src[i + 1] & 0xF8) != 0xD0) {
+      return i;
+    }
+  }
+  return src_len;
+}
+
+bool jpg_overlay_boxes(const uint8_t *src, size_t src_len, const jpg_overlay_box_t *boxes, size_t count, uint32_t color, uint8_t **out, size_t *out_len) {
+  *out = NULL;
+  *out_len = 0;
+
+  jpg_overlay_t *ov = (jpg_overlay_t *)calloc(1, sizeof(jpg_overlay_t));
+  if (!ov) {
+    return false;
+  }
+  bool ok = false;
+  size_t scan_start = parse_headers(ov, src, src_len);
+  if (!scan_start || !ov->width || !ov->height) {
+    log_w("Unsupported JPEG for overlay");
+    free(ov);
+    return false;
+  }
+
+  int r = color & 0xFF;
+  int g = (color >> 8) & 0xFF;
+  int b = (color >> 16) & 0xFF;
+  int levels[JPG_MAX_COMPONENTS] = {
+    (77 * r + 150 * g + 29 * b) >> 8,
+    (-43 * r - 85 * g + 128 * b + 32768) >> 8,
+    (128 * r - 107 * g - 21 * b + 32768) >> 8,
+  };
+
+  int hmax, vmax;
+  if (!check_components(ov, &hmax, &vmax)) {
+    log_w("Unsupported JPEG for overlay");
+    free(ov);
+    return false;
+  }
+  for (int i = 0; i < ov->ncomp; i++) {
+    ov->comp[i].paint_dc = paint_dc(levels[i], ov->qdc[ov->comp[i].tq]);
+  }
+
+  size_t scan_end = find_scan_end(src, scan_start, src_len);
+  ov->r.src = src;
+  ov->r.pos = scan_start;
+  ov->r.end = scan_end;
+  ov->w.cap = src_len + src_len / 8 + 1024;
+  ov->w.buf = (uint8_t *)malloc(ov->w.cap);
+  if (!ov->w.buf) {
+    free(ov);
+    return false;
+  }
+  memcpy(ov->w.buf, src, scan_start);
+  ov->w.len = scan_start;
+
+  int mcus_x = (ov->width + 8 * hmax - 1) / (8 * hmax);
+  int mcus_y = (ov->height + 8 * vmax - 1) / (8 * vmax);
+  int mcu = 0;
+  int rst = 0;
+  for (int my = 0; my < mcus_y; my++) {
+    for (int mx = 0; mx < mcus_x; mx++, mcu++) {
+      if (ov->restart_interval && mcu && (mcu % ov->restart_interval) == 0) {
+        if (!reader_restart(&ov->r)) {
+          goto done;
+        }
+        writer_flush(&ov->w);
+        writer_byte(&ov->w, 0xFF);
+        writer_byte(&ov->w, 0xD0 + (rst++ & 7));
+        for (int i = 0; i < ov->ncomp; i++) {
+          ov->comp[i].pred_in = 0;
+          ov->comp[i].pred_out = 0;
+        }
+      }
+      for (int i = 0; i < ov->ncomp; i++) {
+        jpg_comp_t *c = &ov->comp[i];
+        int bw = 8 * hmax / c->h;
+        int bh = 8 * vmax / c->v;
+        for (int v = 0; v < c->v; v++) {
+          for (int h = 0; h < c->h; h++) {
+            int x = (mx * c->h + h) * bw;
+            int y = (my * c->v + v) * bh;
+            if (!transcode_block(ov, c, block_on_edge(boxes, count, x, y, bw, bh) ? BLOCK_PAINT : BLOCK_COPY)) {
+              goto done;
+            }
+          }
+        }
+      }
+    }
+  }
+  writer_flush(&ov->w);
+  for (size_t i = scan_end; i < src_len; i++) {
+    writer_byte(&ov->w, src[i]);
+  }
+  ok = !ov->w.oom;
+
+done:
+  if (ok) {
+    *out = ov->w.buf;
+    *out_len = ov->w.len;
+  } else {
+    log_w("JPEG overlay failed at MCU %d", mcu);
+    free(ov->w.buf);
+  }
+  free(ov);
+  return ok;
+}
+
+// Copies the header segments in front of the scan, with the frame size replaced and
+// without DRI, since the cropped scan is written without restart markers
+static void write_crop_headers(jpg_writer_t *w, const uint8_t *src, size_t scan_start, int width, int height) {
+  writer_byte(w, 0xFF);
+  writer_byte(w, 0xD8);
+  size_t pos = 2;
+  while (pos + 4 <= scan_start) {
+    if (src[pos + 1] == 0xFF) {
+      pos++;
+      continue;
+    }
+    uint8_t marker = src[pos + 1];
+    size_t seg_len = be16(src + pos + 2);
+    if (marker != 0xDD) {
+      size_t start = w->len;
+      for (size_t i = 0; i < 2 + seg_len; i++) {
+        writer_byte(w, src[pos + i]);
+      }
+      if ((marker == 0xC0 || marker == 0xC1) && !w->oom) {
+        w->buf[start + 5] = height >> 8;
+        w->buf[start + 6] = height & 0xFF;
+        w->buf[start + 7] = width >> 8;
+        w->buf[start + 8] = width & 0xFF;
+      }
+    }
+    pos += 2 + seg_len;
+  }
+}
+
+bool jpg_crop(const uint8_t *src, size_t src_len, jpg_overlay_box_t *rect, uint8_t **out, size_t *out_len) {
+  *out = NULL;
+  *out_len = 0;
+
+  jpg_overlay_t *ov = (jpg_overlay_t *)calloc(1, sizeof(jpg_overlay_t));
+  if (!ov) {
+    return false;
+  }
+  bool ok = false;
+  int hmax, vmax;
+  size_t scan_start = parse_headers(ov, src, src_len);
+  if (!scan_start || !ov->width || !ov->height || !check_components(ov, &hmax, &vmax)) {
+    log_w("Unsupported JPEG for crop");
+    free(ov);
+    return false;
+  }
+
+  // snap outwards to the MCU grid and clip to the frame
+  int mcu_w = 8 * hmax;
+  int mcu_h = 8 * vmax;
+  int mcus_x = (ov->width + mcu_w - 1) / mcu_w;
+  int mcus_y = (ov->height + mcu_h - 1) / mcu_h;
+  int x0 = rect->x < 0 ? 0 : rect->x / mcu_w;
+  int y0 = rect->y < 0 ? 0 : rect->y / mcu_h;
+  int x1 = (rect->x + rect->w + mcu_w - 1) / mcu_w;
+  int y1 = (rect->y + rect->h + mcu_h - 1) / mcu_h;
+  x1 = x1 > mcus_x ? mcus_x : x1;
+  y1 = y1 > mcus_y ? mcus_y : y1;
+  if (x0 >= x1 || y0 >= y1) {
+    free(ov);
+    return false;
+  }
+  rect->x = x0 * mcu_w;
+  rect->y = y0 * mcu_h;
+  rect->w = (x1 * mcu_w > ov->width ? ov->width : x1 * mcu_w) - rect->x;
+  rect->h = (y1 * mcu_h > ov->height ? ov->height : y1 * mcu_h) - rect->y;
+
+  size_t scan_end = find_scan_end(src, scan_start, src_len);
+  ov->r.src = src;
+  ov->r.pos = scan_start;
+  ov->r.end = scan_end;
+  ov->w.cap = scan_start + (scan_end - scan_start) * (x1 - x0) * (y1 - y0) / (mcus_x * mcus_y) + 1024;
+  ov->w.buf = (uint8_t *)malloc(ov->w.cap);
+  if (!ov->w.buf) {
+    free(ov);
+    return false;
+  }
+  write_crop_headers(&ov->w, src, scan_start, rect->w, rect->h);
+
+  int mcu = 0;
+  for (int my = 0; my < y1; my++) {
+    for (int mx = 0; mx < mcus_x; mx++, mcu++) {
+      if (ov->restart_interval && mcu && (mcu % ov->restart_interval) == 0) {
+        if (!reader_restart(&ov->r)) {
+          goto done;
+        }
+        for (int i = 0; i < ov->ncomp; i++) {
+          ov->comp[i].pred_in = 0;
+        }
+      }
+      jpg_block_mode_t mode = (my >= y0 && mx >= x0 && mx < x1) ? BLOCK_COPY : BLOCK_SKIP;
+      for (int i = 0; i < ov->ncomp; i++) {
+        jpg_comp_t *c = &ov->comp[i];
+        for (int b = 0; b < c->h * c->v; b++) {
+          if (!transcode_block(ov, c, mode)) {
+            goto done;
+          }
+        }
+      }
+    }
+  }
+  writer_flush(&ov->w);
+  writer_byte(&ov->w, 0xFF);
+  writer_byte(&ov->w, 0xD9);
+  ok = !ov->w.oom;
+
+done:
+  if (ok) {
+    *out = ov->w.buf;
+    *out_len = ov->w.len;
+  } else {
+    log_w("JPEG crop failed at MCU %d", mcu);
+    free(ov->w.buf);
+  }
+  free(ov);
+  return ok;
+}
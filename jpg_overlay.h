@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+  int x;
+  int y;
+  int w;
+  int h;
+} jpg_overlay_box_t;
+
+// Draws box outlines into a baseline JPEG without decoding it to pixels.
+// The entropy coded data is Huffman decoded and re-emitted as is, except for the
+// 8x8 blocks crossed by a box edge, which are replaced by a flat block of `color`
+// (0x00BBGGRR, same as fb_gfx). No IDCT/DCT is run, so the cost is a fraction of
+// a decode + re-encode and the sensor quantization is kept for the rest of the image.
+// Returns false for streams it can't handle (progressive, non-interleaved scans, ...),
+// in which case the caller should fall back to the RGB path.
+bool jpg_overlay_boxes(const uint8_t *src, size_t src_len, const jpg_overlay_box_t *boxes, size_t count, uint32_t color, uint8_t **out, size_t *out_len);
+
+// Cuts the MCUs covering `rect` out of a baseline JPEG, again without IDCT/DCT: blocks outside
+// are only Huffman decoded (for the DC predictors), blocks inside are copied. `rect` is widened
+// to the MCU grid (8 or 16 pixels) and clipped to the frame; the actual area is written back.
+bool jpg_crop(const uint8_t *src, size_t src_len, jpg_overlay_box_t *rect, uint8_t **out, size_t *out_len);
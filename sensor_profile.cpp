@@ -0,0 +1,239 @@
+#include <string.h>
+#include <Preferences.h>
+#include "sdkconfig.h"
+#include "sensor_profile.h"
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
+#include "esp32-hal-log.h"
+#endif
+
+#define PROFILE_NAMESPACE "profiles"
+#define PROFILE_LIST_KEY  "_names"
+#define PROFILE_BOOT_KEY  "_boot"
+
+void sensor_profile_capture(sensor_t *s, sensor_profile_t *p) {
+  memset(p, 0, sizeof(*p));
+  p->version = SENSOR_PROFILE_VERSION;
+  p->framesize = s->status.framesize;
+  p->quality = s->status.quality;
+  p->brightness = s->status.brightness;
+  p->contrast = s->status.contrast;
+  p->saturation = s->status.saturation;
+  p->special_effect = s->status.special_effect;
+  p->wb_mode = s->status.wb_mode;
+  p->awb = s->status.awb;
+  p->awb_gain = s->status.awb_gain;
+  p->aec = s->status.aec;
+  p->aec2 = s->status.aec2;
+  p->ae_level = s->status.ae_level;
+  p->aec_value = s->status.aec_value;
+  p->agc = s->status.agc;
+  p->agc_gain = s->status.agc_gain;
+  p->gainceiling = s->status.gainceiling;
+  p->bpc = s->status.bpc;
+  p->wpc = s->status.wpc;
+  p->raw_gma = s->status.raw_gma;
+  p->lenc = s->status.lenc;
+  p->hmirror = s->status.hmirror;
+  p->vflip = s->status.vflip;
+  p->dcw = s->status.dcw;
+  p->colorbar = s->status.colorbar;
+}
+
+// Calls the setter only when the sensor doesn't have the value already
+#define APPLY(field, setter, type)          \
+  if (p->field != s->status.field) {        \
+    if (s->setter(s, (type)p->field) < 0) { \
+      res = -1;                             \
+    }                                       \
+    (*writes)++;                            \
+  }
+
+int sensor_profile_apply(sensor_t *s, const sensor_profile_t *p, int *writes) {
+  int res = 0;
+  *writes = 0;
+
+  // geometry restarts the pipeline, so at most one of these runs
+  if (p->has_window) {
+    res = s->set_res_raw(
+      s, p->window.start_x, p->window.start_y, p->window.end_x, p->window.end_y, p->window.offset_x, p->window.offset_y, p->window.total_x, p->window.total_y,
+      p->window.output_x, p->window.output_y, p->window.scale, p->window.binning
+    );
+    (*writes)++;
+  } else if (s->pixformat == PIXFORMAT_JPEG && p->framesize != s->status.framesize) {
+    res = s->set_framesize(s, (framesize_t)p->framesize);
+    (*writes)++;
+  }
+  // set_framesize picks its own clock on OV3660/OV5640, so the PLL goes after it
+  if (p->has_pll && res >= 0) {
+    res = s->set_pll(s, p->pll.bypass, p->pll.mul, p->pll.sys, p->pll.root, p->pll.pre, p->pll.seld5, p->pll.pclken, p->pll.pclk);
+    (*writes)++;
+  }
+  if (res < 0) {
+    return res;
+  }
+
+  if (s->pixformat == PIXFORMAT_JPEG) {
+    APPLY(quality, set_quality, int);
+  }
+  // auto modes before the manual values, which are only written when the auto mode is off
+  APPLY(aec, set_exposure_ctrl, int);
+  APPLY(aec2, set_aec2, int);
+  APPLY(ae_level, set_ae_level, int);
+  if (!p->aec) {
+    APPLY(aec_value, set_aec_value, int);
+  }
+  APPLY(agc, set_gain_ctrl, int);
+  APPLY(gainceiling, set_gainceiling, gainceiling_t);
+  if (!p->agc) {
+    APPLY(agc_gain, set_agc_gain, int);
+  }
+  APPLY(awb, set_whitebal, int);
+  APPLY(awb_gain, set_awb_gain, int);
+  APPLY(wb_mode, set_wb_mode, int);
+  APPLY(brightness, set_brightness, int);
+  APPLY(contrast, set_contrast, int);
+  APPLY(saturation, set_saturation, int);
+  APPLY(special_effect, set_special_effect, int);
+  APPLY(bpc, set_bpc, int);
+  APPLY(wpc, set_wpc, int);
+  APPLY(raw_gma, set_raw_gma, int);
+  APPLY(lenc, set_lenc, int);
+  APPLY(dcw, set_dcw, int);
+  APPLY(hmirror, set_hmirror, int);
+  APPLY(vflip, set_vflip, int);
+  APPLY(colorbar, set_colorbar, int);
+  return res;
+}
+
+bool sensor_profile_valid_name(const char *name) {
+  size_t len = strlen(name);
+  if (len == 0 || len > SENSOR_PROFILE_NAME_MAX) {
+    return false;
+  }
+  for (size_t i = 0; i < len; i++) {
+    char c = name[i];
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || (c == '_' && i > 0))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Adds or removes `name` in the comma separated list kept next to the blobs. Returns false, with
+// the list left as it was, when there's no room for the name.
+static bool profile_list_update(Preferences &prefs, const char *name, bool add) {
+  char list[SENSOR_PROFILE_LIST_MAX];
+  char out[SENSOR_PROFILE_LIST_MAX];
+  size_t n = 0;
+  bool found = false;
+  list[0] = 0;
+  out[0] = 0;
+  prefs.getString(PROFILE_LIST_KEY, list, sizeof(list));
+  for (char *item = strtok(list, ","); item; item = strtok(NULL, ",")) {
+    bool same = !strcmp(item, name);
+    found |= same;
+    if (same && !add) {
+      continue;
+    }
+    n += snprintf(out + n, sizeof(out) - n, n ? ",%s" : "%s", item);
+  }
+  if (add && !found && snprintf(out + n, sizeof(out) - n, n ? ",%s" : "%s", name) >= (int)(sizeof(out) - n)) {
+    log_e("No room for profile '%s'", name);
+    return false;
+  }
+  prefs.putString(PROFILE_LIST_KEY, out);
+  return true;
+}
+
+bool sensor_profile_save(const char *name, const sensor_profile_t *p) {
+  if (!sensor_profile_valid_name(name)) {
+    return false;
+  }
+  Preferences prefs;
+  if (!prefs.begin(PROFILE_NAMESPACE, false)) {
+    return false;
+  }
+  bool stored = prefs.isKey(name);
+  bool ok = profile_list_update(prefs, name, true);
+  if (ok && prefs.putBytes(name, p, sizeof(*p)) != sizeof(*p)) {
+    ok = false;
+    if (!stored) {
+      profile_list_update(prefs, name, false);
+    }
+  }
+  prefs.end();
+  return ok;
+}
+
+bool sensor_profile_load(const char *name, sensor_profile_t *p) {
+  if (!sensor_profile_valid_name(name)) {
+    return false;
+  }
+  Preferences prefs;
+  if (!prefs.begin(PROFILE_NAMESPACE, true)) {
+    return false;
+  }
+  bool ok = prefs.getBytesLength(name) == sizeof(*p) && prefs.getBytes(name, p, sizeof(*p)) == sizeof(*p) && p->version == SENSOR_PROFILE_VERSION;
+  prefs.end();
+  if (!ok) {
+    log_e("Profile '%s' not found or from another version", name);
+  }
+  return ok;
+}
+
+bool sensor_profile_remove(const char *name) {
+  if (!sensor_profile_valid_name(name)) {
+    return false;
+  }
+  Preferences prefs;
+  if (!prefs.begin(PROFILE_NAMESPACE, false)) {
+    return false;
+  }
+  bool ok = prefs.remove(name);
+  if (ok) {
+    profile_list_update(prefs, name, false);
+  }
+  prefs.end();
+  return ok;
+}
+
+size_t sensor_profile_list(char *out, size_t len) {
+  Preferences prefs;
+  out[0] = 0;
+  if (!prefs.begin(PROFILE_NAMESPACE, true)) {
+    return 0;
+  }
+  size_t n = prefs.getString(PROFILE_LIST_KEY, out, len);
+  prefs.end();
+  return n ? strlen(out) : 0;
+}
+
+bool sensor_profile_set_boot(const char *name) {
+  if (name[0] && !sensor_profile_valid_name(name)) {
+    return false;
+  }
+  Preferences prefs;
+  if (!prefs.begin(PROFILE_NAMESPACE, false)) {
+    return false;
+  }
+  bool ok = true;
+  if (name[0]) {
+    ok = prefs.putString(PROFILE_BOOT_KEY, name) > 0;
+  } else {
+    prefs.remove(PROFILE_BOOT_KEY);
+  }
+  prefs.end();
+  return ok;
+}
+
+size_t sensor_profile_get_boot(char *out, size_t len) {
+  Preferences prefs;
+  out[0] = 0;
+  if (!prefs.begin(PROFILE_NAMESPACE, true)) {
+    return 0;
+  }
+  size_t n = prefs.getString(PROFILE_BOOT_KEY, out, len);
+  prefs.end();
+  return n ? strlen(out) : 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_camera.h"
+
+#define SENSOR_PROFILE_VERSION  1
+#define SENSOR_PROFILE_NAME_MAX 15  // NVS key length limit
+#define SENSOR_PROFILE_LIST_MAX 256  // comma separated names of all profiles, with the terminator
+
+// A named set of sensor settings, stored as a blob in the "profiles" NVS namespace.
+// PLL and window are optional, as the driver can't read them back from the sensor.
+typedef struct {
+  uint8_t version;
+  uint8_t framesize;  // framesize_t
+  uint8_t quality;
+  int8_t brightness;
+  int8_t contrast;
+  int8_t saturation;
+  uint8_t special_effect;
+  uint8_t wb_mode;
+  uint8_t awb;
+  uint8_t awb_gain;
+  uint8_t aec;
+  uint8_t aec2;
+  int8_t ae_level;
+  uint16_t aec_value;
+  uint8_t agc;
+  uint8_t agc_gain;
+  uint8_t gainceiling;
+  uint8_t bpc;
+  uint8_t wpc;
+  uint8_t raw_gma;
+  uint8_t lenc;
+  uint8_t hmirror;
+  uint8_t vflip;
+  uint8_t dcw;
+  uint8_t colorbar;
+
+  bool has_pll;
+  struct {
+    int bypass, mul, sys, root, pre, seld5, pclken, pclk;
+  } pll;
+
+  bool has_window;
+  struct {
+    int start_x, start_y, end_x, end_y, offset_x, offset_y, total_x, total_y, output_x, output_y;
+    bool scale, binning;
+  } window;
+} sensor_profile_t;
+
+// Fills `p` from the sensor's current status (PLL and window are left unset).
+void sensor_profile_capture(sensor_t *s, sensor_profile_t *p);
+
+// Applies `p` in one pass ordered to restart the sensor pipeline as little as possible: the output
+// geometry first (window, or framesize only when it changes), then the PLL, then the plain register
+// settings, each skipped when the sensor already has that value. Returns < 0 on error and stores the
+// number of setter calls made in `writes`.
+int sensor_profile_apply(sensor_t *s, const sensor_profile_t *p, int *writes);
+
+// NVS storage. Names are 1..15 characters of [A-Za-z0-9_-]. Saving a new profile fails once its name
+// doesn't fit the list.
+bool sensor_profile_valid_name(const char *name);
+bool sensor_profile_save(const char *name, const sensor_profile_t *p);
+bool sensor_profile_load(const char *name, sensor_profile_t *p);
+bool sensor_profile_remove(const char *name);
+// Comma separated names of the stored profiles, returns the length written
+size_t sensor_profile_list(char *out, size_t len);
+
+// The profile setup() applies after esp_camera_init(), "" for none
+bool sensor_profile_set_boot(const char *name);
+size_t sensor_profile_get_boot(char *out, size_t len);
@@ -0,0 +1,74 @@
+// Sends settings over the /ws control socket: 8 byte binary commands (op, param id, seq, value),
+// answered in order, so slider moves don't each cost an HTTP request. Falls back to GET /control
+// while the socket is down or when the firmware was built without WebSocket support.
+var cameraControl = (function () {
+  const OP_SET = 1
+  const OP_REPLY = 0x80
+  let ws = null
+  let params = null
+  let seq = 0
+  const pending = new Map()
+
+  function connect () {
+    let opened = false
+    const proto = document.location.protocol === 'https:' ? 'wss:' : 'ws:'
+    ws = new WebSocket(`${proto}//${document.location.host}/ws`)
+    ws.binaryType = 'arraybuffer'
+    ws.onopen = () => {
+      opened = true
+      ws.send('params')
+    }
+    ws.onmessage = (event) => {
+      if (typeof event.data === 'string') {
+        params = new Map(event.data.split(',').map((name, id) => [name, id]))
+        return
+      }
+      const view = new DataView(event.data)
+      for (let off = 0; off + 8 <= view.byteLength; off += 8) {
+        const id = view.getUint16(off + 2, true)
+        const done = pending.get(id)
+        if (done && view.getUint8(off) === (OP_SET | OP_REPLY)) {
+          pending.delete(id)
+          done(view.getInt32(off + 4, true))
+        }
+      }
+    }
+    ws.onclose = () => {
+      ws = null
+      params = null
+      pending.forEach(done => done(-1))
+      pending.clear()
+      // only retry a socket that worked once
+      if (opened) {
+        setTimeout(connect, 2000)
+      }
+    }
+  }
+
+  function send (name, value) {
+    if (ws && ws.readyState === WebSocket.OPEN && params && params.has(name)) {
+      const id = seq = (seq + 1) & 0xffff
+      const msg = new DataView(new ArrayBuffer(8))
+      msg.setUint8(0, OP_SET)
+      msg.setUint8(1, params.get(name))
+      msg.setUint16(2, id, true)
+      msg.setInt32(4, parseInt(value), true)
+      ws.send(msg.buffer)
+      return new Promise(resolve => pending.set(id, resolve)).then(res => {
+        console.log(`${name} = ${value} finished, result: ${res}`)
+        return res
+      })
+    }
+    const query = `${document.location.origin}/control?var=${name}&val=${value}`
+    return fetch(query)
+      .then(response => {
+        console.log(`request to ${query} finished, status: ${response.status}`)
+        return response.status === 200 ? 0 : -1
+      })
+  }
+
+  if ('WebSocket' in window) {
+    connect()
+  }
+  return { send }
+})()